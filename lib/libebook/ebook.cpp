@@ -50,3 +50,52 @@ EBook * EBook::loadFile( const QString &archiveName )
 	return 0;
 }
 
+
+bool EBook::getIndexProgressively( EBookIndexSink * sink ) const
+{
+	QList<EBookIndexEntry> index;
+
+	if ( !getIndex( index ) )
+		return false;
+
+	if ( !index.isEmpty() )
+		sink->indexEntries( index );
+
+	return true;
+}
+
+bool EBook::getFileContentAsBinaryBatch( QVector<QByteArray> &data, const QList<QUrl> &urls ) const
+{
+	bool result = true;
+	data.resize( urls.size() );
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		if ( !getFileContentAsBinary( data[i], urls[i] ) )
+		{
+			data[i].clear();
+			result = false;
+		}
+		else if ( data[i].isNull() )
+			data[i] = QByteArray( "" );	// zero-length, which is not a failure
+	}
+
+	return result;
+}
+
+bool EBook::getFileContentAsStringBatch( QVector<QString> &str, const QList<QUrl> &urls ) const
+{
+	bool result = true;
+	str.resize( urls.size() );
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		if ( !getFileContentAsString( str[i], urls[i] ) )
+		{
+			str[i].clear();
+			result = false;
+		}
+	}
+
+	return result;
+}
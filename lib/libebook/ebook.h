@@ -21,6 +21,7 @@
 
 #include <QString>
 #include <QList>
+#include <QVector>
 #include <QUrl>
 
 //! Stores a single table of content entry
@@ -69,6 +70,17 @@ class EBookIndexEntry
 };
 
 
+//! Receives the index entries from EBook::getIndexProgressively() while the index is parsed
+class EBookIndexSink
+{
+	public:
+		virtual ~EBookIndexSink() {}
+
+		//! Called with the next block of the parsed entries, in the index order
+		virtual void indexEntries( const QList<EBookIndexEntry>& entries ) = 0;
+};
+
+
 //! Universal ebook files processor supporting both CHM and EPUB. Abstract.
 class EBook
 {
@@ -146,6 +158,18 @@ class EBook
 		 */
 		virtual bool getIndex( QList< EBookIndexEntry >& index ) const = 0;
 
+		/*!
+		 * \brief Parses the index table, and passes the entries to the sink in blocks while parsing,
+		 *        so the first entries could be shown before the large index is parsed completely.
+		 * \param sink Receives the blocks; together they hold the same entries as getIndex() returns.
+		 * \return true if the index is present and parsed successfully, false otherwise. In the latter
+		 *         case the blocks already received should be discarded.
+		 *
+		 * The default implementation calls getIndex(), and passes the whole index as a single block.
+		 * \ingroup fileparsing
+		 */
+		virtual bool getIndexProgressively( EBookIndexSink * sink ) const;
+
 		/*!
 		 * \brief Retrieves the content associated with the url from the current ebook as QString.
 		 * \param str A string where the retreived content should be stored.
@@ -175,6 +199,32 @@ class EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const = 0;
 
+		/*!
+		 * \brief Retrieves the content of several URLs at once. Used by the whole-book passes such as
+		 *        search index generation and content extraction.
+		 * \param data An array to store the retrieved content. It is resized to the size of \param urls,
+		 *             and the content of urls[i] is stored in data[i]. Failed entries are left null;
+		 *             the zero-length entries are empty, but not null.
+		 * \param urls A list of URLs in ebook file to retrieve content from. Must be absolute.
+		 * \return true if all the URLs were retrieved successfully; false otherwise.
+		 *
+		 * The default implementation calls getFileContentAsBinary() for each URL. The formats which
+		 * can read the archive concurrently reimplement it.
+		 *
+		 * \sa getFileContentAsBinary() getFileContentAsStringBatch()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsBinaryBatch( QVector<QByteArray>& data, const QList<QUrl>& urls ) const;
+
+		/*!
+		 * \brief Same as getFileContentAsBinaryBatch(), but the content is recoded according to current
+		 *        encoding as getFileContentAsString() does.
+		 *
+		 * \sa getFileContentAsString() getFileContentAsBinaryBatch()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsStringBatch( QVector<QString>& str, const QList<QUrl>& urls ) const;
+
 		/*!
 		 * \brief Obtains the list of all the files (URLs) in current ebook archive. This is used in search
 		 * and to dump the e-book content.
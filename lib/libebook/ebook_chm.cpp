@@ -151,25 +151,28 @@ bool EBook_CHM::getIndex(QList<EBookIndexEntry> &index) const
 	if ( !parseFileAndFillArray( encodeWithCurrentCodec(m_indexFile), parsed, true ) )
 		return false;
 
-	// Find out the root offset, and reduce the indent level to it
-	// so the index starts from zero offset.
-    int root_offset = 0;
-
 	// Fill up the real index
+	index.clear();
 	index.reserve( parsed.size() );
+	appendIndexEntries( index, parsed, 0, true );
 
-    // Find the index root offset
-    Q_FOREACH( const ParsedEntry& e, parsed )
-    {
-        if ( e.urls.empty() )
-            continue;
+	return true;
+}
 
-        root_offset = qMin( root_offset, e.indent );
-    }
+bool EBook_CHM::getIndexProgressively( EBookIndexSink * sink ) const
+{
+	QList< ParsedEntry > parsed;
 
-    // And apply the index
-	Q_FOREACH( const ParsedEntry& e, parsed )
+	return parseFileAndFillArray( encodeWithCurrentCodec(m_indexFile), parsed, true, sink );
+}
+
+void EBook_CHM::appendIndexEntries( QList<EBookIndexEntry> &index, const QList<ParsedEntry> &parsed, int from, bool atRoot ) const
+{
+	// The parser already reduces the indent levels to the root offset
+	for ( int i = from; i < parsed.size(); i++ )
 	{
+		const ParsedEntry& e = parsed[i];
+
 		if ( e.urls.empty() )
 			continue;
 
@@ -178,17 +181,14 @@ bool EBook_CHM::getIndex(QList<EBookIndexEntry> &index) const
 		entry.urls = e.urls;
 		entry.seealso = e.seealso;
 
-        // If the index array is empty, make sure the first entry is on root offset
-        if ( index.isEmpty() )
-            entry.indent = root_offset;
-        else
-            entry.indent = e.indent - root_offset;
+		// If the index array is empty, make sure the first entry is on root offset
+		if ( atRoot && index.isEmpty() )
+			entry.indent = 0;
+		else
+			entry.indent = e.indent;
 
 		index.append( entry );
-        printf("%d: %s\n", entry.indent, qPrintable(entry.name));
 	}
-
-	return true;
 }
 
 bool EBook_CHM::getFileContentAsString( QString &str, const QUrl &url ) const
@@ -201,6 +201,94 @@ bool EBook_CHM::getFileContentAsBinary( QByteArray &data, const QUrl &url ) cons
 	return getBinaryContent( data, urlToPath(url) );
 }
 
+// An object to retrieve in getFileContentAsBinaryBatch(), ordered by its location in the archive
+struct ChmBatchObject
+{
+	bool operator<( const ChmBatchObject& other ) const
+	{
+		return location < other.location;
+	}
+
+	quint64		location;
+	int			index;		// in the urls
+	chmUnitInfo	ui;
+};
+
+bool EBook_CHM::getFileContentAsBinaryBatch( QVector<QByteArray> &data, const QList<QUrl> &urls ) const
+{
+	bool result = true;
+	QVector<ChmBatchObject> objects;
+
+	data.resize( urls.size() );
+	objects.reserve( urls.size() );
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		ChmBatchObject object;
+
+		data[i].clear();
+
+		if ( !ResolveObject( urlToPath( urls[i] ), &object.ui ) )
+		{
+			result = false;
+			continue;
+		}
+
+		// The space is either uncompressed or compressed, so it takes a single bit above the offset
+		object.location = ((quint64) object.ui.space << 62) | object.ui.start;
+		object.index = i;
+		objects.push_back( object );
+	}
+
+	qSort( objects );
+
+	for ( int i = 0; i < objects.size(); i++ )
+	{
+		QByteArray& buf = data[ objects[i].index ];
+
+		// Zero-length, which is not a failure; the failed ones stay null
+		if ( objects[i].ui.length == 0 )
+		{
+			buf = QByteArray( "" );
+			continue;
+		}
+
+		buf.resize( objects[i].ui.length );
+
+		if ( !RetrieveObject( &objects[i].ui, (unsigned char*) buf.data(), 0, objects[i].ui.length ) )
+		{
+			buf.clear();
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+bool EBook_CHM::getFileContentAsStringBatch( QVector<QString> &str, const QList<QUrl> &urls ) const
+{
+	QVector<QByteArray> data;
+	bool result = getFileContentAsBinaryBatch( data, urls );
+
+	str.resize( urls.size() );
+
+	for ( int i = 0; i < data.size(); i++ )
+	{
+		str[i].clear();
+
+		// Same as getTextContent(), the empty content is a failure
+		if ( data[i].isEmpty() )
+		{
+			result = false;
+			continue;
+		}
+
+		str[i] = encodeWithCurrentCodec( data[i] );
+	}
+
+	return result;
+}
+
 bool EBook_CHM::getBinaryContent( QByteArray &data, const QString &url ) const
 {
 	chmUnitInfo ui;
@@ -374,10 +462,29 @@ int EBook_CHM::findStringInQuotes (const QString& tag, int offset, QString& valu
 }
 
 
-bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >& data, bool asIndex ) const
+void EBook_CHM::flushIndexEntries( EBookIndexSink * sink, const QList<ParsedEntry> &parsed, int &from, bool &started ) const
+{
+	QList<EBookIndexEntry> block;
+	appendIndexEntries( block, parsed, from, !started );
+	from = parsed.size();
+
+	if ( block.isEmpty() )
+		return;
+
+	started = true;
+	sink->indexEntries( block );
+}
+
+
+bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >& data, bool asIndex, EBookIndexSink * sink ) const
 {
 	QString src;
 	const int MAX_NEST_DEPTH = 256;
+	const int INDEX_BLOCK_SIZE = 2000;
+
+	// How many entries were passed to the sink, and whether any of them was an index entry
+	int sinkParsed = 0;
+	bool sinkStarted = false;
 
 	if ( !getTextContent( src, file, true ) || src.isEmpty() )
 		return false;
@@ -470,6 +577,9 @@ bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >
 
 				entry.indent = real_indent;
 				data.push_back( entry );
+
+				if ( sink && data.size() - sinkParsed >= INDEX_BLOCK_SIZE )
+					flushIndexEntries( sink, data, sinkParsed, sinkStarted );
 			}
 
 			entry.name = QString::null;
@@ -570,6 +680,9 @@ bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >
 //    for ( int i = 0; i < data.size(); i++ )
 //        qDebug() << data[i].indent << data[i].name << data[i].urls;
 
+	if ( sink )
+		flushIndexEntries( sink, data, sinkParsed, sinkStarted );
+
 	return true;
 }
 
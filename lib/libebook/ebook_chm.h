@@ -100,6 +100,13 @@ class EBook_CHM : public EBook
 		 */
 		virtual bool getIndex( QList< EBookIndexEntry >& index ) const;
 
+		/*!
+		 * \brief Parses the index table, and passes the entries to the sink every few thousand entries.
+		 * \sa EBook::getIndexProgressively()
+		 * \ingroup fileparsing
+		 */
+		virtual bool getIndexProgressively( EBookIndexSink * sink ) const;
+
 		/*!
 		 * \brief Retrieves the content associated with the url from the current ebook as QString.
 		 * \param str A string where the retreived content should be stored.
@@ -129,6 +136,28 @@ class EBook_CHM : public EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const;
 
+		/*!
+		 * \brief Retrieves the content of several URLs at once, reading them in the order they are stored in the archive.
+		 * \param data An array to store the retrieved content, in the same order as \param urls.
+		 * \param urls A list of URLs in chm file to retrieve content from. Must be absolute.
+		 * \return true if all the URLs were retrieved successfully; false otherwise.
+		 *
+		 * The documents compressed in the same LZX block are read one after another, so chmlib
+		 * decompresses each block once instead of once per document.
+		 *
+		 * \sa getFileContentAsBinary()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsBinaryBatch( QVector<QByteArray>& data, const QList<QUrl>& urls ) const;
+
+		/*!
+		 * \brief Same as getFileContentAsBinaryBatch(), but the content is recoded according to current encoding.
+		 *
+		 * \sa getFileContentAsString()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsStringBatch( QVector<QString>& str, const QList<QUrl>& urls ) const;
+
 		/*!
 		 * \brief Retrieves the content size.
 		 * \param url An URL in ebook file to retreive content from. Must be absolute.
@@ -241,7 +270,16 @@ class EBook_CHM : public EBook
 		const char * GetFontEncFromCharSet (const QString& font) const;
 
 		//! Parse the HHC or HHS file, and fill the context (asIndex is false) or index (asIndex is true) array.
-		bool  		parseFileAndFillArray (const QString& file, QList< ParsedEntry >& data, bool asIndex ) const;
+		//! If the sink is set, the index entries are also passed to it while parsing.
+		bool  		parseFileAndFillArray (const QString& file, QList< ParsedEntry >& data, bool asIndex, EBookIndexSink * sink = 0 ) const;
+
+		//! Appends the parsed index entries starting from 'from' to the index. If the index is empty, its first
+		//! entry is put on the root level.
+		void		appendIndexEntries( QList< EBookIndexEntry >& index, const QList< ParsedEntry >& parsed, int from, bool atRoot ) const;
+
+		//! Passes the index entries parsed since 'from' to the sink, and advances 'from'. The 'started' flag
+		//! tells whether the sink already received an entry, so only the very first one is put on the root level.
+		void		flushIndexEntries( EBookIndexSink * sink, const QList< ParsedEntry >& parsed, int& from, bool& started ) const;
 
 		bool		getBinaryContent( QByteArray &data, const QString &url ) const;
 		bool		getTextContent( QString& str, const QString& url, bool internal_encoding = false ) const;
@@ -23,6 +23,10 @@
 #endif
 
 #include <QMessageBox>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
 #include <QtXml/QXmlSimpleReader>
 
 #include "ebook_epub.h"
@@ -32,6 +36,98 @@
 
 static const char * URL_SCHEME_EPUB = "epub";
 
+
+// Reads the ZIP archive entry completely into the data array
+static bool readArchiveEntry( struct zip * archive, const QString& completeUrl, QByteArray &data )
+{
+	// Retrieve the file size
+	struct zip_stat fileinfo;
+
+	// http://www.nih.at/libzip/zip_stat.html
+	if ( zip_stat( archive, completeUrl.toUtf8().constData(), 0, &fileinfo) != 0 )
+	{
+		qDebug("File %s is not found in the archive", qPrintable(completeUrl));
+		return false;
+	}
+
+	// Make sure the size field is valid
+	if ( (fileinfo.valid & ZIP_STAT_SIZE) == 0 || (fileinfo.valid & ZIP_STAT_INDEX) == 0 )
+		return false;
+
+	// Open the file
+	struct zip_file * file = zip_fopen_index( archive, fileinfo.index, 0 );
+
+	if ( !file )
+		return false;
+
+	// Allocate the memory and read the file
+	data.resize( fileinfo.size );
+
+	// Could it return a positive number but not fileinfo.size???
+	int ret = zip_fread( file, data.data(), fileinfo.size );
+	if ( ret != (int) fileinfo.size )
+	{
+		zip_fclose( file );
+		return false;
+	}
+
+	zip_fclose( file );
+	return true;
+}
+
+
+// Checks whether the XML prolog declares UTF-16 encoding, which we do not support
+static bool isUtf16Xml( const QByteArray& data )
+{
+	if ( !data.startsWith("<?xml" ) )
+		return false;
+
+	int endxmltag = data.indexOf( "?>" );
+	int utf16 = data.indexOf("UTF-16");
+
+	return utf16 > 0 && utf16 < endxmltag;
+}
+
+
+// Inflates the entries of a batch using its own archive handle. Several readers share the
+// same batch, and pick up the next unprocessed entry, so the large entries do not stall the rest.
+class EpubBatchReader : public QRunnable
+{
+	public:
+		EpubBatchReader( struct zip * archive, const QStringList& paths, QByteArray * data, QAtomicInt * next, QAtomicInt * failed )
+			: m_archive( archive ), m_paths( paths ), m_data( data ), m_next( next ), m_failed( failed )
+		{
+			setAutoDelete( false );
+		}
+
+		void run()
+		{
+			while ( 1 )
+			{
+				int i = m_next->fetchAndAddOrdered( 1 );
+
+				if ( i >= m_paths.size() )
+					break;
+
+				if ( !readArchiveEntry( m_archive, m_paths[i], m_data[i] ) )
+				{
+					m_data[i].clear();
+					m_failed->ref();
+				}
+				else if ( m_data[i].isNull() )
+					m_data[i] = QByteArray( "" );	// zero-length, which is not a failure
+			}
+		}
+
+	private:
+		struct zip *		m_archive;
+		const QStringList&	m_paths;
+		QByteArray		*	m_data;
+		QAtomicInt		*	m_next;
+		QAtomicInt		*	m_failed;
+};
+
+
 EBook_EPUB::EBook_EPUB()
     : EBook()
 {
@@ -85,6 +181,9 @@ bool EBook_EPUB::load(const QString &archiveName)
 
 void EBook_EPUB::close()
 {
+	while ( !m_zipReaders.isEmpty() )
+		zip_close( m_zipReaders.takeFirst() );
+
 	if ( m_zipFile )
 	{
 		zip_close( m_zipFile );
@@ -321,18 +420,12 @@ bool EBook_EPUB::getFileAsString(QString &str, const QString &path) const
 		return false;
 
 	// I have never seen yet an UTF16 epub
-	if ( data.startsWith("<?xml" ) )
+	if ( isUtf16Xml( data ) )
 	{
-		int endxmltag = data.indexOf( "?>" );
-		int utf16 = data.indexOf("UTF-16");
-
-		if ( utf16 > 0 && utf16 < endxmltag )
-		{
-			QMessageBox::critical( 0,
-								   ("Unsupported encoding"),
-								   ("The encoding of this ebook is not supported yet. Please send it to gyunaev@ulduzsoft.com for support to be added") );
-			return false;
-		}
+		QMessageBox::critical( 0,
+							   ("Unsupported encoding"),
+							   ("The encoding of this ebook is not supported yet. Please send it to gyunaev@ulduzsoft.com for support to be added") );
+		return false;
 	}
 
 	str = QString::fromUtf8( data );
@@ -341,45 +434,123 @@ bool EBook_EPUB::getFileAsString(QString &str, const QString &path) const
 
 bool EBook_EPUB::getFileAsBinary(QByteArray &data, const QString &path) const
 {
-	// Retrieve the file size
-	struct zip_stat fileinfo;
-	QString completeUrl;
+	//qDebug("URL requested: %s (%s)", qPrintable(path), qPrintable(archivePath( path )));
+	return readArchiveEntry( m_zipFile, archivePath( path ), data );
+}
 
+QString EBook_EPUB::archivePath( const QString &path ) const
+{
 	if ( !path.isEmpty() && path[0] == '/' )
-		completeUrl = m_documentRoot + path.mid( 1 );
+		return m_documentRoot + path.mid( 1 );
 	else
-		completeUrl = m_documentRoot + path;
+		return m_documentRoot + path;
+}
 
-	//qDebug("URL requested: %s (%s)", qPrintable(path), qPrintable(completeUrl));
+struct zip * EBook_EPUB::acquireArchiveReader() const
+{
+	if ( !m_zipReaders.isEmpty() )
+		return m_zipReaders.takeFirst();
 
-	// http://www.nih.at/libzip/zip_stat.html
-	if ( zip_stat( m_zipFile, completeUrl.toUtf8().constData(), 0, &fileinfo) != 0 )
+	// Same as in load(); every reader needs its own descriptor, as they cannot share the file offset
+	QFile file( m_epubFile.fileName() );
+
+	if ( !file.open( QIODevice::ReadOnly ) )
 	{
-		qDebug("File %s is not found in the archive", qPrintable(completeUrl));
-		return false;
+		qWarning("Could not open file %s: %s", qPrintable( file.fileName() ), qPrintable( file.errorString()));
+		return 0;
 	}
 
-	// Make sure the size field is valid
-	if ( (fileinfo.valid & ZIP_STAT_SIZE) == 0 || (fileinfo.valid & ZIP_STAT_INDEX) == 0 )
-		return false;
+	int fdcopy = dup( file.handle() );
 
-	// Open the file
-	struct zip_file * file = zip_fopen_index( m_zipFile, fileinfo.index, 0 );
+	if ( fdcopy < 0 )
+	{
+		qWarning("Could not duplicate descriptor" );
+		return 0;
+	}
 
-	if ( !file )
-		return false;
+	int errcode;
+	struct zip * archive = zip_fdopen( fdcopy, 0, &errcode );
 
-	// Allocate the memory and read the file
-	data.resize( fileinfo.size );
+	if ( !archive )
+		qWarning("Could not open file %s: error %d", qPrintable( file.fileName() ), errcode);
 
-	// Could it return a positive number but not fileinfo.size???
-	int ret = zip_fread( file, data.data(), fileinfo.size );
-	if ( ret != (int) fileinfo.size )
+	return archive;
+}
+
+bool EBook_EPUB::getFileContentAsBinaryBatch( QVector<QByteArray> &data, const QList<QUrl> &urls ) const
+{
+	data.resize( urls.size() );
+
+	// Not worth starting the threads
+	if ( urls.size() < 2 )
+		return EBook::getFileContentAsBinaryBatch( data, urls );
+
+	QStringList paths;
+
+	Q_FOREACH( const QUrl& url, urls )
+		paths.push_back( archivePath( urlToPath( url ) ) );
+
+	// Get the archive handles for all the readers before starting any of them
+	int numreaders = qBound( 1, QThread::idealThreadCount(), urls.size() );
+	QList<struct zip *> readers;
+
+	while ( readers.size() < numreaders )
 	{
-		zip_fclose( file );
-		return false;
+		struct zip * archive = acquireArchiveReader();
+
+		if ( !archive )
+			break;
+
+		readers.push_back( archive );
 	}
 
-	zip_fclose( file );
-	return true;
+	if ( readers.isEmpty() )
+		return EBook::getFileContentAsBinaryBatch( data, urls );
+
+	QAtomicInt next( 0 ), failed( 0 );
+	QList<EpubBatchReader*> tasks;
+	QThreadPool pool;
+
+	pool.setMaxThreadCount( readers.size() );
+
+	Q_FOREACH( struct zip * archive, readers )
+	{
+		tasks.push_back( new EpubBatchReader( archive, paths, data.data(), &next, &failed ) );
+		pool.start( tasks.last() );
+	}
+
+	pool.waitForDone();
+
+	qDeleteAll( tasks );
+	m_zipReaders += readers;
+
+	return failed.load() == 0;
+}
+
+bool EBook_EPUB::getFileContentAsStringBatch( QVector<QString> &str, const QList<QUrl> &urls ) const
+{
+	QVector<QByteArray> data;
+	bool result = getFileContentAsBinaryBatch( data, urls );
+
+	str.resize( urls.size() );
+
+	for ( int i = 0; i < data.size(); i++ )
+	{
+		str[i].clear();
+
+		if ( data[i].isEmpty() )
+			continue;
+
+		// See getFileAsString(); we cannot show the message box for each file here
+		if ( isUtf16Xml( data[i] ) )
+		{
+			qWarning( "The encoding of %s is not supported yet", qPrintable( urls[i].toString() ) );
+			result = false;
+			continue;
+		}
+
+		str[i] = QString::fromUtf8( data[i] );
+	}
+
+	return result;
 }
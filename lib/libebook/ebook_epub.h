@@ -126,6 +126,28 @@ class EBook_EPUB : public EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const;
 
+		/*!
+		 * \brief Retrieves the content of several URLs at once, inflating the ZIP entries in parallel.
+		 * \param data An array to store the retrieved content, in the same order as \param urls.
+		 * \param urls A list of URLs in ebook file to retrieve content from. Must be absolute.
+		 * \return true if all the URLs were retrieved successfully; false otherwise.
+		 *
+		 * Each worker thread uses its own read handle to the archive, so the entries are inflated
+		 * independently. The handles are kept open until the ebook is closed.
+		 *
+		 * \sa getFileContentAsBinary()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsBinaryBatch( QVector<QByteArray>& data, const QList<QUrl>& urls ) const;
+
+		/*!
+		 * \brief Same as getFileContentAsBinaryBatch(), but the content is converted from UTF-8.
+		 *
+		 * \sa getFileContentAsString()
+		 * \ingroup dataretrieve
+		 */
+		virtual bool getFileContentAsStringBatch( QVector<QString>& str, const QList<QUrl>& urls ) const;
+
 		/*!
 		 * \brief Obtains the list of all the files (URLs) in current ebook archive. This is used in search
 		 * and to dump the e-book content.
@@ -187,10 +209,19 @@ class EBook_EPUB : public EBook
 		bool	getFileAsString( QString& str, const QString& path ) const;
 		bool	getFileAsBinary( QByteArray& data, const QString& path ) const;
 
+		// Converts the path to the full path of ZIP archive entry
+		QString	archivePath( const QString& path ) const;
+
+		// Opens an independent read handle to the ZIP archive, or takes one kept from previous batch
+		struct zip *	acquireArchiveReader() const;
+
 		// ZIP archive fd and structs
 		QFile			m_epubFile;
 		struct zip *	m_zipFile;
 
+		// Additional read handles used by the batch readers; each one is used by a single thread at a time
+		mutable QList<struct zip *>	m_zipReaders;
+
 		// Ebook info
 		QString			m_title;
 		QString			m_documentRoot;
@@ -0,0 +1,357 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include "ebook_library_search.h"
+
+// How much memory the loaded indexes may take by default
+static const qint64 DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+
+// The state of a single library query, shared by the tasks searching the books
+struct LibrarySearchState
+{
+	int									serial;
+	QString								query;
+	int									limit;
+	QtAs::QueryControl					control;
+	QMutex								mutex;
+	QList< EBookLibrarySearch::Result >	results;
+	bool								invalid;	// the query could not be parsed
+	int									total;		// the number of the books
+	int									searched;	// only used in the library thread
+};
+
+
+// Searches in a single book of the library
+class LibrarySearchTask : public QRunnable
+{
+	public:
+		LibrarySearchTask( EBookLibrarySearch * library, EBookLibrarySearch::Book * book, QSharedPointer<LibrarySearchState> state )
+			: m_library( library ), m_book( book ), m_state( state ) {}
+
+		void run()
+		{
+			if ( !m_state->control.isStopped() )
+				search();
+
+			QMetaObject::invokeMethod( m_library, "onBookSearched", Qt::QueuedConnection, Q_ARG( int, m_state->serial ) );
+		}
+
+	private:
+		void search()
+		{
+			QSharedPointer<EBookSearch> engine = m_library->acquireBook( m_book );
+
+			if ( !engine )
+				return;
+
+			QList< EBookSearch::Match > matches;
+
+			if ( !engine->searchQueryRanked( m_state->query, &matches, m_state->limit, &m_state->control ) )
+			{
+				QMutexLocker locker( &m_state->mutex );
+
+				if ( !m_state->control.isCancelled() )
+					m_state->invalid = true;
+
+				return;
+			}
+
+			QMutexLocker locker( &m_state->mutex );
+
+			for ( int i = 0; i < matches.size(); i++ )
+			{
+				EBookLibrarySearch::Result result;
+				result.ebook = m_book->ebookFile;
+				result.url = matches[i].url;
+				result.title = matches[i].title;
+				result.score = matches[i].score;
+				m_state->results.push_back( result );
+			}
+		}
+
+		EBookLibrarySearch			*	m_library;
+		EBookLibrarySearch::Book	*	m_book;
+		QSharedPointer<LibrarySearchState>	m_state;
+};
+
+
+static bool resultMoreRelevant( const EBookLibrarySearch::Result& a, const EBookLibrarySearch::Result& b )
+{
+	return a.score > b.score;
+}
+
+
+EBookLibrarySearch::EBookLibrarySearch()
+{
+	m_memoryBudget = DEFAULT_MEMORY_BUDGET;
+	m_memoryUsed = 0;
+	m_usageCounter = 0;
+	m_querySerial = 0;
+}
+
+
+EBookLibrarySearch::~EBookLibrarySearch()
+{
+	// Only the index being read delays it; the searches are cancelled
+	cancelQuery();
+	m_pool.waitForDone();
+	qDeleteAll( m_books );
+}
+
+
+void EBookLibrarySearch::addBook( const QString& ebookFile, const QString& indexFile )
+{
+	Book * book = new Book();
+	book->ebookFile = ebookFile;
+	book->indexFile = indexFile;
+
+	QMutexLocker locker( &m_mutex );
+	m_books.push_back( book );
+}
+
+
+void EBookLibrarySearch::clear()
+{
+	cancelQuery();
+	m_pool.waitForDone();
+	m_results.clear();
+
+	QMutexLocker locker( &m_mutex );
+	qDeleteAll( m_books );
+	m_books.clear();
+	m_memoryUsed = 0;
+}
+
+
+int EBookLibrarySearch::bookCount() const
+{
+	QMutexLocker locker( &m_mutex );
+	return m_books.size();
+}
+
+
+void EBookLibrarySearch::setMemoryBudget( qint64 bytes )
+{
+	QMutexLocker locker( &m_mutex );
+	m_memoryBudget = bytes;
+	enforceMemoryBudget( 0 );
+}
+
+
+void EBookLibrarySearch::startQuery( const QString& query, int limit )
+{
+	cancelQuery();
+
+	QSharedPointer<LibrarySearchState> state( new LibrarySearchState() );
+	state->serial = ++m_querySerial;
+	state->query = query;
+	state->limit = limit;
+	state->invalid = false;
+	state->searched = 0;
+
+	m_mutex.lock();
+	QList< Book* > books = m_books;
+	m_mutex.unlock();
+
+	state->total = books.size();
+	m_query = state;
+
+	// Every book is searched in its own task; each returns its own best results, so the best
+	// results of the whole library are among them
+	for ( int i = 0; i < books.size(); i++ )
+		m_pool.start( new LibrarySearchTask( this, books[i], state ) );
+
+	// Nothing to search; finished as if the last book was searched
+	if ( books.isEmpty() )
+		QMetaObject::invokeMethod( this, "onBookSearched", Qt::QueuedConnection, Q_ARG( int, state->serial ) );
+}
+
+
+void EBookLibrarySearch::cancelQuery()
+{
+	if ( !m_query )
+		return;
+
+	// The tasks still running keep the state
+	m_query->control.cancel();
+	m_query.clear();
+}
+
+
+void EBookLibrarySearch::onBookSearched( int serial )
+{
+	// Was it cancelled, or superseded by a newer query?
+	if ( !m_query || m_query->serial != serial )
+		return;
+
+	if ( ++m_query->searched < m_query->total )
+	{
+		emit queryProgress( m_query->searched, m_query->total );
+		return;
+	}
+
+	QSharedPointer<LibrarySearchState> state = m_query;
+	m_query.clear();
+
+	// All the tasks are done, so the state is not used by them anymore
+	m_results.clear();
+
+	if ( state->invalid )
+	{
+		emit queryFinished( false );
+		return;
+	}
+
+	qStableSort( state->results.begin(), state->results.end(), resultMoreRelevant );
+
+	for ( int i = 0; i < state->results.size() && i < state->limit; i++ )
+		m_results.push_back( state->results[i] );
+
+	emit queryFinished( true );
+}
+
+
+QString EBookLibrarySearch::getSnippet( const QString& ebookFile, const QUrl& url, const QString& query, int maxlength )
+{
+	QSharedPointer<EBookSearch> engine;
+
+	m_mutex.lock();
+
+	for ( int i = 0; i < m_books.size(); i++ )
+	{
+		if ( m_books[i]->ebookFile == ebookFile )
+		{
+			engine = m_books[i]->search;
+			break;
+		}
+	}
+
+	m_mutex.unlock();
+
+	// It is called while the results are painted, so the index is never read here
+	return engine ? engine->getSnippet( url, query, maxlength ) : QString();
+}
+
+
+QSharedPointer<EBookSearch> EBookLibrarySearch::acquireBook( Book * book )
+{
+	QMutexLocker locker( &m_mutex );
+
+	// Another query is reading this index
+	while ( book->loading )
+		m_loaded.wait( &m_mutex );
+
+	if ( book->search )
+	{
+		book->lastUsed = ++m_usageCounter;
+		return book->search;
+	}
+
+	QFileInfo indexinfo( book->indexFile );
+	QDateTime indextime = indexinfo.lastModified();
+
+	// No index, or the same index which could not be read before
+	if ( !indextime.isValid() || indextime == book->failedIndexTime )
+		return QSharedPointer<EBookSearch>();
+
+	// The loaded index takes about as much memory as its file. The memory is reserved before reading,
+	// so the indexes read in parallel do not exceed the budget together.
+	qint64 reserved = indexinfo.size();
+	book->loading = true;
+	book->memory = reserved;
+	m_memoryUsed += reserved;
+	enforceMemoryBudget( book );
+
+	// The index is read without holding the lock, so several books are loaded in parallel
+	locker.unlock();
+
+	EBookSearch * engine = new EBookSearch();
+	QFile file( book->indexFile );
+	bool loaded = false;
+
+	if ( file.open( QIODevice::ReadOnly ) )
+	{
+		QDataStream stream( &file );
+		loaded = engine->loadIndex( stream );
+	}
+
+	// The engine is used by the tasks and destroyed in the library thread, so it belongs there
+	if ( loaded )
+		engine->moveToThread( thread() );
+	else
+		delete engine;
+
+	locker.relock();
+
+	book->loading = false;
+	m_loaded.wakeAll();
+	m_memoryUsed -= reserved;
+	book->memory = 0;
+
+	if ( !loaded )
+	{
+		qWarning( "Library search: could not read the search index %s", qPrintable( book->indexFile ) );
+		book->failedIndexTime = indextime;
+		return QSharedPointer<EBookSearch>();
+	}
+
+	book->search = QSharedPointer<EBookSearch>( engine, &QObject::deleteLater );
+	book->memory = engine->memoryUsage();
+	m_memoryUsed += book->memory;
+	book->lastUsed = ++m_usageCounter;
+
+	enforceMemoryBudget( book );
+
+	QSharedPointer<EBookSearch> search = book->search;
+	locker.unlock();
+
+	emit indexLoaded( book->indexFile );
+	return search;
+}
+
+
+void EBookLibrarySearch::enforceMemoryBudget( Book * keep )
+{
+	while ( m_memoryUsed > m_memoryBudget )
+	{
+		Book * oldest = 0;
+
+		for ( int i = 0; i < m_books.size(); i++ )
+		{
+			Book * book = m_books[i];
+
+			if ( book != keep && book->search && (!oldest || book->lastUsed < oldest->lastUsed) )
+				oldest = book;
+		}
+
+		if ( !oldest )
+			break;
+
+		// The queries still using it keep their own reference, so it is deleted when they are done. The books
+		// being read have no engine yet, so their reserved memory stays.
+		m_memoryUsed -= oldest->memory;
+		oldest->search.clear();
+		oldest->memory = 0;
+	}
+}
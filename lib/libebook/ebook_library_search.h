@@ -0,0 +1,136 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBOOK_LIBRARY_SEARCH_H
+#define EBOOK_LIBRARY_SEARCH_H
+
+#include <QDateTime>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "ebook_search.h"
+
+class LibrarySearchTask;
+struct LibrarySearchState;
+
+//! Searches in many ebooks at once, using their previously generated search indexes. The ebooks themselves
+//! are not opened. The indexes are read when first needed, and the least recently used ones are unloaded
+//! when the memory budget is exceeded.
+//!
+//! The queries run in the thread pool, and the results are returned by the queryFinished() signal, so the
+//! calling thread is never blocked. The loaded search engines belong to the thread the library was created in.
+class EBookLibrarySearch : public QObject
+{
+	Q_OBJECT
+
+	public:
+		//! A document found in the library
+		struct Result
+		{
+			QString		ebook;	// the ebook file name
+			QUrl		url;
+			QString		title;	// may be empty
+			int			score;	// the higher the more relevant
+		};
+
+		EBookLibrarySearch();
+		~EBookLibrarySearch();
+
+		//! Adds the ebook \param ebookFile to the library. Its search index is read from \param indexFile,
+		//! which is created by EBookSearch::generateIndex(); the ebooks without the index are not searched.
+		void	addBook( const QString& ebookFile, const QString& indexFile );
+
+		//! Removes all the books and unloads their indexes
+		void	clear();
+
+		//! Returns the number of books in the library
+		int		bookCount() const;
+
+		//! Sets how much memory the loaded indexes may take, in bytes
+		void	setMemoryBudget( qint64 bytes );
+
+		//! Starts the search \param query (see EBookSearch::searchQuery()) in all the books in parallel, and
+		//! returns at once. The progress is reported by queryProgress(), and the completion by queryFinished();
+		//! then up to \param limit most relevant documents of all the books are returned by queryResults().
+		//! The query started before is cancelled.
+		void	startQuery( const QString& query, int limit = 100 );
+
+		//! Cancels the running query; queryFinished() is not emitted for it
+		void	cancelQuery();
+
+		//! Returns the documents found by the last finished query, sorted by relevance
+		QList< Result >	queryResults() const { return m_results; }
+
+		//! Returns the snippet of the document found by the query; see EBookSearch::getSnippet(). The index
+		//! is not read for it, so if the book was unloaded since, the snippet is empty.
+		QString	getSnippet( const QString& ebookFile, const QUrl& url, const QString& query, int maxlength = 200 );
+
+	signals:
+		//! \param searched of \param total books are searched by the running query
+		void	queryProgress( int searched, int total );
+
+		//! The query has finished; \param success is false if the query is not valid
+		void	queryFinished( bool success );
+
+		//! The search index \param indexFile was read from disk; emitted from the pool thread
+		void	indexLoaded( const QString& indexFile );
+
+	private slots:
+		void	onBookSearched( int serial );
+
+	private:
+		friend class LibrarySearchTask;
+
+		struct Book
+		{
+			Book() : memory( 0 ), lastUsed( 0 ), loading( false ) {}
+
+			QString						ebookFile;
+			QString						indexFile;
+			QSharedPointer<EBookSearch>	search;			// null if not loaded
+			qint64						memory;			// used by the loaded index, or reserved for the one being read
+			quint64						lastUsed;
+			QDateTime					failedIndexTime;	// the index modification time if it could not be read
+			bool						loading;		// the index is being read by a task
+		};
+
+		// Returns the book search engine, loading its index if needed; null if there is no usable index
+		QSharedPointer<EBookSearch>	acquireBook( Book * book );
+
+		// Unloads the least recently used books, except the keep one, until the budget is met; the mutex must be held
+		void	enforceMemoryBudget( Book * keep );
+
+		mutable QMutex		m_mutex;
+		QWaitCondition		m_loaded;		// signalled when a book index is read
+		QList< Book* >		m_books;
+		qint64				m_memoryBudget;
+		qint64				m_memoryUsed;
+		quint64				m_usageCounter;
+
+		QThreadPool			m_pool;
+
+		// The running query, and the results of the last finished one
+		QSharedPointer<LibrarySearchState>	m_query;
+		int					m_querySerial;
+		QList< Result >		m_results;
+};
+
+#endif // EBOOK_LIBRARY_SEARCH_H
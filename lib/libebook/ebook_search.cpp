@@ -17,61 +17,100 @@
  */
 
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QRunnable>
+#include <QTextCodec>
+#include <QThreadPool>
+#include <QWriteLocker>
+
+#include <stdio.h>
 
 #include "ebook.h"
 #include "ebook_search.h"
+#include "helper_search_scan.h"
+
+// How many query results are kept in cache
+static const int QUERY_CACHE_SIZE = 64;
+
+// Separator of the conjuncts in the query cache keys
+static const QChar CACHE_KEY_SEPARATOR = QChar( 0x01 );
+
+// How many documents scanQuery() reads at once
+static const int SCAN_BATCH_SIZE = 64;
 
-// Helper class to simplity state management and data keeping
-class SearchDataKeeper
+// Maximum length of the scanQuery() snippets
+static const int SCAN_SNIPPET_LENGTH = 200;
+
+
+static bool isHtmlDocument( const QUrl& url )
 {
-	public:
-		SearchDataKeeper() { m_inPhrase = false; }
+	QString docpath = url.path();
 
-		void beginPhrase()
+	return docpath.endsWith( ".html", Qt::CaseInsensitive )
+		|| docpath.endsWith( ".htm", Qt::CaseInsensitive )
+		|| docpath.endsWith( ".xhtml", Qt::CaseInsensitive );
+}
+
+
+// Scans the text of a single document in scanQuery()
+class ScanTask : public QRunnable
+{
+	public:
+		ScanTask( EBookSearch * search, const QUrl& url, const QString& html, const QString& needle, bool caseSensitive,
+				  const HelperEntityDecoder * decoder, const QtAs::QueryControl * control )
+			: m_search( search ), m_url( url ), m_html( html ), m_needle( needle ), m_caseSensitive( caseSensitive ),
+			  m_decoder( decoder ), m_control( control )
 		{
-			phrase_terms.clear();
-			m_inPhrase = true;
 		}
 
-		void endPhrase()
+		void run()
 		{
-			m_inPhrase = false;
-			phrasewords += phrase_terms;
-			phrases.push_back( phrase_terms.join(" ") );
-		}
+			if ( m_control && m_control->isStopped() )
+				return;
 
-		bool isInPhrase() const { return m_inPhrase; }
+			QString text = QtAs::htmlToPlainText( m_html, *m_decoder );
+			QString haystack = m_caseSensitive ? text : text.toLower();
+			int count = 0, first = -1;
 
-		void addTerm( const QString& term )
-		{
-			if ( !term.isEmpty() )
+			for ( int pos = QtAs::findText( haystack.constData(), haystack.length(), m_needle.constData(), m_needle.length(), 0 );
+				  pos != -1;
+				  pos = QtAs::findText( haystack.constData(), haystack.length(), m_needle.constData(), m_needle.length(), pos + m_needle.length() ) )
 			{
-				terms.push_back( term );
+				if ( first == -1 )
+					first = pos;
 
-				if ( m_inPhrase )
-					phrase_terms.push_back( term );
+				count++;
 			}
-		}
 
-		// Should contain all the search terms present in query, includind those from phrases. One element - one term .
-		QStringList terms;
+			if ( count == 0 )
+				return;
 
-		// Should contain phrases present in query without quotes. One element - one phrase.
-		QStringList phrases;
+			// A few characters change their length in lower case, so the positions would not match the original text
+			const QString& shown = haystack.length() == text.length() ? text : haystack;
 
-		// Should contain all the terms present in all the phrases (but not outside).
-		QStringList phrasewords;
+			emit m_search->scanMatch( m_url, count, QtAs::scanSnippet( shown, haystack, m_needle, first, SCAN_SNIPPET_LENGTH ) );
+		}
 
 	private:
-		bool		m_inPhrase;
-		QStringList phrase_terms;
+		EBookSearch					*	m_search;
+		QUrl							m_url;
+		QString							m_html;
+		QString							m_needle;
+		bool							m_caseSensitive;
+		const HelperEntityDecoder	*	m_decoder;
+		const QtAs::QueryControl	*	m_control;
 };
 
 
-
 EBookSearch::EBookSearch()
 {
 	m_Index = 0;
+	m_generatedIndex = 0;
+	m_substringIndexEnabled = false;
+	m_indexMemoryBudget = 0;
+	m_queryCache.setMaxCost( QUERY_CACHE_SIZE );
 }
 
 
@@ -83,14 +122,15 @@ EBookSearch::~ EBookSearch()
 
 bool EBookSearch::loadIndex( QDataStream & stream )
 {
-	delete m_Index;
+	QtAs::Index * index = new QtAs::Index();
+	bool result = index->readDict( stream );
 
-	m_Index = new QtAs::Index();
-	return m_Index->readDict( stream );
+	setIndex( index );
+	return result;
 }
 
 
-bool EBookSearch::generateIndex( EBook * ebookFile, QDataStream & stream )
+bool EBookSearch::generateIndex( EBook * ebookFile, QDataStream & stream, QDataStream * previous )
 {
 	QList< QUrl > documents;
 	QList< QUrl > alldocuments;
@@ -102,40 +142,87 @@ bool EBookSearch::generateIndex( EBook * ebookFile, QDataStream & stream )
 	if ( !ebookFile->enumerateFiles( alldocuments ) )
 		return false;
 			
-	if ( m_Index )
-		delete m_Index;
-
-	m_Index = new QtAs::Index();
-	connect( m_Index, SIGNAL( indexingProgress( int, const QString& ) ), this, SLOT( updateProgress( int, const QString& ) ) );
+	// The new index is built aside, so the queries running in other threads are not affected
+	m_generatedIndex = new QtAs::Index();
+	m_generatedIndex->setTrigramsEnabled( m_substringIndexEnabled );
+	m_generatedIndex->setMemoryBudget( m_indexMemoryBudget );
+	connect( m_generatedIndex, SIGNAL( indexingProgress( int, const QString& ) ), this, SLOT( updateProgress( int, const QString& ) ) );
 	
 	// Process the list of files in CHM archive and keep only HTML document files from there
 	for ( int i = 0; i < alldocuments.size(); i++ )
 	{
-		QString docpath = alldocuments[i].path();
-
-		if ( docpath.endsWith( ".html", Qt::CaseInsensitive )
-		|| docpath.endsWith( ".htm", Qt::CaseInsensitive )
-		|| docpath.endsWith( ".xhtml", Qt::CaseInsensitive ) )
+		if ( isHtmlDocument( alldocuments[i] ) )
 			documents.push_back( alldocuments[i] );
 	}
 
-    if ( !m_Index->makeIndex( documents, ebookFile ) )
+	// The index of the previous revision is only used to copy the postings of the unchanged documents
+	QtAs::Index * previousIndex = 0;
+
+	if ( previous )
+	{
+		emit progressStep( 0, "Reading the previous index" );
+		processEvents();
+
+		previousIndex = new QtAs::Index();
+
+		if ( !previousIndex->readDict( *previous ) )
+		{
+			delete previousIndex;
+			previousIndex = 0;
+		}
+	}
+
+	QtAs::Index * index = m_generatedIndex;
+	bool result = index->makeIndex( documents, ebookFile, previousIndex );
+
+	delete previousIndex;
+	m_generatedIndex = 0;
+
+    if ( !result )
 	{
-		delete m_Index;
-		m_Index = 0;
+		delete index;
+		setIndex( 0 );
 		return false;
 	}
 	
-	m_Index->writeDict( stream );
+	// The index built with the memory limit is merged from the temporary files while it is written,
+	// and is not kept in memory
+	bool spilled = index->isSpilled();
+	bool written = index->writeDict( stream );
+
+	if ( !written || spilled )
+	{
+		delete index;
+		setIndex( 0 );
+	}
+	else
+		setIndex( index );
+
 	m_keywordDocuments.clear();
-	
-	return true;
+	return written;
+}
+
+
+void EBookSearch::setIndex( QtAs::Index * index )
+{
+	QWriteLocker locker( &m_indexLock );
+
+	delete m_Index;
+	m_Index = index;
+
+	// The index moves with the engine if the engine is moved to another thread
+	if ( m_Index )
+		m_Index->setParent( this );
+
+	QMutexLocker cachelocker( &m_cacheMutex );
+	m_queryCache.clear();
 }
 
 
 void EBookSearch::cancelIndexGeneration()
 {
-	m_Index->setLastWinClosed();
+	if ( m_generatedIndex )
+		m_generatedIndex->setLastWinClosed();
 }
 
 
@@ -151,75 +238,417 @@ void EBookSearch::processEvents()
 		qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
 }
 
-bool EBookSearch::searchQuery(const QString & query, QList< QUrl > * results, EBook *ebookFile, unsigned int limit)
+QtAs::QueryNode * EBookSearch::parseQuery( const QString& query, bool lastTermIsPrefix ) const
+{
+	QtAs::QueryParser parser( m_Index->getCharsSplit(), m_Index->getCharsPartOfWord() );
+	return parser.parse( query, lastTermIsPrefix );
+}
+
+bool EBookSearch::searchQuery(const QString & query, QList< QUrl > * results, EBook *, unsigned int limit, QtAs::QueryControl * control, bool lastTermIsPrefix, const QtAs::DocIdSet * scope )
+{
+	QReadLocker locker( &m_indexLock );
+	QVector< QtAs::Document > foundDocs;
+
+	if ( !findDocuments( query, foundDocs, control, lastTermIsPrefix, scope ) )
+		return false;
+
+	for ( int i = 0; i < foundDocs.size() && limit > 0; i++, limit-- )
+		results->push_back( m_Index->getDocumentUrl( foundDocs[i].docNumber ) );
+
+	return true;
+}
+
+bool EBookSearch::searchQueryRanked( const QString& query, QList< Match > * results, unsigned int limit, QtAs::QueryControl * control, bool lastTermIsPrefix, const QtAs::DocIdSet * scope )
+{
+	QReadLocker locker( &m_indexLock );
+	QVector< QtAs::Document > foundDocs;
+
+	if ( !findDocuments( query, foundDocs, control, lastTermIsPrefix, scope ) )
+		return false;
+
+	for ( int i = 0; i < foundDocs.size() && limit > 0; i++, limit-- )
+	{
+		Match match;
+		match.url = m_Index->getDocumentUrl( foundDocs[i].docNumber );
+		match.title = m_Index->getDocumentTitle( foundDocs[i].docNumber );
+		match.score = foundDocs[i].frequency;
+		results->push_back( match );
+	}
+
+	return true;
+}
+
+QtAs::DocIdSet EBookSearch::documentSet( const QList<QUrl>& urls ) const
+{
+	QReadLocker locker( &m_indexLock );
+
+	if ( !m_Index )
+		return QtAs::DocIdSet();
+
+	return m_Index->getDocumentSet( urls );
+}
+
+// Returns the documents which are in the scope, keeping their order
+static QVector< QtAs::Document > documentsInScope( const QVector< QtAs::Document >& documents, const QtAs::DocIdSet& scope )
+{
+	QVector< QtAs::Document > result;
+
+	for ( int i = 0; i < documents.size(); i++ )
+	{
+		if ( scope.contains( documents[i].docNumber ) )
+			result.push_back( documents[i] );
+	}
+
+	return result;
+}
+
+bool EBookSearch::findDocuments( const QString& query, QVector< QtAs::Document >& foundDocs, QtAs::QueryControl * control, bool lastTermIsPrefix,
+								 const QtAs::DocIdSet * scope )
 {
 	// We should have index
 	if ( !m_Index )
 		return false;
 	
-	// Characters which split the words. We need to make them separate tokens
-	QString splitChars = m_Index->getCharsSplit();
-	
-	// Characters which are part of the word. We should keep them apart.
-	QString partOfWordChars = m_Index->getCharsPartOfWord();
+	QtAs::QueryNode * root = parseQuery( query, lastTermIsPrefix );
+
+	if ( !root )
+		return false;
 	
-	// Variables to store current state
-	SearchDataKeeper keeper;	
-	QString term;
+	// Normalize the query, so the same conjuncts in different order share the cache entry
+	QStringList conjuncts;
+
+	Q_FOREACH( const QtAs::QueryNode * node, root->conjuncts() )
+		conjuncts.push_back( node->toString() );
+
+	conjuncts.removeDuplicates();
+	conjuncts.sort();
 
-	for ( int i = 0; i < query.length(); i++ )
+	QString key = conjuncts.join( CACHE_KEY_SEPARATOR );
+	QVector< QtAs::Document > basedocs;
+	bool cached = false, hasbase = false;
+
+	// The cache lock is not held while the query runs, so the queries from other threads are not delayed
+	m_cacheMutex.lock();
+
+	if ( m_queryCache.contains( key ) )
+	{
+		foundDocs = m_queryCache.object( key )->documents;
+		cached = true;
+	}
+	else
 	{
-		QChar ch = query[i].toLower();
-		
-		// a quote either begins or ends the phrase
-		if ( ch == '"' )
+		QString basekey = findCachedSubquery( conjuncts );
+
+		if ( !basekey.isEmpty() )
 		{
-			keeper.addTerm( term );
-			
-			if ( keeper.isInPhrase() )
-				keeper.endPhrase();
+			basedocs = m_queryCache.object( basekey )->documents;
+			hasbase = true;
+		}
+	}
+
+	m_cacheMutex.unlock();
+
+	// The results for the whole ebook are cached, and those in the scope are picked from them
+	if ( cached && scope )
+		foundDocs = documentsInScope( foundDocs, *scope );
+
+	if ( !cached )
+	{
+		// Only the scope documents are checked, or only those of them found by the cached subquery
+		if ( scope )
+		{
+			if ( hasbase )
+				basedocs = documentsInScope( basedocs, *scope );
 			else
-				keeper.beginPhrase();
+			{
+				QVector<qint32> numbers = scope->toVector();
 
-			continue;
+				for ( int i = 0; i < numbers.size(); i++ )
+					basedocs.push_back( QtAs::Document( numbers[i], 0 ) );
+
+				hasbase = true;
+			}
 		}
-		
-		// If new char does not stop the word, add ot and continue
-		if ( ch.isLetterOrNumber() || partOfWordChars.indexOf( ch ) != -1 )
+
+		// If this query only adds conditions to the cached one, the results are among the cached results.
+		// The whole query is still evaluated on them, so the scores include all the terms.
+		foundDocs = m_Index->query( root, hasbase ? &basedocs : 0, control );
+
+		// Incomplete results should not be reused, and neither should the results only for the scope
+		if ( control && control->isStopped() )
 		{
-			term.append( ch );
-			continue;
+			if ( control->isCancelled() )
+			{
+				delete root;
+				return false;
+			}
 		}
-		
-		// If it is a split char, add this term and split char as separate term
-		if ( splitChars.indexOf( ch ) != -1 )
+		else if ( !scope )
 		{
-			// Add existing term if present
-			keeper.addTerm( term );
-			
-			// Change the term variable, so it will be added when we exit this block
-			term = ch;
-		}
+			QueryCacheEntry * entry = new QueryCacheEntry;
+			entry->conjuncts = conjuncts;
+			entry->documents = foundDocs;
 
-		// Just add the word; it is most likely a space or terminated by tokenizer.
-		keeper.addTerm( term );
-		term = QString::null;			
+			QMutexLocker cachelocker( &m_cacheMutex );
+			m_queryCache.insert( key, entry );
+		}
 	}
 	
-	keeper.addTerm( term );
-	
-	if ( keeper.isInPhrase() )
+	delete root;
+	return true;
+}
+
+// Checks whether all the documents matching the cached conjunct also match one of the conjuncts
+static bool isConjunctCovered( const QString& cached, const QStringList& conjuncts )
+{
+	if ( conjuncts.contains( cached ) )
+		return true;
+
+	// The prefix matches all the words starting with it, including the longer prefixes.
+	// The phrases, groups and negations contain spaces, quotes or brackets.
+	if ( cached.length() > 1 && cached.endsWith( '*' ) && !cached.contains( ' ' )
+	&& !cached.startsWith( '"' ) && !cached.startsWith( '(' ) )
+	{
+		QString prefix = cached.left( cached.length() - 1 );
+
+		Q_FOREACH( const QString& conjunct, conjuncts )
+		{
+			if ( conjunct.startsWith( prefix ) && !conjunct.contains( ' ' ) )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+QString EBookSearch::findCachedSubquery( const QStringList& conjuncts ) const
+{
+	QString bestkey;
+	int bestcount = 0;
+
+	// The keys are checked without accessing the entries, so the cache usage order is not affected
+	Q_FOREACH( const QString& key, m_queryCache.keys() )
+	{
+		QStringList cached = key.split( CACHE_KEY_SEPARATOR, QString::SkipEmptyParts );
+
+		// The more conjuncts the cached query has, the fewer documents it would likely match
+		if ( cached.isEmpty() || cached.size() <= bestcount || cached.size() > conjuncts.size() )
+			continue;
+
+		bool subset = true;
+
+		for ( int i = 0; i < cached.size() && subset; i++ )
+			subset = isConjunctCovered( cached[i], conjuncts );
+
+		if ( subset )
+		{
+			bestkey = key;
+			bestcount = cached.size();
+		}
+	}
+
+	return bestkey;
+}
+
+QString EBookSearch::getSnippet( const QUrl& url, const QString& query, int maxlength, bool lastTermIsPrefix ) const
+{
+	QReadLocker locker( &m_indexLock );
+
+	if ( !m_Index )
+		return QString();
+
+	QtAs::QueryNode * root = parseQuery( query, lastTermIsPrefix );
+
+	if ( !root )
+		return QString();
+
+	QStringList terms;
+	root->collectTerms( terms );
+	delete root;
+
+	return m_Index->getSnippet( url, terms, maxlength );
+}
+
+bool EBookSearch::runBenchmark( int iterations )
+{
+	QReadLocker locker( &m_indexLock );
+
+	if ( !m_Index )
 		return false;
-	
-	QList< QUrl > foundDocs = m_Index->query( keeper.terms, keeper.phrases, keeper.phrasewords, ebookFile );
-	
-	for ( QList< QUrl >::iterator it = foundDocs.begin(); it != foundDocs.end() && limit > 0; ++it, limit-- )
-		results->push_back( *it );
+
+	// The queries are made of the most common words, so they are the most expensive ones
+	QStringList words = m_Index->getFrequentTerms( 4 );
+
+	if ( words.size() < 4 )
+		return false;
+
+	QList< QPair<QString, QString> > queries;
+	queries.push_back( qMakePair( QString("term"), words[0] ) );
+	queries.push_back( qMakePair( QString("prefix"), words[1].left( 3 ) ) );
+	queries.push_back( qMakePair( QString("AND"), words[0] + " " + words[1] ) );
+	queries.push_back( qMakePair( QString("OR"), words[0] + " OR " + words[2] ) );
+	queries.push_back( qMakePair( QString("NOT"), words[0] + " -" + words[1] ) );
+	queries.push_back( qMakePair( QString("phrase"), "\"" + words[0] + " " + words[1] + "\"" ) );
+	queries.push_back( qMakePair( QString("NEAR"), words[0] + " NEAR/5 " + words[1] ) );
+	queries.push_back( qMakePair( QString("substring"), "*" + words[0].mid( 1, 3 ) + "*" ) );
+	queries.push_back( qMakePair( QString("regex"), "/" + words[0].left( 2 ) + "\\w+/" ) );
+	queries.push_back( qMakePair( QString("group"), "(" + words[0] + " OR " + words[1] + ") " + words[2] + " -" + words[3] ) );
+
+	printf( "Search benchmark, %d iterations per query\n", iterations );
+
+	for ( int q = 0; q < queries.size(); q++ )
+	{
+		// Only the prefix query treats the last word as a prefix
+		QtAs::QueryNode * root = parseQuery( queries[q].second, queries[q].first == "prefix" );
+
+		if ( !root )
+			continue;
+
+		qint64 total = 0, best = -1;
+		int found = 0;
+
+		// The query cache is bypassed, so every iteration is evaluated
+		for ( int i = 0; i < iterations; i++ )
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			found = m_Index->query( root ).size();
+
+			qint64 elapsed = timer.nsecsElapsed();
+			total += elapsed;
+
+			if ( best < 0 || elapsed < best )
+				best = elapsed;
+		}
+
+		printf( "  %-8s %-40s min %8.3f ms, avg %8.3f ms, %d documents\n",
+				qPrintable( queries[q].first ),
+				qPrintable( root->toString() ),
+				best / 1000000.0,
+				total / 1000000.0 / qMax( iterations, 1 ),
+				found );
+
+		delete root;
+	}
+
+	// The snippets for a page of results: the first 100 documents with the most common word
+	QtAs::QueryNode * root = parseQuery( words[0], false );
+
+	if ( root )
+	{
+		QVector<QtAs::Document> docs = m_Index->query( root );
+		QStringList terms;
+		root->collectTerms( terms );
+		delete root;
+
+		int count = qMin( docs.size(), 100 );
+		qint64 total = 0, worst = 0;
+
+		for ( int i = 0; i < iterations; i++ )
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			for ( int d = 0; d < count; d++ )
+				m_Index->getSnippet( m_Index->getDocumentUrl( docs[d].docNumber ), terms, 200 );
+
+			qint64 elapsed = timer.nsecsElapsed();
+			total += elapsed;
+			worst = qMax( worst, elapsed );
+		}
+
+		printf( "  %-8s %-40s max %8.3f ms, avg %8.3f ms, %d documents\n",
+				"snippets",
+				qPrintable( words[0] ),
+				worst / 1000000.0,
+				total / 1000000.0 / qMax( iterations, 1 ),
+				count );
+	}
 
 	return true;
 }
 
+qint64 EBookSearch::memoryUsage() const
+{
+	QReadLocker locker( &m_indexLock );
+	return m_Index ? m_Index->memoryUsage() : 0;
+}
+
 bool EBookSearch::hasIndex() const
 {
+	QReadLocker locker( &m_indexLock );
 	return m_Index != 0;
 }
+
+bool EBookSearch::scanQuery( EBook * ebook, const QString& text, bool caseSensitive, QtAs::QueryControl * control )
+{
+	// The document text has the whitespace collapsed
+	QString needle = text.simplified();
+
+	if ( needle.isEmpty() )
+		return false;
+
+	if ( !caseSensitive )
+		needle = needle.toLower();
+
+	QList< QUrl > alldocuments, documents;
+
+	if ( !ebook->enumerateFiles( alldocuments ) )
+		return false;
+
+	Q_FOREACH( const QUrl& url, alldocuments )
+	{
+		if ( isHtmlDocument( url ) )
+			documents.push_back( url );
+	}
+
+	if ( documents.isEmpty() )
+		return false;
+
+	// The decoder is only read by the tasks, so it is shared between them
+	HelperEntityDecoder decoder;
+
+	if ( ebook->hasFeature( EBook::FEATURE_ENCODING ) )
+		decoder.changeEncoding( QTextCodec::codecForName( ebook->currentEncoding().toUtf8() ) );
+
+	QThreadPool pool;
+	bool completed = true;
+
+	for ( int batchstart = 0; batchstart < documents.size(); batchstart += SCAN_BATCH_SIZE )
+	{
+		emit progressStep( batchstart * 100 / documents.size(), "Scanning the documents" );
+
+		// The user input is left to the caller, which cancels the scan through the control;
+		// otherwise the ebook could be closed, or the scan started again, while it is read here.
+		qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
+
+		if ( control && control->isStopped() )
+		{
+			completed = false;
+			break;
+		}
+
+		QList< QUrl > batch = documents.mid( batchstart, SCAN_BATCH_SIZE );
+		QVector< QString > contents;
+
+		ebook->getFileContentAsStringBatch( contents, batch );
+
+		// The previous batch was scanned while this one was read
+		pool.waitForDone();
+
+		for ( int b = 0; b < batch.size(); b++ )
+		{
+			if ( !contents[b].isEmpty() )
+				pool.start( new ScanTask( this, batch[b], contents[b], needle, caseSensitive, &decoder, control ) );
+		}
+	}
+
+	pool.waitForDone();
+
+	if ( control && control->isStopped() )
+		completed = false;
+
+	emit progressStep( 100, "Scanning the documents" );
+	return completed;
+}
@@ -20,6 +20,9 @@
 #define EBookSearch_H
 
 #include <QDataStream>
+#include <QCache>
+#include <QMutex>
+#include <QReadWriteLock>
 #include "helper_search_index.h"
 
 class EBook;
@@ -48,25 +51,99 @@ class EBookSearch : public QObject
 		//! If \param progressDls is not null, it will be used to display progress.
 		//! Returns true if the index has been generated and saved, or false if internal
 		//! error occurs, or (most likely) the cancelIndexGeneration() slot has been called.
-		bool	generateIndex( EBook * ebook, QDataStream& stream );
+		//!
+		//! If \param previous is not null, it is the index generated for the previous revision of this ebook.
+		//! The documents which did not change since then are not parsed again, so only the changed
+		//! and new documents take time.
+		bool	generateIndex( EBook * ebook, QDataStream& stream, QDataStream * previous = 0 );
+
+		//! Enables the trigram index in the indexes generated by generateIndex(), which makes the substring and
+		//! regular expression queries (like <i>*Buffer*</i> or <i>/get\w+Size/</i>) fast, but the index larger.
+		//! Those queries work without it too, but check the text of every document.
+		void	setSubstringIndexEnabled( bool enabled ) { m_substringIndexEnabled = enabled; }
+
+		//! Limits the memory the index may take while generateIndex() runs, in bytes; 0 means no limit. With a limit,
+		//! the document texts are written to a temporary file, and over the limit the partial dictionaries and
+		//! trigrams are too; they are merged straight into the output stream at the end. Then the memory taken is
+		//! about the limit plus a small entry per document, plus the previous index if it is given; see
+		//! QtAs::Index::setMemoryBudget(). Such an index is not kept after generateIndex(), and must be read
+		//! back from the written stream with loadIndex().
+		void	setIndexMemoryBudget( qint64 bytes ) { m_indexMemoryBudget = bytes; }
 		
-		//! Executes the search query. The \param query is a string like <i>"C++ language" class</i>,
+		//! Executes the search query. The \param query is a string like <i>"C++ language" class -java</i>;
+		//! see QtAs::QueryParser for the query language.
 		//! \param results is a pointer to QStringList, and \param limit limits the number of
 		//! results in case the query is too generic (like \a "a" ).
-		//! The \param chmFile is used to get the current encoding information.
-		//! The return value is false only if the index is not generated, or if a closing quote character 
-		//! is missing. Call hasIndex() to clarify. If search returns no results, the return value is 
-		//! true, but the \param results list will be empty.
+		//! The \param chmFile is not used anymore, as the phrases are verified in the text stored in the index.
+		//! The return value is false only if the index is not generated, or if the query is not valid
+		//! (like a missing closing quote or bracket), or the query was cancelled. Call hasIndex() to clarify. If search returns no results,
+		//! the return value is true, but the \param results list will be empty.
+		//!
+		//! The function is thread-safe, and several queries may run at once. If \param control is not null,
+		//! it could be used to cancel the query from another thread, or to limit its time; if the time is
+		//! over, the results found so far are returned. If \param lastTermIsPrefix is true, the last word
+		//! of the query matches all the words starting with it, which is useful for search as you type.
+		//!
+		//! If \param scope is not null, only the documents from it are searched; see documentSet().
 		//!
 		//! Note that the function does not clear \param results before adding search results, so if you are
 		//! not merging search results, make sure it's empty.
-		bool	searchQuery ( const QString& query, QList< QUrl > * results, EBook * chmFile, unsigned int limit = 100 );
+		bool	searchQuery ( const QString& query, QList< QUrl > * results, EBook * chmFile, unsigned int limit = 100,
+							  QtAs::QueryControl * control = 0, bool lastTermIsPrefix = false, const QtAs::DocIdSet * scope = 0 );
+
+		//! A document found by searchQueryRanked()
+		struct Match
+		{
+			QUrl		url;
+			QString		title;	// from the document HTML; may be empty
+			int			score;	// the higher the more relevant
+		};
+
+		//! Same as searchQuery(), but also returns the title and the relevance score of each document.
+		//! The results are sorted by relevance.
+		bool	searchQueryRanked( const QString& query, QList< Match > * results, unsigned int limit = 100,
+								   QtAs::QueryControl * control = 0, bool lastTermIsPrefix = false, const QtAs::DocIdSet * scope = 0 );
+
+		//! Returns the documents with the \param urls (like all the pages of a table of contents section),
+		//! to be used as the scope of searchQuery(). The scoped search only checks these documents, so it
+		//! takes less time than the search in the whole ebook. The set is valid until the index is changed
+		//! by loadIndex() or generateIndex().
+		QtAs::DocIdSet	documentSet( const QList<QUrl>& urls ) const;
+
+		//! Returns a short HTML snippet of the document \param url text with the terms of the \param query
+		//! marked in bold. The snippet is built from the text stored in the index, and is at most
+		//! \param maxlength characters long (not counting the markup). Returns an empty string if
+		//! there is no text for this document in the index.
+		QString	getSnippet( const QUrl& url, const QString& query, int maxlength = 200, bool lastTermIsPrefix = false ) const;
 		
+		//! Runs the queries of each type made of the most common words in the index \param iterations times,
+		//! and prints the time they take to stdout, followed by the time to make the snippets for 100 results.
+		//! Returns false if there is no index. tests/benchmark.sh checks the printed times.
+		bool	runBenchmark( int iterations = 20 );
+
+		//! Returns the approximate size of the loaded index in memory, in bytes
+		qint64	memoryUsage() const;
+
 		//! Returns true if a valid search index is present, and therefore search could be executed
 		bool	hasIndex() const;
+
+		//! Searches the text of every HTML document in \param ebook for \param text, without using the index.
+		//! The documents are read in batches, and each batch is scanned in the thread pool while the next
+		//! one is read. Each matching document is reported with the scanMatch() signal as soon as it is found,
+		//! so the results are not ranked. The whitespace in \param text matches any whitespace in the document.
+		//!
+		//! The progress is reported with the progressStep() signal as in generateIndex(), but the event
+		//! processing after it includes the user input, so the caller could cancel the scan via \param control;
+		//! the caller should show a modal dialog to prevent the ebook from being closed meanwhile.
+		//! Returns false if the text is empty, the ebook has no documents, or the scan was stopped.
+		bool	scanQuery( EBook * ebook, const QString& text, bool caseSensitive = false, QtAs::QueryControl * control = 0 );
 		
 	signals:
 		void	progressStep( int value, const QString& stepName );
+
+		//! Emitted by scanQuery() from the worker threads for each matching document. The \param count is
+		//! the number of matches in it, and \param snippet is the HTML text around the first match.
+		void	scanMatch( const QUrl& url, int count, const QString& snippet );
 		
 	public slots:
 		void	cancelIndexGeneration();
@@ -75,9 +152,41 @@ class EBookSearch : public QObject
 		void	updateProgress( int value, const QString& stepName );
 		void	processEvents();
 		
+	private:
+		// Returns the parsed query, which should be deleted by the caller, or 0 if the query is not valid
+		QtAs::QueryNode * parseQuery( const QString& query, bool lastTermIsPrefix ) const;
+
+		// Finds the documents matching the query in the scope (if not null), using the cache; the index lock must be held
+		bool	findDocuments( const QString& query, QVector< QtAs::Document >& foundDocs, QtAs::QueryControl * control, bool lastTermIsPrefix,
+							   const QtAs::DocIdSet * scope );
+
+		// Replaces the current index, and drops the cached results
+		void	setIndex( QtAs::Index * index );
+
+		// Returns the key of the cached query which has a part of the conjuncts, or empty string
+		QString	findCachedSubquery( const QStringList& conjuncts ) const;
+
+		// Results of a query, ranked; the conjuncts (the parts of the query which all must match)
+		// are normalized (sorted, no duplicates)
+		struct QueryCacheEntry
+		{
+			QStringList					conjuncts;
+			QVector<QtAs::Document>		documents;
+		};
+
 	private:
 		QStringList 				m_keywordDocuments;
 		QtAs::Index 			*	m_Index;
+		QtAs::Index				*	m_generatedIndex;	// being generated by generateIndex()
+		bool						m_substringIndexEnabled;
+		qint64						m_indexMemoryBudget;
+
+		// Protects m_Index from being replaced while the queries are running
+		mutable QReadWriteLock		m_indexLock;
+
+		// Recent query results; cleared when the index changes
+		QCache<QString, QueryCacheEntry>	m_queryCache;
+		QMutex								m_cacheMutex;
 
 };
 
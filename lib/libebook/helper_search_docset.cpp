@@ -0,0 +1,320 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtAlgorithms>
+
+#include "helper_search_docset.h"
+
+namespace QtAs {
+
+// The sorted array takes two bytes per number, and the bitmap 8 KB; over this count the bitmap is smaller
+static const int ARRAY_CONTAINER_MAX = 4096;
+
+// The number of 64-bit words in the bitmap container
+static const int BITMAP_WORDS = 1024;
+
+// The bitmap ranks are kept for each block of this many words
+static const int BLOCK_WORDS = 8;
+
+
+// Returns the number of the highest set bit of the non-zero word
+static inline int highestBit( quint64 word )
+{
+	int bit = 63;
+
+	while ( (word & ((quint64) 1 << bit)) == 0 )
+		bit--;
+
+	return bit;
+}
+
+
+void DocIdSet::setBit( Container& c, quint16 low )
+{
+	int word = low >> 6;
+	int block = word / BLOCK_WORDS;
+
+	// The numbers are appended in order, so all the set bits are before this block
+	while ( c.lastBlock < block )
+		c.blockRanks[ ++c.lastBlock ] = c.count;
+
+	c.bitmap[ word ] |= (quint64) 1 << (low & 63);
+	c.count++;
+}
+
+
+void DocIdSet::convertToBitmap( Container& c )
+{
+	QVector<quint16> array = c.array;
+
+	c.array.clear();
+	c.array.squeeze();
+	c.bitmap.fill( 0, BITMAP_WORDS );
+	c.blockRanks.fill( 0, BITMAP_WORDS / BLOCK_WORDS );
+	c.lastBlock = -1;
+	c.count = 0;
+
+	for ( int i = 0; i < array.size(); i++ )
+		setBit( c, array[i] );
+}
+
+
+void DocIdSet::append( qint32 docNumber )
+{
+	quint16 key = docNumber >> 16;
+	quint16 low = docNumber & 0xFFFF;
+
+	if ( m_containers.isEmpty() || m_containers.last().key != key )
+	{
+		Container c;
+		c.key = key;
+		c.rank = m_size;
+		m_containers.push_back( c );
+	}
+
+	Container& c = m_containers.last();
+
+	if ( c.bitmap.isEmpty() )
+	{
+		c.array.push_back( low );
+		c.count++;
+
+		if ( c.count > ARRAY_CONTAINER_MAX )
+			convertToBitmap( c );
+	}
+	else
+		setBit( c, low );
+
+	m_size++;
+	m_last = docNumber;
+}
+
+
+int DocIdSet::indexOf( qint32 docNumber ) const
+{
+	if ( docNumber < 0 || docNumber > m_last )
+		return -1;
+
+	quint16 key = docNumber >> 16;
+	quint16 low = docNumber & 0xFFFF;
+
+	// There are very few containers, as the ebooks rarely have more than 65536 documents
+	int c = 0;
+
+	while ( c < m_containers.size() && m_containers[c].key < key )
+		c++;
+
+	if ( c == m_containers.size() || m_containers[c].key != key )
+		return -1;
+
+	const Container& container = m_containers[c];
+
+	if ( container.bitmap.isEmpty() )
+	{
+		QVector<quint16>::const_iterator it = qLowerBound( container.array.constBegin(), container.array.constEnd(), low );
+
+		if ( it == container.array.constEnd() || *it != low )
+			return -1;
+
+		return container.rank + (it - container.array.constBegin());
+	}
+
+	int word = low >> 6;
+	quint64 bit = (quint64) 1 << (low & 63);
+
+	if ( (container.bitmap[ word ] & bit) == 0 )
+		return -1;
+
+	int block = word / BLOCK_WORDS;
+	int rank = container.blockRanks[ block ];
+
+	for ( int w = block * BLOCK_WORDS; w < word; w++ )
+		rank += qPopulationCount( container.bitmap[w] );
+
+	return container.rank + rank + qPopulationCount( container.bitmap[ word ] & (bit - 1) );
+}
+
+
+QVector<qint32> DocIdSet::toVector() const
+{
+	QVector<qint32> result;
+	result.reserve( m_size );
+
+	for ( int c = 0; c < m_containers.size(); c++ )
+	{
+		const Container& container = m_containers[c];
+		qint32 high = (qint32) container.key << 16;
+
+		if ( container.bitmap.isEmpty() )
+		{
+			for ( int i = 0; i < container.array.size(); i++ )
+				result.push_back( high | container.array[i] );
+
+			continue;
+		}
+
+		for ( int w = 0; w < container.bitmap.size(); w++ )
+		{
+			quint64 word = container.bitmap[w];
+
+			for ( int b = 0; word != 0; b++, word >>= 1 )
+			{
+				if ( word & 1 )
+					result.push_back( high | (w << 6) | b );
+			}
+		}
+	}
+
+	return result;
+}
+
+
+qint64 DocIdSet::memoryUsage() const
+{
+	qint64 size = sizeof(DocIdSet);
+
+	for ( int c = 0; c < m_containers.size(); c++ )
+	{
+		size += sizeof(Container)
+				+ m_containers[c].array.size() * sizeof(quint16)
+				+ m_containers[c].bitmap.size() * sizeof(quint64)
+				+ m_containers[c].blockRanks.size() * sizeof(quint16);
+	}
+
+	return size;
+}
+
+
+QDataStream& operator<<( QDataStream& s, const DocIdSet& set )
+{
+	s << (qint32) set.m_containers.size();
+
+	for ( int c = 0; c < set.m_containers.size(); c++ )
+	{
+		const DocIdSet::Container& container = set.m_containers[c];
+
+		s << container.key;
+		s << container.count;
+
+		if ( container.bitmap.isEmpty() )
+		{
+			for ( int i = 0; i < container.array.size(); i++ )
+				s << container.array[i];
+		}
+		else
+		{
+			for ( int w = 0; w < container.bitmap.size(); w++ )
+				s << container.bitmap[w];
+		}
+	}
+
+	return s;
+}
+
+
+QDataStream& operator>>( QDataStream& s, DocIdSet& set )
+{
+	qint32 count;
+
+	set = DocIdSet();
+	s >> count;
+
+	// The set comes from a file, which could be corrupted; the containers are checked
+	// as thoroughly as append() would build them
+	bool valid = count >= 0 && count <= 65536;
+
+	for ( int c = 0; valid && c < count && s.status() == QDataStream::Ok; c++ )
+	{
+		DocIdSet::Container container;
+
+		s >> container.key;
+		s >> container.count;
+		container.rank = set.m_size;
+
+		if ( s.status() != QDataStream::Ok )
+			break;
+
+		// The keys are strictly ascending, and an empty container is never stored
+		if ( container.count <= 0 || container.count > 65536
+		|| (!set.m_containers.isEmpty() && container.key <= set.m_containers.last().key) )
+		{
+			valid = false;
+			break;
+		}
+
+		if ( container.count <= ARRAY_CONTAINER_MAX )
+		{
+			container.array.resize( container.count );
+
+			for ( int i = 0; i < container.count && s.status() == QDataStream::Ok; i++ )
+			{
+				s >> container.array[i];
+
+				if ( i > 0 && container.array[i] <= container.array[i - 1] )
+				{
+					valid = false;
+					break;
+				}
+			}
+
+			set.m_last = ((qint32) container.key << 16) | container.array.last();
+		}
+		else
+		{
+			container.bitmap.resize( BITMAP_WORDS );
+			container.blockRanks.fill( 0, BITMAP_WORDS / BLOCK_WORDS );
+
+			int rank = 0;
+
+			for ( int w = 0; w < BITMAP_WORDS && s.status() == QDataStream::Ok; w++ )
+			{
+				if ( (w % BLOCK_WORDS) == 0 )
+					container.blockRanks[ w / BLOCK_WORDS ] = rank;
+
+				s >> container.bitmap[w];
+
+				if ( container.bitmap[w] != 0 )
+				{
+					rank += qPopulationCount( container.bitmap[w] );
+					container.lastBlock = w / BLOCK_WORDS;
+					set.m_last = ((qint32) container.key << 16) | (w << 6) | highestBit( container.bitmap[w] );
+				}
+			}
+
+			// The ranks are only right if the stored count is
+			if ( rank != container.count )
+				valid = false;
+		}
+
+		if ( !valid || s.status() != QDataStream::Ok )
+			break;
+
+		set.m_size += container.count;
+		set.m_containers.push_back( container );
+	}
+
+	if ( !valid )
+		s.setStatus( QDataStream::ReadCorruptData );
+
+	if ( s.status() != QDataStream::Ok )
+		set = DocIdSet();
+
+	return s;
+}
+
+};
@@ -0,0 +1,86 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_SEARCH_DOCSET_H
+#define HELPER_SEARCH_DOCSET_H
+
+#include <QVector>
+#include <QDataStream>
+
+namespace QtAs
+{
+
+//! A sorted set of the document numbers, stored like the Roaring bitmaps: the numbers are split into the
+//! chunks of 65536 by their high 16 bits, and each chunk keeps the low 16 bits either in a sorted array if
+//! there are few of them, or in a bitmap. So the terms present in almost every document (like the split
+//! characters) take a bit per document, and the rare terms two bytes per document.
+//!
+//! The set also returns the position of a number in it in constant time, which is the index of this
+//! document in the other posting arrays.
+class DocIdSet
+{
+	public:
+		DocIdSet() : m_size( 0 ), m_last( -1 ) {}
+
+		int		size() const { return m_size; }
+		bool	isEmpty() const { return m_size == 0; }
+
+		//! Returns the largest number in the set, or -1 if it is empty
+		qint32	last() const { return m_last; }
+
+		//! Appends the number, which must be greater than all the numbers in the set
+		void	append( qint32 docNumber );
+
+		//! Returns the position of the number in the set, or -1 if it is not there
+		int		indexOf( qint32 docNumber ) const;
+		bool	contains( qint32 docNumber ) const { return indexOf( docNumber ) != -1; }
+
+		//! Returns all the numbers in the ascending order
+		QVector<qint32>	toVector() const;
+
+		//! Returns the approximate size of the set in memory, in bytes
+		qint64	memoryUsage() const;
+
+		friend QDataStream& operator<<( QDataStream& s, const DocIdSet& set );
+		friend QDataStream& operator>>( QDataStream& s, DocIdSet& set );
+
+	private:
+		struct Container
+		{
+			Container() : key( 0 ), rank( 0 ), count( 0 ), lastBlock( -1 ) {}
+
+			quint16				key;		// the high 16 bits of the numbers
+			qint32				rank;		// how many numbers are in the preceding containers
+			qint32				count;		// how many numbers are in this container
+			QVector<quint16>	array;		// the low 16 bits in the ascending order, if the container is sparse
+			QVector<quint64>	bitmap;		// the low 16 bits as a bitmap, if the container is dense
+			QVector<quint16>	blockRanks;	// how many bits are set in the bitmap before each block of words
+			int					lastBlock;	// the last block which has any bits set
+		};
+
+		static void	setBit( Container& c, quint16 low );
+		static void	convertToBitmap( Container& c );
+
+		QVector<Container>	m_containers;
+		int					m_size;
+		qint32				m_last;
+};
+
+};
+
+#endif // HELPER_SEARCH_DOCSET_H
@@ -17,13 +17,40 @@
  */
 
 #include <QApplication>
+#include <QCryptographicHash>
 #include <QTextCodec>
+#include <QRegularExpression>
+#include <QSet>
+#include <QTemporaryFile>
 
 #include "ebook.h"
 #include "ebook_search.h"
 #include "helper_search_index.h"
 
-static const int DICT_VERSION = 4;
+static const int DICT_VERSION = 12;
+
+// How many documents are retrieved from the ebook at once when building the index
+static const int INDEX_BATCH_SIZE = 64;
+
+// How many characters of the document text is shown before the first match in the snippet
+static const int SNIPPET_LEADING_CONTEXT = 60;
+
+// Approximate memory taken by a dictionary hash node besides the key and the entry
+static const int DICT_NODE_OVERHEAD = 32;
+
+// The parts of the document a term is in; a posting could have several
+static const int FIELD_BODY = 0x01;
+static const int FIELD_TITLE = 0x02;		// the HTML title
+static const int FIELD_HEADING = 0x04;		// h1 to h6
+static const int FIELD_CONTENTS = 0x08;		// the name of a table of contents entry pointing to the document
+static const int FIELD_KEYWORD = 0x10;		// the name of a keyword index entry pointing to the document
+
+// How much each field adds to the term frequency in the document score, so the pages about the term
+// rank above the pages which just mention it
+static const int FIELD_WEIGHT_TITLE = 20;
+static const int FIELD_WEIGHT_HEADING = 10;
+static const int FIELD_WEIGHT_CONTENTS = 20;
+static const int FIELD_WEIGHT_KEYWORD = 30;
 
 namespace QtAs {
 
@@ -36,17 +63,237 @@ static const char SPLIT_CHARACTERS[] = "!()*&^%#@[]{}':;,.?/|/?<>\\-+=~`";
 static const char WORD_CHARACTERS[] = "$_";
 
 
-struct Term
+// Appends the character to the document plain text, collapsing the whitespaces
+static inline void appendPlainText( QString * plaintext, QChar ch )
+{
+	if ( !plaintext )
+		return;
+
+	if ( ch.isSpace() )
+	{
+		if ( plaintext->isEmpty() || plaintext->endsWith( ' ' ) )
+			return;
+
+		ch = ' ';
+	}
+
+	plaintext->append( ch );
+}
+
+// Returns the field of the text following the HTML tag, which starts or ends the title or a heading
+static int fieldAfterTag( const QString& tagname, int field )
+{
+	bool closing = tagname.startsWith( '/' );
+	QString name = closing ? tagname.mid( 1 ) : tagname;
+
+	if ( name == "title" )
+		return closing ? FIELD_BODY : FIELD_TITLE;
+
+	if ( name.length() == 2 && name[0] == 'h' && name[1] >= '1' && name[1] <= '6' )
+		return closing ? FIELD_BODY : FIELD_HEADING;
+
+	return field;
+}
+
+// Appends the word to the tokens in lower case, or its character pairs if it is CJK text
+static void appendToken( const QString& word, QStringList& tokenlist, QByteArray * tokenfields, int field )
+{
+	int count = tokenlist.size();
+
+	if ( isCjkCharacter( word[0] ) )
+		appendBigrams( word, tokenlist );
+	else
+		tokenlist.push_back( word.toLower() );
+
+	if ( tokenfields )
+		tokenfields->append( QByteArray( tokenlist.size() - count, (char) field ) );
+}
+
+// Checks whether the characters are the parts of the same word. The CJK text is indexed by the character
+// pairs, so there is a word boundary next to every CJK character.
+static inline bool isSameWord( QChar a, QChar b )
+{
+	return a.isLetterOrNumber() && b.isLetterOrNumber() && !isCjkCharacter( a ) && !isCjkCharacter( b );
+}
+
+// Checks whether the term found at pos in text is a separate word, and not a part of another one.
+// The prefix term only needs to start the word.
+static bool isWholeWordAt( const QString& text, int pos, int length, bool prefix )
+{
+	if ( pos > 0 && isSameWord( text[pos - 1], text[pos] ) )
+		return false;
+
+	if ( !prefix && pos + length < text.length() && isSameWord( text[pos + length - 1], text[pos + length] ) )
+		return false;
+
+	return true;
+}
+
+
+// Appends the value in variable-length encoding: seven bits per byte, the high bit is set if more bytes follow
+static inline void appendVarint( QByteArray& data, quint32 value )
+{
+	while ( value >= 0x80 )
+	{
+		data.append( (char) ((value & 0x7F) | 0x80) );
+		value >>= 7;
+	}
+
+	data.append( (char) value );
+}
+
+// Decodes the value encoded by appendVarint(), and advances the pointer
+static inline quint32 readVarint( const unsigned char *& ptr )
+{
+	quint32 value = 0;
+
+	for ( int shift = 0; ; shift += 7 )
+	{
+		unsigned char byte = *ptr++;
+		value |= (quint32) (byte & 0x7F) << shift;
+
+		if ( (byte & 0x80) == 0 )
+			return value;
+	}
+}
+
+// Checks whether any match from a (each lengtha words long) is at most distance words apart from any match from b.
+// The positions are sorted.
+static bool hasNearMatches( const QVector<quint32>& a, int lengtha, const QVector<quint32>& b, int lengthb, int distance )
+{
+	int i = 0, j = 0;
+
+	while ( i < a.size() && j < b.size() )
+	{
+		if ( a[i] <= b[j] )
+		{
+			// a goes first; the gap is between the end of a and the start of b
+			if ( (qint64) b[j] - (a[i] + lengtha - 1) <= distance + 1 )
+				return true;
+
+			i++;
+		}
+		else
+		{
+			if ( (qint64) a[i] - (b[j] + lengthb - 1) <= distance + 1 )
+				return true;
+
+			j++;
+		}
+	}
+
+	return false;
+}
+
+// Returns the key of the three characters starting at pos in the trigram index
+static inline quint64 trigramKey( const QString& text, int pos )
+{
+	return ((quint64) text[pos].unicode() << 32) | ((quint64) text[pos + 1].unicode() << 16) | text[pos + 2].unicode();
+}
+
+// Returns the literal strings which any match of the regular expression must contain, to find the candidate
+// documents in the trigram index. It is conservative: whatever is not understood is skipped, which only
+// makes the candidate list longer.
+static QStringList regexRequiredLiterals( const QString& pattern )
+{
+	QStringList literals;
+	QString current;
+
+	// Any of the alternatives may match, so nothing is required
+	if ( pattern.contains( '|' ) )
+		return literals;
+
+	for ( int i = 0; i < pattern.length(); i++ )
+	{
+		QChar ch = pattern[i];
+		QChar literal;
+
+		if ( ch == '\\' && i + 1 < pattern.length() )
+		{
+			// \w, \d, \b and the back references are not literals
+			if ( !pattern[i + 1].isLetterOrNumber() )
+				literal = pattern[i + 1];
+
+			i++;
+		}
+		else if ( ch == '[' || ch == '(' )
+		{
+			// The classes match one of many characters, and the groups may be optional; skip them
+			QChar closing = (ch == '[') ? ']' : ')';
+			int depth = 0;
+
+			for ( ; i < pattern.length(); i++ )
+			{
+				if ( pattern[i] == '\\' )
+					i++;
+				else if ( pattern[i] == ch && (ch == '(' || depth == 0) )
+					depth++;
+				else if ( pattern[i] == closing && --depth == 0 )
+					break;
+			}
+		}
+		else if ( QString( ".^$)?*+{" ).indexOf( ch ) == -1 )
+			literal = ch;
+
+		if ( literal.isNull() )
+		{
+			// Skip the repetition count
+			if ( ch == '{' )
+				i = qMax( i, pattern.indexOf( '}', i ) );
+
+			if ( current.length() >= 3 )
+				literals.push_back( current );
+
+			current.clear();
+			continue;
+		}
+
+		QChar quantifier = i + 1 < pattern.length() ? pattern[i + 1] : QChar();
+
+		// The literal must be present at least once, but what follows may not be adjacent
+		if ( quantifier == '+' || (quantifier == '{' && i + 2 < pattern.length() && pattern[i + 2] != '0' && pattern[i + 2] != ',') )
+		{
+			current += literal;
+			quantifier = QChar( '?' );
+		}
+
+		if ( quantifier == '?' || quantifier == '*' || quantifier == '{' )
+		{
+			if ( current.length() >= 3 )
+				literals.push_back( current );
+
+			current.clear();
+			continue;
+		}
+
+		current += literal;
+	}
+
+	if ( current.length() >= 3 )
+		literals.push_back( current );
+
+	return literals;
+}
+
+// Returns the hash of the document content, after it was decoded from the ebook encoding
+static QByteArray documentHash( const QString& content )
+{
+	QCryptographicHash hash( QCryptographicHash::Md5 );
+	hash.addData( (const char *) content.constData(), content.size() * sizeof(QChar) );
+	return hash.result();
+}
+
+// The query node with its estimated cost, to evaluate the cheapest nodes first
+struct NodeCost
 {
-	Term() : frequency(-1) {}
-	Term( const QString &t, int f, QVector<Document> l ) : term( t ), frequency( f ), documents( l ) {}
-	QString term;
-	int frequency;
-	QVector<Document>documents;
-	bool operator<( const Term &i2 ) const { return frequency < i2.frequency; }
+	NodeCost( const QueryNode * n, int c ) : node( n ), cost( c ) {}
+	bool operator<( const NodeCost& other ) const { return cost < other.cost; }
+
+	const QueryNode * node;
+	int cost;
 };
 
-	
+
 QDataStream &operator>>( QDataStream &s, Document &l )
 {
 	s >> l.docNumber;
@@ -56,8 +303,8 @@ QDataStream &operator>>( QDataStream &s, Document &l )
 
 QDataStream &operator<<( QDataStream &s, const Document &l )
 {
-	s << (short)l.docNumber;
-	s << (short)l.frequency;
+	s << l.docNumber;
+	s << l.frequency;
 	return s;
 }
 
@@ -65,26 +312,78 @@ Index::Index()
 	: QObject( 0 )
 {
 	lastWindowClosed = false;
+	trigramsEnabled = false;
+	memoryBudget = 0;
+	dictMemory = 0;
+	trigramMemory = 0;
+	textFile = 0;
 	connect( qApp, SIGNAL( lastWindowClosed() ), this, SLOT( setLastWinClosed() ) );
 }
 
+Index::~Index()
+{
+	qDeleteAll( dict );
+	clearRuns();
+}
+
 void Index::setLastWinClosed()
 {
 	lastWindowClosed = true;
 }
 
 
-bool Index::makeIndex(const QList< QUrl >& docs, EBook *chmFile )
+bool Index::makeIndex( const QList< QUrl >& docs, EBook *chmFile, const Index * previous )
 {
 	if ( docs.isEmpty() )
 		return false;
 	
 	docList = docs;
+	docTexts.clear();
+	docTitles.clear();
+	docHashes.clear();
+	docHashes.resize( docList.size() );
+	docNumbers.clear();
+	trigrams.clear();
+	clearRuns();
+	dictMemory = 0;
+	trigramMemory = 0;
+
+	// With the memory limit, the document texts are written into a file as they are made
+	if ( memoryBudget > 0 )
+	{
+		textFile = new QTemporaryFile();
+
+		if ( !textFile->open() )
+		{
+			qWarning( "Search index generator: could not create the temporary text file, keeping the texts in memory" );
+			delete textFile;
+			textFile = 0;
+		}
+	}
+
+	if ( !textFile )
+		docTexts.resize( docList.size() );
+
+	// The postings could only be reused if the documents were split into the words the same way
+	if ( previous && (previous->docHashes.isEmpty() || previous->m_charssplit != SPLIT_CHARACTERS || previous->m_charsword != WORD_CHARACTERS) )
+		previous = 0;
+
+	QVector<QString> contentNames, keywordNames;
+	collectEntryNames( chmFile, contentNames, keywordNames );
+
+	// The new number of each document of the previous index which did not change, or -1
+	QVector<int> newNumbers( previous ? previous->docList.size() : 0, -1 );
+	int reused = 0;
+
+	for ( int i = 0; i < docList.size(); i++ )
+	{
+		docNumbers[ docList[i] ] = i;
+		docTitles.push_back( QString() );
+	}
 
 	if ( chmFile->hasFeature( EBook::FEATURE_ENCODING ) )
 		entityDecoder.changeEncoding( QTextCodec::codecForName( chmFile->currentEncoding().toUtf8() ) );
 	
-	QList< QUrl >::ConstIterator it = docList.begin();
 	int steps = docList.count() / 100;
 	
 	if ( !steps )
@@ -92,401 +391,1991 @@ bool Index::makeIndex(const QList< QUrl >& docs, EBook *chmFile )
 	
 	int prog = 0;
 	
-	for ( int i = 0; it != docList.end(); ++it, ++i )
+	// The documents are retrieved in batches, so the ebook could decompress them concurrently
+	for ( int batchstart = 0; batchstart < docList.count(); batchstart += INDEX_BATCH_SIZE )
 	{
-		if ( lastWindowClosed )
-			return false;
+		QList< QUrl > batch = docList.mid( batchstart, INDEX_BATCH_SIZE );
+		QVector< QString > contents;
 
-		QUrl filename = *it;
-		QStringList terms;
-		
-		if ( parseDocumentToStringlist( chmFile, filename, terms ) )
-		{
-			for ( QStringList::ConstIterator tit = terms.begin(); tit != terms.end(); ++tit )
-				insertInDict( *tit, i );
-		}
-		
-		if ( i%steps == 0 )
+		chmFile->getFileContentAsStringBatch( contents, batch );
+
+		for ( int b = 0; b < batch.size(); b++ )
 		{
-			prog++;
-			prog = qMin( prog, 99 );
-			emit indexingProgress( prog, tr("Processing document %1") .arg( (*it).path() ) );
+			if ( lastWindowClosed )
+				return false;
+
+			int i = batchstart + b;
+			QStringList terms;
+			QByteArray termfields;
+			QString plaintext;
+			QByteArray text;
+
+			if ( !contents[b].isEmpty() )
+				docHashes[i] = documentHash( contents[b] );
+
+			int old = previous ? previous->docNumbers.value( batch[b], -1 ) : -1;
+
+			if ( contents[b].isEmpty() )
+				qWarning( "Search index generator: could not retrieve the document content for %s", qPrintable( batch[b].toString() ) );
+			else if ( old != -1 && previous->docHashes[old] == docHashes[i] )
+			{
+				// The document did not change; its postings are copied after all the documents are processed
+				text = previous->docTexts[old];
+				docTitles[i] = previous->docTitles[old];
+				newNumbers[old] = i;
+				reused++;
+
+				if ( trigramsEnabled )
+					insertTrigrams( QString::fromUtf8( qUncompress( text ) ), i );
+			}
+			else
+			{
+				parseTextToStringlist( contents[b], terms, &plaintext, &termfields );
+
+				// The plain text is kept to show the search result snippets without fetching the documents again
+				text = qCompress( plaintext.toUtf8() );
+				docTitles[i] = parseTitle( contents[b] );
+
+				if ( trigramsEnabled )
+					insertTrigrams( plaintext, i );
+
+				// The word positions are kept for the phrase and proximity search
+				for ( int t = 0; t < terms.size(); t++ )
+					insertInDict( terms[t], i, t, termfields[t] );
+
+				// The contents and keyword index entries show which pages are about the words
+				markField( contentNames[i], i, FIELD_CONTENTS );
+				markField( keywordNames[i], i, FIELD_KEYWORD );
+			}
+
+			if ( !storeText( i, text ) )
+			{
+				qWarning( "Search index generator: could not write the temporary text file" );
+				return false;
+			}
+
+			// Each document is entirely in a single part, so the parts could be merged by the document number
+			checkMemoryBudget();
+
+			// Release the memory as soon as possible
+			contents[b].clear();
+
+			if ( i%steps == 0 )
+			{
+				prog++;
+				prog = qMin( prog, 99 );
+				emit indexingProgress( prog, tr("Processing document %1") .arg( batch[b].path() ) );
+			}
 		}
 	}
 	
+	if ( reused > 0 )
+	{
+		emit indexingProgress( 99, tr("Copying %1 unchanged documents") .arg( reused ) );
+		carryOverPostings( previous, newNumbers, contentNames, keywordNames );
+	}
+
+	// The parts written into the temporary files are merged by writeDict()
+	if ( !isSpilled() )
+	{
+		sortedTerms = dict.keys();
+		qSort( sortedTerms );
+	}
+
 	emit indexingProgress( 100, tr("Processing completed") );
 	return true;
 }
 
 
-void Index::insertInDict( const QString &str, int docNum )
+void Index::insertInDict( const QString &str, int docNum, quint32 position, int field )
 {
-	Entry *e = 0;
-	if ( dict.count() )
-		e = dict[ str ];
+	Entry *e = dict.value( str );
 
-	if ( e )
+	if ( !e )
 	{
-		if ( e->documents.last().docNumber != docNum )
-			e->documents.append( Document(docNum, 1 ) );
-		else
-			e->documents.last().frequency++;
+		e = new Entry();
+		dict.insert( str, e );
+		dictMemory += sizeof(Entry) + str.size() * sizeof(QChar) + DICT_NODE_OVERHEAD;
+	}
+
+	// The frequency is not stored; it is the number of the positions
+	if ( e->docs.last() != docNum )
+	{
+		e->docs.append( docNum );
+		e->offsets.append( e->positions.size() );
+		e->fields.append( (char) field );
+		e->lastPosition = 0;
+		dictMemory += sizeof(quint16) + sizeof(quint32) + 1;
 	}
 	else
+		e->fields.data()[ e->fields.size() - 1 ] |= field;
+
+	int oldsize = e->positions.size();
+
+	// The positions grow within the document, so only the difference from the previous one is stored
+	appendVarint( e->positions, position - e->lastPosition );
+	e->lastPosition = position;
+	dictMemory += e->positions.size() - oldsize;
+}
+
+
+void Index::checkMemoryBudget()
+{
+	if ( memoryBudget <= 0 || dictMemory + trigramMemory <= memoryBudget )
+		return;
+
+	if ( !spillDict() || !spillTrigrams() )
 	{
-		dict.insert( str, new Entry( docNum ) );
+		qWarning( "Search index generator: could not write the temporary index file, continuing in memory" );
+		memoryBudget = 0;
 	}
 }
 
 
-bool Index::parseDocumentToStringlist(EBook *chmFile, const QUrl& filename, QStringList& tokenlist )
+bool Index::storeText( int docNum, const QByteArray& text )
 {
-	QString parsedbuf, parseentity, text;
-	
-	if ( !chmFile->getFileContentAsString( text, filename )
-	|| text.isEmpty() )
+	if ( !textFile )
 	{
-		qWarning( "Search index generator: could not retrieve the document content for %s", qPrintable( filename.toString() ) );
+		docTexts[docNum] = text;
+		return true;
+	}
+
+	// The documents come in order, so the texts are read back in the same order
+	QDataStream stream( textFile );
+	stream << text;
+
+	return stream.status() == QDataStream::Ok;
+}
+
+
+bool Index::writeTexts( QDataStream& stream )
+{
+	if ( !textFile->flush() || !textFile->seek( 0 ) )
 		return false;
+
+	// The same format as the QVector the texts are read into
+	QDataStream texts( textFile );
+	stream << (quint32) docList.size();
+
+	for ( int i = 0; i < docList.size() && texts.status() == QDataStream::Ok; i++ )
+	{
+		QByteArray text;
+		texts >> text;
+		stream << text;
 	}
 
-	m_charssplit = SPLIT_CHARACTERS;
-	m_charsword = WORD_CHARACTERS;
-	
-	tokenlist.clear();
-	
-	// State machine states
-	enum state_t
+	return texts.status() == QDataStream::Ok && stream.status() == QDataStream::Ok;
+}
+
+
+bool Index::spillDict()
+{
+	if ( dict.isEmpty() )
+		return true;
+
+	QTemporaryFile * file = new QTemporaryFile();
+
+	if ( !file->open() )
 	{
-		STATE_OUTSIDE_TAGS,		// outside HTML tags; parse text
-		STATE_IN_HTML_TAG,		// inside HTML tags; wait for end tag
-		STATE_IN_QUOTES,		// inside HTML tags and inside quotes; wait for end quote (in var QuoteChar)
-		STATE_IN_HTML_ENTITY	// inside HTML entity; parse the entity
-	};
-	
-	state_t state = STATE_OUTSIDE_TAGS;
-	QChar QuoteChar; // used in STATE_IN_QUOTES
-	
-	for ( int j = 0; j < text.length(); j++ )
+		delete file;
+		return false;
+	}
+
+	QStringList terms = dict.keys();
+	qSort( terms );
+
+	// The terms are sorted, so the parts could be merged reading each of them once
+	QDataStream stream( file );
+
+	Q_FOREACH( const QString& term, terms )
+		writeEntry( stream, term, *dict.value( term ) );
+
+	if ( stream.status() != QDataStream::Ok || !file->flush() )
 	{
-		QChar ch = text[j];
-		
-		if ( (j % 20000) == 0 )
-			qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
-		
-		if ( state == STATE_IN_HTML_TAG )
-		{
-			// We are inside HTML tag.
-			// Ignore everything until we see '>' (end of HTML tag) or quote char (quote start)
-			if ( ch == '"' || ch == '\'' )
-			{
-				state = STATE_IN_QUOTES;
-				QuoteChar = ch;
-			}
-			else if ( ch == '>' )
-				state = STATE_OUTSIDE_TAGS;
-				
-			continue;
-		}
-		else if ( state == STATE_IN_QUOTES )
-		{
-			// We are inside quoted text inside HTML tag. 
-			// Ignore everything until we see the quote character again
-			if ( ch == QuoteChar )
-				state = STATE_IN_HTML_TAG;
-				
-			continue;
-		}
-		else if ( state == STATE_IN_HTML_ENTITY )
-		{
-			// We are inside encoded HTML entity (like &nbsp;).
-			// Collect to parsedbuf everything until we see ;
-			if ( ch.isLetterOrNumber() )
-			{
-				// get next character of this entity
-				parseentity.append( ch );
-				continue;
-			}
-				
-			// The entity ended
-			state = STATE_OUTSIDE_TAGS;
-			
-			// Some shitty HTML does not terminate entities correctly. Screw it.			
+		delete file;
+		return false;
+	}
+
+	runFiles.push_back( file );
+
+	qDeleteAll( dict );
+	dict.clear();
+	dictMemory = 0;
+	return true;
+}
+
+
+bool Index::spillTrigrams()
+{
+	if ( trigrams.isEmpty() )
+		return true;
+
+	QTemporaryFile * file = new QTemporaryFile();
+
+	if ( !file->open() )
+	{
+		delete file;
+		return false;
+	}
+
+	QList<quint64> keys = trigrams.keys();
+	qSort( keys );
+
+	// Sorted like the dictionary parts, so the parts are merged the same way
+	QDataStream stream( file );
+
+	Q_FOREACH( quint64 key, keys )
+		stream << key << trigrams.value( key );
+
+	if ( stream.status() != QDataStream::Ok || !file->flush() )
+	{
+		delete file;
+		return false;
+	}
+
+	trigramRunFiles.push_back( file );
+
+	trigrams.clear();
+	trigramMemory = 0;
+	return true;
+}
+
+
+void Index::writeEntry( QDataStream& stream, const QString& term, const Entry& entry )
+{
+	// The offsets grow, so only the differences are stored, which take a byte or two each
+	QByteArray offsets;
+	quint32 previous = 0;
+
+	for ( int i = 0; i < entry.offsets.size(); i++ )
+	{
+		appendVarint( offsets, entry.offsets[i] - previous );
+		previous = entry.offsets[i];
+	}
+
+	stream << term;
+	stream << entry.docs;
+	stream << offsets;
+	stream << entry.positions;
+	stream << entry.fields;
+}
+
+
+bool Index::readEntry( QDataStream& stream, QString& term, Entry& entry )
+{
+	if ( stream.atEnd() )
+		return false;
+
+	QByteArray offsets;
+
+	stream >> term;
+	stream >> entry.docs;
+	stream >> offsets;
+	stream >> entry.positions;
+	stream >> entry.fields;
+
+	const unsigned char * ptr = (const unsigned char *) offsets.constData();
+	const unsigned char * end = ptr + offsets.size();
+	quint32 offset = 0;
+
+	entry.offsets.clear();
+	entry.offsets.reserve( entry.docs.size() );
+
+	while ( ptr < end )
+	{
+		offset += readVarint( ptr );
+		entry.offsets.push_back( offset );
+	}
+
+	return stream.status() == QDataStream::Ok && entry.offsets.size() == entry.docs.size() && entry.fields.size() == entry.docs.size();
+}
+
+
+bool Index::mergeRuns( QDataStream& output )
+{
+	// The rest of the dictionary is written too, so all the parts are merged the same way
+	if ( !spillDict() )
+	{
+		qWarning( "Search index generator: could not write the temporary index file" );
+		return false;
+	}
+
+	int count = runFiles.size();
+	QList<QDataStream*> streams;
+	QVector<QString> terms( count );
+	QVector<Entry> entries( count );
+	QVector<bool> valid( count );
+	bool result = true;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		runFiles[i]->seek( 0 );
+		streams.push_back( new QDataStream( runFiles[i] ) );
+		valid[i] = readEntry( *streams[i], terms[i], entries[i] );
+	}
+
+	// Only the current term of each part is in memory; the merged entries go straight to the output
+	while ( true )
+	{
+		// The smallest of the current terms of all the parts goes next
+		int smallest = -1;
+
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( valid[i] && (smallest == -1 || terms[i] < terms[smallest]) )
+				smallest = i;
+		}
+
+		if ( smallest == -1 )
+			break;
+
+		if ( lastWindowClosed )
+		{
+			result = false;
+			break;
+		}
+
+		QString term = terms[smallest];
+		Entry merged;
+
+		// The parts are mostly in the document order, so the postings are usually just appended
+		for ( int i = smallest; i < count; i++ )
+		{
+			if ( !valid[i] || terms[i] != term )
+				continue;
+
+			merged.merge( entries[i] );
+			valid[i] = readEntry( *streams[i], terms[i], entries[i] );
+		}
+
+		writeEntry( output, term, merged );
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( streams[i]->status() != QDataStream::Ok )
+		{
+			qWarning( "Search index generator: could not read the temporary index file" );
+			result = false;
+		}
+	}
+
+	qDeleteAll( streams );
+	return result && output.status() == QDataStream::Ok;
+}
+
+
+bool Index::mergeTrigramRuns( QDataStream& output )
+{
+	if ( !spillTrigrams() )
+	{
+		qWarning( "Search index generator: could not write the temporary index file" );
+		return false;
+	}
+
+	// The merged trigrams are written as a QHash, which starts with the number of the keys;
+	// it is only known after the merge, so they are merged into another file first
+	QTemporaryFile mergedfile;
+
+	if ( !mergedfile.open() )
+		return false;
+
+	QDataStream merged( &mergedfile );
+	int count = trigramRunFiles.size();
+	QList<QDataStream*> streams;
+	QVector<quint64> keys( count );
+	QVector< QVector<qint32> > documents( count );
+	QVector<bool> valid( count );
+	quint32 total = 0;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		trigramRunFiles[i]->seek( 0 );
+		streams.push_back( new QDataStream( trigramRunFiles[i] ) );
+		valid[i] = !streams[i]->atEnd();
+
+		if ( valid[i] )
+			*streams[i] >> keys[i] >> documents[i];
+	}
+
+	while ( true )
+	{
+		int smallest = -1;
+
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( valid[i] && (smallest == -1 || keys[i] < keys[smallest]) )
+				smallest = i;
+		}
+
+		if ( smallest == -1 )
+			break;
+
+		quint64 key = keys[smallest];
+		QVector<qint32> list;
+
+		// The parts are in the document order, so the lists are just appended
+		for ( int i = smallest; i < count; i++ )
+		{
+			if ( !valid[i] || keys[i] != key )
+				continue;
+
+			list += documents[i];
+			valid[i] = !streams[i]->atEnd();
+
+			if ( valid[i] )
+				*streams[i] >> keys[i] >> documents[i];
+		}
+
+		merged << key << list;
+		total++;
+	}
+
+	bool result = merged.status() == QDataStream::Ok && mergedfile.flush() && mergedfile.seek( 0 );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( streams[i]->status() != QDataStream::Ok )
+			result = false;
+	}
+
+	qDeleteAll( streams );
+
+	if ( !result )
+	{
+		qWarning( "Search index generator: could not merge the temporary trigram files" );
+		return false;
+	}
+
+	output << total;
+
+	while ( !mergedfile.atEnd() )
+	{
+		QByteArray chunk = mergedfile.read( 65536 );
+
+		if ( chunk.isEmpty() || output.writeRawData( chunk.constData(), chunk.size() ) != chunk.size() )
+			return false;
+	}
+
+	return output.status() == QDataStream::Ok;
+}
+
+
+void Index::clearRuns()
+{
+	qDeleteAll( runFiles );
+	runFiles.clear();
+	qDeleteAll( trigramRunFiles );
+	trigramRunFiles.clear();
+	delete textFile;
+	textFile = 0;
+}
+
+
+void Index::insertTrigrams( const QString& text, int docNum )
+{
+	QString lower = text.toLower();
+	QSet<quint64> present;
+
+	for ( int i = 0; i + 3 <= lower.length(); i++ )
+		present.insert( trigramKey( lower, i ) );
+
+	// The documents are indexed in order, so the lists stay sorted
+	Q_FOREACH( quint64 key, present )
+	{
+		QVector<qint32>& documents = trigrams[ key ];
+
+		if ( documents.isEmpty() )
+			trigramMemory += sizeof(quint64) + sizeof(QVector<qint32>) + DICT_NODE_OVERHEAD;
+
+		documents.push_back( docNum );
+		trigramMemory += sizeof(qint32);
+	}
+}
+
+
+void Index::carryOverPostings( const Index * previous, const QVector<int>& newNumbers,
+								const QVector<QString>& contentNames, const QVector<QString>& keywordNames )
+{
+	// The contents and keyword index entries may change even if the documents did not, so their fields
+	// are marked again from the current entries
+	QHash< int, QSet<QString> > contentTerms, keywordTerms;
+
+	for ( int k = 0; k < newNumbers.size(); k++ )
+	{
+		int docnum = newNumbers[k];
+
+		if ( docnum == -1 )
+			continue;
+
+		contentTerms[ docnum ] = nameTerms( contentNames[docnum] ).toSet();
+		keywordTerms[ docnum ] = nameTerms( keywordNames[docnum] ).toSet();
+	}
+
+	for ( QHash<QString, Entry *>::ConstIterator it = previous->dict.begin(); it != previous->dict.end(); ++it )
+	{
+		const Entry * old = it.value();
+		QVector<qint32> oldnumbers = old->docs.toVector();
+		QVector< QPair<int, int> > order;
+
+		for ( int k = 0; k < oldnumbers.size(); k++ )
+		{
+			int docnum = newNumbers[ oldnumbers[k] ];
+
+			if ( docnum != -1 )
+				order.push_back( qMakePair( docnum, k ) );
+		}
+
+		if ( order.isEmpty() )
+			continue;
+
+		// The documents keep their order in most revisions, but not necessarily
+		qSort( order );
+
+		Entry carried;
+
+		for ( int k = 0; k < order.size(); k++ )
+		{
+			int docnum = order[k].first;
+			carried.appendDocument( *old, order[k].second, docnum );
+
+			int field = carried.fields.at( carried.fields.size() - 1 ) & ~(FIELD_CONTENTS | FIELD_KEYWORD);
+
+			if ( contentTerms[ docnum ].contains( it.key() ) )
+				field |= FIELD_CONTENTS;
+
+			if ( keywordTerms[ docnum ].contains( it.key() ) )
+				field |= FIELD_KEYWORD;
+
+			carried.fields.data()[ carried.fields.size() - 1 ] = field;
+		}
+
+		Entry * e = dict.value( it.key() );
+
+		if ( !e )
+		{
+			e = new Entry();
+			dict.insert( it.key(), e );
+			dictMemory += sizeof(Entry) + it.key().size() * sizeof(QChar) + DICT_NODE_OVERHEAD;
+		}
+
+		e->merge( carried );
+		dictMemory += carried.docs.memoryUsage() + carried.offsets.size() * sizeof(quint32) + carried.positions.size() + carried.fields.size();
+
+		// The copied postings are a separate part; the parts are merged by the document number
+		checkMemoryBudget();
+	}
+}
+
+
+void Index::Entry::appendDocument( const Entry& source, int i, int docNumber )
+{
+	int start = source.offsets[i];
+	int end = i + 1 < source.offsets.size() ? source.offsets[i + 1] : source.positions.size();
+
+	docs.append( docNumber );
+	offsets.push_back( positions.size() );
+	fields.push_back( source.fields[i] );
+	positions.append( source.positions.constData() + start, end - start );
+}
+
+
+void Index::Entry::merge( const Entry& source )
+{
+	if ( docs.isEmpty() )
+	{
+		docs = source.docs;
+		offsets = source.offsets;
+		positions = source.positions;
+		fields = source.fields;
+		return;
+	}
+
+	if ( source.docs.isEmpty() )
+		return;
+
+	QVector<qint32> sourcenumbers = source.docs.toVector();
+
+	// Usually the source documents go after all the present ones, so they are just appended
+	if ( sourcenumbers.first() > docs.last() )
+	{
+		quint32 base = positions.size();
+
+		for ( int k = 0; k < sourcenumbers.size(); k++ )
+		{
+			docs.append( sourcenumbers[k] );
+			offsets.push_back( base + source.offsets[k] );
+		}
+
+		positions += source.positions;
+		fields += source.fields;
+		return;
+	}
+
+	QVector<qint32> numbers = docs.toVector();
+	Entry merged;
+	int i = 0, j = 0;
+
+	while ( i < numbers.size() || j < sourcenumbers.size() )
+	{
+		if ( j == sourcenumbers.size() || (i < numbers.size() && numbers[i] < sourcenumbers[j]) )
+		{
+			merged.appendDocument( *this, i, numbers[i] );
+			i++;
+		}
+		else
+		{
+			merged.appendDocument( source, j, sourcenumbers[j] );
+			j++;
+		}
+	}
+
+	docs = merged.docs;
+	offsets = merged.offsets;
+	positions = merged.positions;
+	fields = merged.fields;
+}
+
+
+int Index::Entry::frequency( int i ) const
+{
+	const char * ptr = positions.constData() + offsets[i];
+	const char * end = positions.constData() + (i + 1 < offsets.size() ? offsets[i + 1] : positions.size());
+	int count = 0;
+
+	// Each position ends with a byte without the high bit
+	for ( ; ptr < end; ptr++ )
+	{
+		if ( (*ptr & 0x80) == 0 )
+			count++;
+	}
+
+	return count;
+}
+
+
+int Index::Entry::score( int i ) const
+{
+	int field = fields[i];
+	int result = frequency( i );
+
+	if ( field & FIELD_TITLE )
+		result += FIELD_WEIGHT_TITLE;
+
+	if ( field & FIELD_HEADING )
+		result += FIELD_WEIGHT_HEADING;
+
+	if ( field & FIELD_CONTENTS )
+		result += FIELD_WEIGHT_CONTENTS;
+
+	if ( field & FIELD_KEYWORD )
+		result += FIELD_WEIGHT_KEYWORD;
+
+	return result;
+}
+
+
+QVector<Document> Index::Entry::documentList() const
+{
+	QVector<qint32> numbers = docs.toVector();
+	QVector<Document> result;
+
+	result.reserve( numbers.size() );
+
+	for ( int i = 0; i < numbers.size(); i++ )
+		result.push_back( Document( numbers[i], score( i ) ) );
+
+	return result;
+}
+
+
+void Index::Entry::getPositions( int i, QVector<quint32>& result ) const
+{
+	const unsigned char * ptr = (const unsigned char *) positions.constData() + offsets[i];
+	const unsigned char * end = (const unsigned char *) positions.constData() + (i + 1 < offsets.size() ? offsets[i + 1] : positions.size());
+	quint32 position = 0;
+
+	result.clear();
+
+	while ( ptr < end )
+	{
+		position += readVarint( ptr );
+		result.push_back( position );
+	}
+}
+
+
+void Index::parseTextToStringlist( const QString& text, QStringList& tokenlist, QString * plaintext, QByteArray * tokenfields )
+{
+	QString parsedbuf, parseentity;
+
+	m_charssplit = SPLIT_CHARACTERS;
+	m_charsword = WORD_CHARACTERS;
+	
+	tokenlist.clear();
+
+	if ( tokenfields )
+		tokenfields->clear();
+	
+	// State machine states
+	enum state_t
+	{
+		STATE_OUTSIDE_TAGS,		// outside HTML tags; parse text
+		STATE_IN_HTML_TAG,		// inside HTML tags; wait for end tag
+		STATE_IN_QUOTES,		// inside HTML tags and inside quotes; wait for end quote (in var QuoteChar)
+		STATE_IN_HTML_ENTITY	// inside HTML entity; parse the entity
+	};
+	
+	state_t state = STATE_OUTSIDE_TAGS;
+	QChar QuoteChar; // used in STATE_IN_QUOTES
+
+	// The field of the text; the tag name is collected to find where the title and the headings are
+	int field = FIELD_BODY;
+	QString tagname;
+	bool tagnamedone = true;
+	
+	for ( int j = 0; j < text.length(); j++ )
+	{
+		QChar ch = text[j];
+		
+		if ( (j % 20000) == 0 )
+			qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
+		
+		if ( state == STATE_IN_HTML_TAG )
+		{
+			// We are inside HTML tag.
+			// Ignore everything until we see '>' (end of HTML tag) or quote char (quote start)
+			if ( !tagnamedone )
+			{
+				if ( ch.isLetterOrNumber() || (ch == '/' && tagname.isEmpty()) )
+					tagname.append( ch.toLower() );
+				else
+					tagnamedone = true;
+			}
+
+			if ( ch == '"' || ch == '\'' )
+			{
+				state = STATE_IN_QUOTES;
+				QuoteChar = ch;
+			}
+			else if ( ch == '>' )
+			{
+				state = STATE_OUTSIDE_TAGS;
+				field = fieldAfterTag( tagname, field );
+			}
+				
+			continue;
+		}
+		else if ( state == STATE_IN_QUOTES )
+		{
+			// We are inside quoted text inside HTML tag. 
+			// Ignore everything until we see the quote character again
+			if ( ch == QuoteChar )
+				state = STATE_IN_HTML_TAG;
+				
+			continue;
+		}
+		else if ( state == STATE_IN_HTML_ENTITY )
+		{
+			// We are inside encoded HTML entity (like &nbsp;).
+			// Collect to parsedbuf everything until we see ;
+			if ( ch.isLetterOrNumber() )
+			{
+				// get next character of this entity
+				parseentity.append( ch );
+				continue;
+			}
+				
+			// The entity ended
+			state = STATE_OUTSIDE_TAGS;
+			
+			// Some shitty HTML does not terminate entities correctly. Screw it.			
 			if ( ch != ';' && ch != '<' )
 			{
-				if ( parseentity.isEmpty() )
-				{
-					// straight '&' symbol. Add and continue.
-					parsedbuf += "&";
-				}
-				else
-					qWarning( "Index::parseDocument: incorrectly terminated HTML entity '&%s%c', ignoring", qPrintable( parseentity ), ch.toLatin1() );
-				
-				j--; // parse this character again, but in different state
-				continue;
+				if ( parseentity.isEmpty() )
+				{
+					// straight '&' symbol. Add and continue.
+					parsedbuf += "&";
+					appendPlainText( plaintext, '&' );
+				}
+				else
+					qWarning( "Index::parseDocument: incorrectly terminated HTML entity '&%s%c', ignoring", qPrintable( parseentity ), ch.toLatin1() );
+				
+				j--; // parse this character again, but in different state
+				continue;
+			}
+			
+			// Don't we have a space?
+			if ( parseentity.toLower() != "nbsp" )
+			{
+				QString entity = entityDecoder.decode( parseentity );
+			
+				if ( entity.isNull() )
+				{
+					// decodeEntity() already printed error message
+					//qWarning( "Index::parseDocument: failed to decode entity &%s;", parsedbuf.ascii() );
+					continue;
+				}
+			
+				parsedbuf += entity;
+
+				for ( int k = 0; k < entity.length(); k++ )
+					appendPlainText( plaintext, entity[k] );
+
+				continue;
+			}
+			else
+				ch = ' '; // We got a space, so treat it like it, and not add it to parsebuf
+		}
+		
+		// 
+		// Now process STATE_OUTSIDE_TAGS
+		//
+		
+		// Check for start of HTML tag, and switch to STATE_IN_HTML_TAG if it is
+		if ( ch == '<' )
+		{
+			state = STATE_IN_HTML_TAG;
+			tagname.clear();
+			tagnamedone = false;
+			appendPlainText( plaintext, ' ' );
+			goto tokenize_buf;
+		}
+		
+		// Check for start of HTML entity
+		if ( ch == '&' )
+		{
+			state = STATE_IN_HTML_ENTITY;
+			parseentity = QString::null;
+			continue;
+		}
+		
+		appendPlainText( plaintext, ch );
+
+		// Replace quote by ' - quotes are used in search window to set the phrase
+		if ( ch == '"' )
+			ch = '\'';
+		
+		// Ok, we have a valid character outside HTML tags, and probably some in buffer already.
+		// If it is char or letter, add it and continue
+		if ( ch.isLetterOrNumber() || m_charsword.indexOf( ch ) != -1 )
+		{
+			// The CJK text is a separate word even without spaces around it, as it is indexed differently
+			if ( !parsedbuf.isEmpty() && isCjkCharacter( ch ) != isCjkCharacter( parsedbuf[0] ) )
+			{
+				appendToken( parsedbuf, tokenlist, tokenfields, field );
+				parsedbuf = QString::null;
+			}
+
+			parsedbuf.append( ch );
+			continue;
+		}
+		
+		// If it is a split char, add the word to the dictionary, and then add the char itself.
+		if ( m_charssplit.indexOf( ch ) != -1 )
+		{
+			if ( !parsedbuf.isEmpty() )
+				appendToken( parsedbuf, tokenlist, tokenfields, field );
+			
+			appendToken( ch, tokenlist, tokenfields, field );
+			parsedbuf = QString::null;
+			continue;
+		}
+		
+tokenize_buf:		
+		// Just add the word; it is most likely a space or terminated by tokenizer.
+		if ( !parsedbuf.isEmpty() )
+		{
+			appendToken( parsedbuf, tokenlist, tokenfields, field );
+			parsedbuf = QString::null;
+		}
+	}
+	
+	// Add the last word if still here - for broken htmls.
+	if ( !parsedbuf.isEmpty() )
+		appendToken( parsedbuf, tokenlist, tokenfields, field );
+}
+
+
+void Index::collectEntryNames( EBook * chmFile, QVector<QString>& contents, QVector<QString>& keywords ) const
+{
+	QList< EBookTocEntry > toc;
+	QList< EBookIndexEntry > index;
+
+	contents.clear();
+	contents.resize( docList.size() );
+	keywords.clear();
+	keywords.resize( docList.size() );
+
+	if ( chmFile->hasFeature( EBook::FEATURE_TOC ) && chmFile->getTableOfContents( toc ) )
+	{
+		for ( int i = 0; i < toc.size(); i++ )
+		{
+			QUrl url = toc[i].url;
+			url.setFragment( QString() );
+
+			int docnum = docNumbers.value( url, -1 );
+
+			if ( docnum >= 0 )
+				contents[docnum] += toc[i].name + ' ';
+		}
+	}
+
+	if ( chmFile->hasFeature( EBook::FEATURE_INDEX ) && chmFile->getIndex( index ) )
+	{
+		for ( int i = 0; i < index.size(); i++ )
+		{
+			for ( int u = 0; u < index[i].urls.size(); u++ )
+			{
+				QUrl url = index[i].urls[u];
+				url.setFragment( QString() );
+
+				int docnum = docNumbers.value( url, -1 );
+
+				if ( docnum >= 0 )
+					keywords[docnum] += index[i].name + ' ';
+			}
+		}
+	}
+}
+
+
+// Marks the postings of the words of the names in the document, which must be the last one added to the dictionary.
+// The words which are not in the document text are not added, so the search results only have the documents
+// containing all the query words.
+void Index::markField( const QString& names, int docNum, int field )
+{
+	QStringList terms = nameTerms( names );
+
+	for ( int t = 0; t < terms.size(); t++ )
+	{
+		Entry * e = dict.value( terms[t] );
+
+		if ( e && e->docs.last() == docNum )
+			e->fields.data()[ e->fields.size() - 1 ] |= field;
+	}
+}
+
+
+QStringList Index::nameTerms( const QString& names )
+{
+	QStringList terms;
+
+	if ( names.isEmpty() )
+		return terms;
+
+	// The names are plain text, so the entities are not decoded, and the tags are not skipped
+	QString escaped = names;
+
+	escaped.replace( '&', ' ' ).replace( '<', ' ' );
+	parseTextToStringlist( escaped, terms );
+	return terms;
+}
+
+
+QString Index::parseTitle( const QString& html )
+{
+	int start = html.indexOf( "<title", 0, Qt::CaseInsensitive );
+
+	if ( start == -1 || (start = html.indexOf( '>', start )) == -1 )
+		return QString();
+
+	int end = html.indexOf( "</title", start, Qt::CaseInsensitive );
+
+	if ( end == -1 )
+		return QString();
+
+	// Decode the entities the same way as in the document text
+	QStringList terms;
+	QString title;
+
+	parseTextToStringlist( html.mid( start + 1, end - start - 1 ), terms, &title );
+	return title.trimmed();
+}
+
+
+bool Index::writeDict( QDataStream& stream )
+{
+	bool spilled = isSpilled();
+
+	stream << DICT_VERSION;
+	stream << m_charssplit;
+	stream << m_charsword;
+	
+	// Document list
+	stream << docList;
+	
+	// Document texts and titles
+	if ( textFile )
+	{
+		if ( !writeTexts( stream ) )
+			return false;
+	}
+	else
+		stream << docTexts;
+
+	stream << docTitles;
+	stream << docHashes;
+
+	// Trigrams, if built
+	if ( !trigramRunFiles.isEmpty() )
+	{
+		if ( !mergeTrigramRuns( stream ) )
+			return false;
+	}
+	else
+		stream << trigrams;
+	
+	// Dictionary
+	if ( !runFiles.isEmpty() )
+	{
+		emit indexingProgress( 99, tr("Merging the index") );
+
+		if ( !mergeRuns( stream ) )
+			return false;
+	}
+	else
+	{
+		for( QHash<QString, Entry *>::ConstIterator it = dict.begin(); it != dict.end(); ++it )
+			writeEntry( stream, it.key(), *it.value() );
+	}
+
+	// The parts are not kept, so such an index must be read back to be queried
+	if ( spilled )
+	{
+		clearDict();
+		clearRuns();
+	}
+
+	return stream.status() == QDataStream::Ok;
+}
+
+
+void Index::clearDict()
+{
+	qDeleteAll( dict );
+	dict.clear();
+	docList.clear();
+	docTexts.clear();
+	docTitles.clear();
+	docHashes.clear();
+	docNumbers.clear();
+	sortedTerms.clear();
+	trigrams.clear();
+}
+
+
+bool Index::readDict( QDataStream& stream )
+{
+	clearDict();
+	
+	QString key;
+	int version;
+	
+	stream >> version;
+	
+	// Only the current format is read; the indexes of the other versions are generated again
+	if ( stream.status() != QDataStream::Ok || version != DICT_VERSION )
+		return false;
+	
+	stream >> m_charssplit;
+	stream >> m_charsword;
+	
+	// Read the document list
+	stream >> docList;
+	stream >> docTexts;
+	stream >> docTitles;
+
+	// The content hashes are only used to generate the index of the next revision of the ebook
+	stream >> docHashes;
+
+	stream >> trigrams;
+
+	if ( stream.status() != QDataStream::Ok )
+	{
+		clearDict();
+		return false;
+	}
+	
+	for ( int i = 0; i < docList.size(); i++ )
+		docNumbers[ docList[i] ] = i;
+	
+	Entry * e = new Entry();
+
+	while ( readEntry( stream, key, *e ) )
+	{
+		// The documents must be in the list
+		if ( e->docs.last() >= docList.size() )
+		{
+			stream.setStatus( QDataStream::ReadCorruptData );
+			break;
+		}
+
+		dict.insert( key, e );
+		e = new Entry();
+	}
+
+	delete e;
+
+	// The entries are read until the end, so stopping before it means the index is truncated or broken
+	if ( stream.status() != QDataStream::Ok || !stream.atEnd() )
+	{
+		clearDict();
+		return false;
+	}
+	
+	sortedTerms = dict.keys();
+	qSort( sortedTerms );
+
+	return dict.size() > 0;
+}
+
+
+// Sorts the documents by document number, as opposed to Document::operator< which sorts them by relevance
+static bool documentNumberLessThan( const Document& a, const Document& b )
+{
+	return a.docNumber < b.docNumber;
+}
+
+// Returns the documents with the numbers, which are sorted, that are present in the scope (any if it is null).
+// Each number is looked up in the scope, as there are usually much fewer of them than the scope documents.
+static QVector<Document> documentsInScope( const QVector<qint32>& numbers, const QVector<Document> * scope )
+{
+	QVector<Document> result;
+	result.reserve( numbers.size() );
+
+	for ( int i = 0; i < numbers.size(); i++ )
+	{
+		Document doc( numbers[i], 0 );
+
+		if ( scope && qBinaryFind( scope->constBegin(), scope->constEnd(), doc, documentNumberLessThan ) == scope->constEnd() )
+			continue;
+
+		result.push_back( doc );
+	}
+
+	return result;
+}
+
+// Returns the documents present in both lists, adding up the scores. The lists are sorted by document number.
+static QVector<Document> intersectDocuments( const QVector<Document>& a, const QVector<Document>& b )
+{
+	QVector<Document> result;
+	int i = 0, j = 0;
+
+	while ( i < a.size() && j < b.size() )
+	{
+		if ( a[i].docNumber < b[j].docNumber )
+			i++;
+		else if ( a[i].docNumber > b[j].docNumber )
+			j++;
+		else
+		{
+			result.push_back( Document( a[i].docNumber, a[i].frequency + b[j].frequency ) );
+			i++;
+			j++;
+		}
+	}
+
+	return result;
+}
+
+// Returns the documents present in any list, adding up the scores. The lists are sorted by document number.
+static QVector<Document> uniteDocuments( const QVector<Document>& a, const QVector<Document>& b )
+{
+	QVector<Document> result;
+	int i = 0, j = 0;
+
+	result.reserve( qMax( a.size(), b.size() ) );
+
+	while ( i < a.size() || j < b.size() )
+	{
+		if ( j == b.size() || (i < a.size() && a[i].docNumber < b[j].docNumber) )
+			result.push_back( a[i++] );
+		else if ( i == a.size() || a[i].docNumber > b[j].docNumber )
+			result.push_back( b[j++] );
+		else
+		{
+			result.push_back( Document( a[i].docNumber, a[i].frequency + b[j].frequency ) );
+			i++;
+			j++;
+		}
+	}
+
+	return result;
+}
+
+// Returns the documents from a which are not in b. The lists are sorted by document number.
+static QVector<Document> subtractDocuments( const QVector<Document>& a, const QVector<Document>& b )
+{
+	QVector<Document> result;
+	int j = 0;
+
+	for ( int i = 0; i < a.size(); i++ )
+	{
+		while ( j < b.size() && b[j].docNumber < a[i].docNumber )
+			j++;
+
+		if ( j == b.size() || b[j].docNumber != a[i].docNumber )
+			result.push_back( a[i] );
+	}
+
+	return result;
+}
+
+
+QList<const Index::Entry*> Index::getTermEntries( const QueryNode * node ) const
+{
+	QList<const Entry*> entries;
+
+	if ( node->type == QueryNode::PREFIX )
+	{
+		const QString& prefix = node->words[0];
+
+		for ( QStringList::const_iterator it = qLowerBound( sortedTerms.begin(), sortedTerms.end(), prefix );
+			  it != sortedTerms.end() && it->startsWith( prefix ); ++it )
+			entries.push_back( dict.value( *it ) );
+	}
+	else if ( dict.contains( node->words[0] ) )
+		entries.push_back( dict.value( node->words[0] ) );
+
+	return entries;
+}
+
+
+int Index::estimateCost( const QueryNode * node ) const
+{
+	int cost = 0;
+
+	switch ( node->type )
+	{
+		case QueryNode::TERM:
+		case QueryNode::PREFIX:
+			Q_FOREACH( const Entry * e, getTermEntries( node ) )
+				cost += e->docs.size();
+			return cost;
+
+		case QueryNode::PHRASE:
+			cost = docList.size();
+
+			for ( int i = 0; i < node->words.size(); i++ )
+			{
+				const Entry * e = dict.value( node->words[i] );
+				cost = qMin( cost, e ? e->docs.size() : 0 );
 			}
-			
-			// Don't we have a space?
-			if ( parseentity.toLower() != "nbsp" )
+			return cost;
+
+		case QueryNode::OR:
+			for ( int i = 0; i < node->children.size(); i++ )
+				cost += estimateCost( node->children[i] );
+			return cost;
+
+		case QueryNode::NOT:
+			return docList.size();
+
+		case QueryNode::SUBSTRING:
+		case QueryNode::REGEX:
+			// Checking the document text is much slower than reading the postings
+			return docList.size() * 2;
+
+		default:
+			// AND and NEAR match no more documents than their cheapest operand
+			cost = docList.size();
+
+			for ( int i = 0; i < node->children.size(); i++ )
 			{
-				QString entity = entityDecoder.decode( parseentity );
-			
-				if ( entity.isNull() )
-				{
-					// decodeEntity() already printed error message
-					//qWarning( "Index::parseDocument: failed to decode entity &%s;", parsedbuf.ascii() );
-					continue;
-				}
-			
-				parsedbuf += entity;
-				continue;
+				if ( node->children[i]->type != QueryNode::NOT )
+					cost = qMin( cost, estimateCost( node->children[i] ) );
 			}
-			else
-				ch = ' '; // We got a space, so treat it like it, and not add it to parsebuf
+			return cost;
+	}
+}
+
+
+QVector<Document> Index::allDocuments( const QVector<Document> * scope ) const
+{
+	QVector<Document> documents;
+
+	if ( scope )
+	{
+		documents.reserve( scope->size() );
+
+		for ( int i = 0; i < scope->size(); i++ )
+			documents.push_back( Document( (*scope)[i].docNumber, 0 ) );
+	}
+	else
+	{
+		documents.reserve( docList.size() );
+
+		for ( int i = 0; i < docList.size(); i++ )
+			documents.push_back( Document( i, 0 ) );
+	}
+
+	return documents;
+}
+
+
+// All the evaluate functions return the documents matching the node, sorted by document number, with the score
+// of this node only. If scope is not null, only the documents from it are returned. They return false
+// if the query was stopped.
+bool Index::evaluate( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const
+{
+	if ( control && control->isStopped() )
+		return false;
+
+	switch ( node->type )
+	{
+		case QueryNode::TERM:
+		case QueryNode::PREFIX:
+			return evaluateTerm( node, scope, withPositions, result, control );
+
+		case QueryNode::PHRASE:
+			return evaluatePhrase( node, scope, withPositions, result, control );
+
+		case QueryNode::NEAR:
+			return evaluateNear( node, scope, result, control );
+
+		case QueryNode::AND:
+			return evaluateAnd( node, scope, result, control );
+
+		case QueryNode::OR:
+			return evaluateOr( node, scope, result, control );
+
+		case QueryNode::NOT:
+			return evaluateNot( node, scope, result, control );
+
+		case QueryNode::SUBSTRING:
+		case QueryNode::REGEX:
+			return evaluateText( node, scope, result, control );
+	}
+
+	return false;
+}
+
+
+bool Index::evaluateTerm( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const
+{
+	QList<const Entry*> entries = getTermEntries( node );
+	result.length = 1;
+
+	// The most common case: a single word, all its documents
+	if ( entries.size() == 1 && !scope )
+	{
+		const Entry * e = entries[0];
+		result.documents = e->documentList();
+
+		if ( withPositions )
+		{
+			result.positions.resize( result.documents.size() );
+
+			for ( int i = 0; i < result.documents.size(); i++ )
+				e->getPositions( i, result.positions[i] );
 		}
-		
-		// 
-		// Now process STATE_OUTSIDE_TAGS
-		//
-		
-		// Check for start of HTML tag, and switch to STATE_IN_HTML_TAG if it is
-		if ( ch == '<' )
+
+		return true;
+	}
+
+	QVector<Document> candidates;
+	int postings = 0;
+
+	Q_FOREACH( const Entry * e, entries )
+		postings += e->docs.size();
+
+	// The scope documents are checked one by one, unless the words are present in fewer documents,
+	// so a search in a small part of the ebook costs less than the whole one.
+	if ( scope && scope->size() <= postings )
+		candidates = *scope;
+	else if ( entries.size() == 1 )
+		candidates = documentsInScope( entries[0]->docs.toVector(), scope );
+	else
+	{
+		// Merge the documents of all the words matching the prefix
+		QVector<bool> present( docList.size(), false );
+		QVector<qint32> numbers;
+
+		Q_FOREACH( const Entry * e, entries )
 		{
-			state = STATE_IN_HTML_TAG;
-			goto tokenize_buf;
+			QVector<qint32> entrynumbers = e->docs.toVector();
+
+			for ( int i = 0; i < entrynumbers.size(); i++ )
+				present[ entrynumbers[i] ] = true;
 		}
-		
-		// Check for start of HTML entity
-		if ( ch == '&' )
+
+		for ( int i = 0; i < present.size(); i++ )
 		{
-			state = STATE_IN_HTML_ENTITY;
-			parseentity = QString::null;
-			continue;
+			if ( present[i] )
+				numbers.push_back( i );
 		}
-		
-		// Replace quote by ' - quotes are used in search window to set the phrase
-		if ( ch == '"' )
-			ch = '\'';
-		
-		// Ok, we have a valid character outside HTML tags, and probably some in buffer already.
-		// If it is char or letter, add it and continue
-		if ( ch.isLetterOrNumber() || m_charsword.indexOf( ch ) != -1 )
+
+		candidates = documentsInScope( numbers, scope );
+	}
+
+	QVector<quint32> positions;
+
+	for ( int i = 0; i < candidates.size(); i++ )
+	{
+		if ( (i % 1024) == 0 && control && control->isStopped() )
+			return false;
+
+		int docnum = candidates[i].docNumber;
+		int frequency = 0;
+		QVector<quint32> docpositions;
+
+		Q_FOREACH( const Entry * e, entries )
 		{
-			parsedbuf.append( ch );
+			int index = e->docs.indexOf( docnum );
+
+			if ( index < 0 )
+				continue;
+
+			frequency += e->score( index );
+
+			if ( withPositions )
+			{
+				e->getPositions( index, positions );
+				docpositions += positions;
+			}
+		}
+
+		if ( frequency == 0 )
 			continue;
+
+		result.documents.push_back( Document( docnum, frequency ) );
+
+		if ( withPositions )
+		{
+			if ( entries.size() > 1 )
+				qSort( docpositions );
+
+			result.positions.push_back( docpositions );
 		}
-		
-		// If it is a split char, add the word to the dictionary, and then add the char itself.
-		if ( m_charssplit.indexOf( ch ) != -1 )
+	}
+
+	return true;
+}
+
+
+bool Index::evaluatePhrase( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const
+{
+	QVector<const Entry*> entries;
+	int rarest = 0;
+
+	result.length = node->words.size();
+
+	for ( int i = 0; i < node->words.size(); i++ )
+	{
+		const Entry * e = dict.value( node->words[i] );
+
+		// One of the words is not present at all
+		if ( !e )
+			return true;
+
+		entries.push_back( e );
+
+		if ( e->docs.size() < entries[rarest]->docs.size() )
+			rarest = i;
+	}
+
+	// Only the documents containing the rarest word need to be checked, or the scope documents if there are
+	// fewer of them. The others are looked up in their document sets, which takes a constant time for the
+	// frequent words.
+	bool checkScope = scope && scope->size() <= entries[rarest]->docs.size();
+	QVector<Document> rarestDocuments;
+
+	if ( !checkScope )
+		rarestDocuments = documentsInScope( entries[rarest]->docs.toVector(), scope );
+
+	const QVector<Document>& candidates = checkScope ? *scope : rarestDocuments;
+	QVector<int> indexes( entries.size() );
+	QVector<quint32> starts, next;
+
+	for ( int i = 0; i < candidates.size(); i++ )
+	{
+		if ( (i % 1024) == 0 && control && control->isStopped() )
+			return false;
+
+		int docnum = candidates[i].docNumber;
+		int frequency = 0;
+		bool found = true;
+
+		for ( int j = 0; j < entries.size() && found; j++ )
 		{
-			if ( !parsedbuf.isEmpty() )
-				tokenlist.push_back( parsedbuf.toLower() );
-			
-			tokenlist.push_back( ch.toLower() );
-			parsedbuf = QString::null;
-			continue;
+			indexes[j] = entries[j]->docs.indexOf( docnum );
+
+			if ( indexes[j] < 0 )
+				found = false;
+			else
+				frequency += entries[j]->score( indexes[j] );
 		}
-		
-tokenize_buf:		
-		// Just add the word; it is most likely a space or terminated by tokenizer.
-		if ( !parsedbuf.isEmpty() )
+
+		if ( !found )
+			continue;
+
+		// Keep the positions of the first word which are followed by the rest of the phrase
+		entries[0]->getPositions( indexes[0], starts );
+
+		for ( int j = 1; j < entries.size() && !starts.isEmpty(); j++ )
 		{
-			tokenlist.push_back( parsedbuf.toLower() );
-			parsedbuf = QString::null;
+			entries[j]->getPositions( indexes[j], next );
+
+			int k = 0, kept = 0;
+
+			for ( int s = 0; s < starts.size(); s++ )
+			{
+				quint32 wanted = starts[s] + j;
+
+				while ( k < next.size() && next[k] < wanted )
+					k++;
+
+				if ( k < next.size() && next[k] == wanted )
+					starts[kept++] = starts[s];
+			}
+
+			starts.resize( kept );
 		}
+
+		if ( starts.isEmpty() )
+			continue;
+
+		result.documents.push_back( Document( docnum, frequency ) );
+
+		if ( withPositions )
+			result.positions.push_back( starts );
 	}
-	
-	// Add the last word if still here - for broken htmls.
-	if ( !parsedbuf.isEmpty() )
-		tokenlist.push_back( parsedbuf.toLower() );
-	
+
 	return true;
 }
 
 
-void Index::writeDict( QDataStream& stream )
+bool Index::evaluateNear( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const
 {
-	stream << DICT_VERSION;
-	stream << m_charssplit;
-	stream << m_charsword;
-	
-	// Document list
-	stream << docList;
-	
-	// Dictionary
-	for( QHash<QString, Entry *>::ConstIterator it = dict.begin(); it != dict.end(); ++it )
+	const QueryNode * a = node->children[0];
+	const QueryNode * b = node->children[1];
+
+	// Start from the cheaper operand
+	if ( estimateCost( b ) < estimateCost( a ) )
+		qSwap( a, b );
+
+	MatchList ma, mb;
+
+	if ( !evaluate( a, scope, true, ma, control ) || !evaluate( b, &ma.documents, true, mb, control ) )
+		return false;
+
+	// The documents of mb are a subset of ma
+	for ( int i = 0, j = 0; j < mb.documents.size(); j++ )
 	{
-		stream << it.key();
-		stream << (int) it.value()->documents.count();
-		stream << it.value()->documents;
+		while ( ma.documents[i].docNumber != mb.documents[j].docNumber )
+			i++;
+
+		if ( hasNearMatches( ma.positions[i], ma.length, mb.positions[j], mb.length, node->distance ) )
+			result.documents.push_back( Document( mb.documents[j].docNumber, ma.documents[i].frequency + mb.documents[j].frequency ) );
 	}
+
+	return true;
 }
 
 
-bool Index::readDict( QDataStream& stream )
+bool Index::evaluateAnd( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const
 {
-	dict.clear();
-	docList.clear();
-	
-	QString key;
-	int version, numOfDocs;
-	
-	stream >> version;
-	
-	if ( version < 2 )
-		return false;
-	
-	stream >> m_charssplit;
-	stream >> m_charsword;
-	
-	// Read the document list
-	stream >> docList;
-	
-	while ( !stream.atEnd() )
+	QList<NodeCost> operands;
+	QList<const QueryNode*> excluded;
+
+	for ( int i = 0; i < node->children.size(); i++ )
 	{
-		stream >> key;
-		stream >> numOfDocs;
-		
-		QVector<Document> docs( numOfDocs );
-		
-		stream >> docs;
-		dict.insert( key, new Entry( docs ) );
+		if ( node->children[i]->type == QueryNode::NOT )
+			excluded.push_back( node->children[i]->children[0] );
+		else
+			operands.push_back( NodeCost( node->children[i], estimateCost( node->children[i] ) ) );
 	}
-	
-	return dict.size() > 0;
+
+	// The cheapest operand limits the documents checked for the rest
+	qSort( operands );
+
+	QVector<Document> current;
+	bool limited = false;
+
+	if ( scope )
+	{
+		current = allDocuments( scope );
+		limited = true;
+	}
+
+	for ( int i = 0; i < operands.size(); i++ )
+	{
+		if ( limited && current.isEmpty() )
+			break;
+
+		MatchList match;
+
+		if ( !evaluate( operands[i].node, limited ? &current : 0, false, match, control ) )
+			return false;
+
+		if ( limited )
+			current = intersectDocuments( current, match.documents );
+		else
+			current = match.documents;
+
+		limited = true;
+	}
+
+	// Only the excluded operands
+	if ( !limited )
+		current = allDocuments( 0 );
+
+	for ( int i = 0; i < excluded.size() && !current.isEmpty(); i++ )
+	{
+		MatchList match;
+
+		if ( !evaluate( excluded[i], &current, false, match, control ) )
+			return false;
+
+		current = subtractDocuments( current, match.documents );
+	}
+
+	result.documents = current;
+	return true;
+}
+
+
+bool Index::evaluateOr( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const
+{
+	for ( int i = 0; i < node->children.size(); i++ )
+	{
+		MatchList match;
+
+		if ( !evaluate( node->children[i], scope, false, match, control ) )
+			return false;
+
+		result.documents = uniteDocuments( result.documents, match.documents );
+	}
+
+	return true;
+}
+
+
+bool Index::evaluateNot( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const
+{
+	QVector<Document> base = allDocuments( scope );
+	MatchList match;
+
+	if ( !evaluate( node->children[0], &base, false, match, control ) )
+		return false;
+
+	result.documents = subtractDocuments( base, match.documents );
+	return true;
 }
 
 
-QList< QUrl > Index::query(const QStringList &terms, const QStringList &termSeq, const QStringList &seqWords, EBook *chmFile )
+QVector<Document> Index::getTextCandidates( const QStringList& literals, const QVector<Document> * scope ) const
 {
-	QList<Term> termList;
+	QVector<Document> candidates = allDocuments( scope );
+
+	// Without the trigram index every document is checked
+	if ( trigrams.isEmpty() )
+		return candidates;
 
-	QStringList::ConstIterator it = terms.begin();
-	for ( it = terms.begin(); it != terms.end(); ++it )
+	for ( int l = 0; l < literals.size(); l++ )
 	{
-		Entry *e = 0;
-		
-		if ( dict[ *it ] )
-		{
-			e = dict[ *it ];
-			termList.append( Term( *it, e->documents.count(), e->documents ) );
-		}
-		else
+		QString literal = literals[l].toLower();
+
+		for ( int i = 0; i + 3 <= literal.length() && !candidates.isEmpty(); i++ )
 		{
-			return QList< QUrl >();
+			QHash< quint64, QVector<qint32> >::ConstIterator it = trigrams.find( trigramKey( literal, i ) );
+
+			if ( it == trigrams.end() )
+				return QVector<Document>();
+
+			// Both lists are sorted by document number
+			const QVector<qint32>& docs = it.value();
+			int kept = 0;
+
+			for ( int c = 0, d = 0; c < candidates.size(); c++ )
+			{
+				while ( d < docs.size() && docs[d] < candidates[c].docNumber )
+					d++;
+
+				if ( d < docs.size() && docs[d] == candidates[c].docNumber )
+					candidates[kept++] = candidates[c];
+			}
+
+			candidates.resize( kept );
 		}
 	}
-	
-	if ( !termList.count() )
-		return QList< QUrl >();
-	
-	qSort( termList );
-
-	QVector<Document> minDocs = termList.takeFirst().documents;
-	for(QList<Term>::Iterator it = termList.begin(); it != termList.end(); ++it) {
-		Term *t = &(*it);
-		QVector<Document> docs = t->documents;
-		for(QVector<Document>::Iterator minDoc_it = minDocs.begin(); minDoc_it != minDocs.end(); ) {
-			bool found = false;
-			for (QVector<Document>::ConstIterator doc_it = docs.constBegin(); doc_it != docs.constEnd(); ++doc_it ) {
-				if ( (*minDoc_it).docNumber == (*doc_it).docNumber ) {
-					(*minDoc_it).frequency += (*doc_it).frequency;
-					found = true;
-					break;
-				}
+
+	return candidates;
+}
+
+
+bool Index::evaluateText( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const
+{
+	QRegularExpression regex;
+	QStringList literals;
+
+	if ( node->type == QueryNode::REGEX )
+	{
+		regex = QRegularExpression( node->words[0], QRegularExpression::CaseInsensitiveOption | QRegularExpression::UseUnicodePropertiesOption );
+
+		if ( !regex.isValid() )
+			return true;
+
+		literals = regexRequiredLiterals( node->words[0] );
+	}
+	else
+		literals.push_back( node->words[0] );
+
+	// Only the documents which contain all the trigrams are checked
+	QVector<Document> candidates = getTextCandidates( literals, scope );
+
+	for ( int i = 0; i < candidates.size(); i++ )
+	{
+		if ( (i % 64) == 0 && control && control->isStopped() )
+			return false;
+
+		int docnum = candidates[i].docNumber;
+
+		if ( docTexts[docnum].isEmpty() )
+			continue;
+
+		QString text = QString::fromUtf8( qUncompress( docTexts[docnum] ) );
+		int count = 0;
+
+		if ( node->type == QueryNode::REGEX )
+		{
+			QRegularExpressionMatchIterator it = regex.globalMatch( text );
+
+			while ( it.hasNext() )
+			{
+				it.next();
+				count++;
 			}
-			if ( !found )
-				minDoc_it = minDocs.erase( minDoc_it );
-			else
-				++minDoc_it;
 		}
+		else
+			count = text.count( node->words[0], Qt::CaseInsensitive );
+
+		if ( count > 0 )
+			result.documents.push_back( Document( docnum, count ) );
 	}
 
-	QList< QUrl > results;
-	qSort( minDocs );
-	if ( termSeq.isEmpty() ) {
-		for(QVector<Document>::Iterator it = minDocs.begin(); it != minDocs.end(); ++it)
-			results << docList.at((int)(*it).docNumber);
-		return results;
+	return true;
+}
+
+
+QVector< Document > Index::query( const QueryNode * root, const QVector<Document> * candidates, const QueryControl * control ) const
+{
+	MatchList result;
+	QVector<Document> scope;
+
+	// The candidates are sorted by relevance, but the evaluation needs them sorted by document number
+	if ( candidates )
+	{
+		scope = *candidates;
+		qSort( scope.begin(), scope.end(), documentNumberLessThan );
 	}
 
-	QUrl fileName;
-	for(QVector<Document>::Iterator it = minDocs.begin(); it != minDocs.end(); ++it) {
-		fileName =  docList[ (int)(*it).docNumber ];
-		if ( searchForPhrases( termSeq, seqWords, fileName, chmFile ) )
-			results << fileName;
+	// If the query is stopped, the result is incomplete
+	evaluate( root, candidates ? &scope : 0, false, result, control );
+
+	qStableSort( result.documents );
+	return result.documents;
+}
+
+
+qint64 Index::memoryUsage() const
+{
+	qint64 size = 0;
+
+	for ( int i = 0; i < docTexts.size(); i++ )
+		size += docTexts[i].size();
+
+	for ( int i = 0; i < docTitles.size(); i++ )
+		size += docTitles[i].size() * sizeof(QChar);
+
+	for ( int i = 0; i < docHashes.size(); i++ )
+		size += docHashes[i].size();
+
+	for ( QHash< quint64, QVector<qint32> >::ConstIterator it = trigrams.begin(); it != trigrams.end(); ++it )
+		size += sizeof(quint64) + it.value().size() * sizeof(qint32);
+
+	for ( QHash<QString, Entry *>::ConstIterator it = dict.begin(); it != dict.end(); ++it )
+	{
+		size += sizeof(Entry) + it.key().size() * sizeof(QChar)
+				+ it.value()->docs.memoryUsage()
+				+ it.value()->offsets.size() * sizeof(quint32)
+				+ it.value()->fields.size()
+				+ it.value()->positions.size();
 	}
-	
-	return results;
+
+	return size;
 }
 
 
-bool Index::searchForPhrases( const QStringList &phrases, const QStringList &words, const QUrl &filename, EBook * chmFile )
+QStringList Index::getFrequentTerms( int count ) const
 {
-	QStringList parsed_document;
+	QList< QPair<int, QString> > terms;
 
-	if ( !parseDocumentToStringlist( chmFile, filename, parsed_document ) )
-		return false;
+	for ( QHash<QString, Entry *>::ConstIterator it = dict.begin(); it != dict.end(); ++it )
+	{
+		if ( it.key().length() >= 3 && it.key()[0].isLetter() )
+			terms.push_back( qMakePair( -it.value()->docs.size(), it.key() ) );
+	}
 
-	miniDict.clear();
-	
-	// Initialize the dictionary with the words in phrase(s)
-	for ( QStringList::ConstIterator cIt = words.begin(); cIt != words.end(); ++cIt )
-		miniDict.insert( *cIt, new PosEntry( 0 ) );
+	qSort( terms );
+
+	QStringList result;
+
+	for ( int i = 0; i < count && i < terms.size(); i++ )
+		result.push_back( terms[i].second );
+
+	return result;
+}
+
+
+DocIdSet Index::getDocumentSet( const QList<QUrl>& urls ) const
+{
+	QVector<qint32> numbers;
 
-	// Fill the dictionary with the words from the document
-	unsigned int word_offset = 3;
-	for ( QStringList::ConstIterator it = parsed_document.begin(); it != parsed_document.end(); it++, word_offset++ )
+	for ( int i = 0; i < urls.size(); i++ )
 	{
-		PosEntry * entry = miniDict[ *it ];
-		
-		if ( entry )
-			entry->positions.append( word_offset );
+		QUrl url = urls[i];
+		url.setFragment( QString() );
+
+		int docnum = docNumbers.value( url, -1 );
+
+		if ( docnum >= 0 )
+			numbers.push_back( docnum );
 	}
-	
-	// Dump it
-/*	
-	QDictIterator<PosEntry> it( miniDict );
-	for( ; it.current(); ++it )
-	{
-		QString text( it.currentKey() );
-		QValueList<uint> pos = miniDict[text]->positions;
-		for ( unsigned int i = 1; i < pos.size(); i++ )
-			text += " " + QString::number( pos[i] );
-		
-		qDebug( "%s", text.ascii());
+
+	qSort( numbers );
+
+	DocIdSet result;
+
+	for ( int i = 0; i < numbers.size(); i++ )
+	{
+		if ( numbers[i] != result.last() )
+			result.append( numbers[i] );
 	}
-*/				
-	
-	QList<uint> first_word_positions;
-	
-	for ( QStringList::ConstIterator phrase_it = phrases.begin(); phrase_it != phrases.end(); phrase_it++ )
+
+	return result;
+}
+
+
+QString Index::getSnippet( const QUrl& url, const QStringList& terms, int maxlength ) const
+{
+	int docnum = docNumbers.value( url, -1 );
+
+	if ( docnum < 0 || docnum >= docTexts.size() || docTexts[docnum].isEmpty() )
+		return QString();
+
+	QString text = QString::fromUtf8( qUncompress( docTexts[docnum] ) );
+
+	// Only the word terms are highlighted; the split characters would match everywhere
+	QStringList words;
+	QVector<bool> prefixes;
+	QVector<bool> substrings;
+
+	for ( int i = 0; i < terms.size(); i++ )
 	{
-		QStringList phrasewords = phrase_it->split( ' ' );
-		first_word_positions = miniDict[ phrasewords[0] ]->positions;
-		
-		for ( int j = 1; j < phrasewords.count(); ++j )
+		if ( terms[i].length() > 2 && terms[i].startsWith( '*' ) && terms[i].endsWith( '*' ) )
 		{
-			QList<uint> next_word_it = miniDict[ phrasewords[j] ]->positions;
-			QList<uint>::iterator dict_it = first_word_positions.begin();
-			
-			while ( dict_it != first_word_positions.end() )
+			words.push_back( terms[i].mid( 1, terms[i].length() - 2 ) );
+			prefixes.push_back( false );
+			substrings.push_back( true );
+		}
+		else if ( terms[i].length() > 1 && terms[i].endsWith( '*' ) )
+		{
+			words.push_back( terms[i].left( terms[i].length() - 1 ) );
+			prefixes.push_back( true );
+			substrings.push_back( false );
+		}
+		else if ( terms[i].length() > 1 || (terms[i].length() == 1 && m_charssplit.indexOf( terms[i][0] ) == -1) )
+		{
+			words.push_back( terms[i] );
+			prefixes.push_back( false );
+			substrings.push_back( false );
+		}
+	}
+
+	// Find the first occurrence of any term
+	int first = -1;
+
+	for ( int i = 0; i < words.size(); i++ )
+	{
+		int pos = 0;
+
+		while ( (pos = text.indexOf( words[i], pos, Qt::CaseInsensitive )) != -1 && (first == -1 || pos < first) )
+		{
+			if ( substrings[i] || isWholeWordAt( text, pos, words[i].length(), prefixes[i] ) )
 			{
-				if ( next_word_it.indexOf( *dict_it + 1 ) != -1 )
-				{
-					(*dict_it)++;
-					++dict_it;
-				}
-				else
-					dict_it = first_word_positions.erase( dict_it );
+				first = pos;
+				break;
 			}
+
+			pos++;
 		}
 	}
-	
-	if ( first_word_positions.count() )
-		return true;
-	
-	return false;
+
+	// Start the snippet at the beginning of a word before the match
+	int start = 0;
+
+	if ( first > SNIPPET_LEADING_CONTEXT )
+	{
+		start = text.indexOf( ' ', first - SNIPPET_LEADING_CONTEXT ) + 1;
+
+		if ( start <= 0 || start > first )
+			start = first - SNIPPET_LEADING_CONTEXT;
+	}
+
+	int end = qMin( text.length(), start + maxlength );
+
+	if ( end < text.length() )
+	{
+		int space = text.lastIndexOf( ' ', end );
+
+		if ( space > first && space > start )
+			end = space;
+	}
+
+	// Build the snippet, marking all the terms in it
+	QString snippet;
+
+	if ( start > 0 )
+		snippet = "...";
+
+	for ( int pos = start; pos < end; )
+	{
+		int matchlen = 0;
+
+		for ( int i = 0; i < words.size(); i++ )
+		{
+			if ( text.midRef( pos, words[i].length() ).compare( words[i], Qt::CaseInsensitive ) != 0
+			|| (!substrings[i] && !isWholeWordAt( text, pos, words[i].length(), prefixes[i] )) )
+				continue;
+
+			int length = words[i].length();
+
+			// Mark the whole word which starts with the prefix
+			while ( prefixes[i] && pos + length < end && isSameWord( text[pos + length - 1], text[pos + length] ) )
+				length++;
+
+			matchlen = qMax( matchlen, length );
+		}
+
+		if ( matchlen > 0 )
+		{
+			snippet += "<b>" + text.mid( pos, matchlen ).toHtmlEscaped() + "</b>";
+			pos += matchlen;
+		}
+		else
+		{
+			snippet += QString( text[pos] ).toHtmlEscaped();
+			pos++;
+		}
+	}
+
+	if ( end < text.length() )
+		snippet += "...";
+
+	return snippet.trimmed();
 }
 
 
@@ -24,11 +24,16 @@
 #include <QVector>
 #include <QDataStream>
 #include <QStringList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 
 #include "helper_entitydecoder.h"
+#include "helper_search_docset.h"
+#include "helper_search_query.h"
 
 
 class EBook;
+class QTemporaryFile;
 
 // This code is based on some pretty old version of Qt Assistant
 namespace QtAs
@@ -58,24 +63,82 @@ struct Document
 		return frequency < doc.frequency;
 	}
 	
-	qint16	docNumber;
-	qint16	frequency;
+	qint32	docNumber;
+	qint32	frequency;		// or the relevance score in the query results
 };
 
 QDataStream &operator>>( QDataStream &s, Document &l );
 QDataStream &operator<<( QDataStream &s, const Document &l );
 
+//! Allows to cancel the query running in another thread, and limits the time it may take
+class QueryControl
+{
+	public:
+		//! \param timeBudget is in milliseconds; 0 means no limit. The time is counted from construction.
+		QueryControl( int timeBudget = 0 ) : m_cancelled( 0 ), m_timeBudget( timeBudget ) { m_timer.start(); }
+
+		void	cancel() { m_cancelled.store( 1 ); }
+		bool	isCancelled() const { return m_cancelled.load() != 0; }
+		bool	isTimedOut() const { return m_timeBudget > 0 && m_timer.elapsed() > m_timeBudget; }
+		bool	isStopped() const { return isCancelled() || isTimedOut(); }
+
+	private:
+		QAtomicInt		m_cancelled;
+		QElapsedTimer	m_timer;
+		int				m_timeBudget;
+};
+
 class Index : public QObject
 {
     Q_OBJECT
 	public:
 
 		Index();
+		~Index();
 		
-		void 		writeDict( QDataStream& stream );
+		//! Writes the index. If makeIndex() wrote its parts into the temporary files, they are merged straight
+		//! into the stream, and the index is left empty; see isSpilled(). Returns false on a write error.
+		bool 		writeDict( QDataStream& stream );
 		bool 		readDict( QDataStream& stream );
-		bool 		makeIndex(const QList<QUrl> &docs, EBook * chmFile );
-		QList<QUrl>	query( const QStringList&, const QStringList&, const QStringList&, EBook * chmFile );
+		//! Builds the index of \param docs. If \param previous is not null, it is the index of the previous
+		//! revision of the ebook; the documents which content did not change are not parsed again, but their
+		//! postings are copied from it.
+		bool 		makeIndex( const QList<QUrl> &docs, EBook * chmFile, const Index * previous = 0 );
+
+		//! Enables building the trigram index in makeIndex(), which speeds up the substring and regular
+		//! expression search. Without it those queries check the text of every document.
+		void		setTrigramsEnabled( bool enabled ) { trigramsEnabled = enabled; }
+
+		//! Limits the memory the dictionary and the trigrams may take in makeIndex(), in bytes; 0 means no limit.
+		//! With a limit, the document texts are written into a temporary file as they are made. When the limit is
+		//! exceeded, the dictionary and the trigrams are written sorted into the temporary files, and writeDict()
+		//! merges all such files into the output. So the memory taken is about the limit, plus a document entry
+		//! per document, plus the previous index if it is given to makeIndex(). The limit is approximate.
+		void		setMemoryBudget( qint64 bytes ) { memoryBudget = bytes; }
+
+		//! Returns true if makeIndex() wrote the parts of the index into the temporary files. Such an index is
+		//! only written by writeDict(), and must be read back with readDict() to be queried.
+		bool		isSpilled() const { return textFile != 0 || !runFiles.isEmpty() || !trigramRunFiles.isEmpty(); }
+		//! Returns the documents matching the query, sorted by relevance. If \param candidates is not null, only
+		//! those documents are checked. The query may run in another thread concurrently with other queries;
+		//! if \param control stops it, the results are incomplete.
+		QVector<Document> query( const QueryNode * root, const QVector<Document> * candidates = 0, const QueryControl * control = 0 ) const;
+
+		//! Returns up to \param count words present in most documents
+		QStringList	getFrequentTerms( int count ) const;
+		QUrl		getDocumentUrl( int docNumber ) const { return docList[ docNumber ]; }
+		QString		getDocumentTitle( int docNumber ) const { return docTitles.value( docNumber ); }
+
+		//! Returns the numbers of the documents with the \param urls, ignoring the fragments. The URLs which are
+		//! not in the index are skipped. The set could be used to limit the query to a part of the ebook.
+		DocIdSet	getDocumentSet( const QList<QUrl>& urls ) const;
+
+		//! Returns the approximate size of the index in memory, in bytes
+		qint64		memoryUsage() const;
+
+		//! Returns the HTML snippet of the document text around the first of the \param terms, with all the terms
+		//! marked in bold. The snippet is made from the text stored in the index, so the document is not fetched.
+		QString		getSnippet( const QUrl& url, const QStringList& terms, int maxlength ) const;
 		QString 	getCharsSplit() const { return m_charssplit; }
 		QString 	getCharsPartOfWord() const { return m_charsword; }
 
@@ -86,30 +149,100 @@ class Index : public QObject
 		void setLastWinClosed();
 
 	private:
+		// The documents containing the term, and the term positions in them
 		struct Entry
 		{
-			Entry( int d ) { documents.append( Document( d, 1 ) ); }
-			Entry( QVector<Document> l ) : documents( l ) {}
-			QVector<Document> documents;
+			Entry() : lastPosition( 0 ) {}
+
+			// Returns how many times the term is in the document i; it is the number of its positions
+			int		frequency( int i ) const;
+
+			// Returns the relevance of the document i: the frequency, and the weights of the fields the term is in
+			int		score( int i ) const;
+
+			// Returns the documents with their scores
+			QVector<Document>	documentList() const;
+
+			// Decodes the word positions in the document i
+			void	getPositions( int i, QVector<quint32>& result ) const;
+
+			// Appends the document i of the source with its positions; the document must go after all the present ones
+			void	appendDocument( const Entry& source, int i, int docNumber );
+
+			// Adds the documents of the source, which are not present in this entry
+			void	merge( const Entry& source );
+
+			DocIdSet			docs;			// the documents containing the term
+			QVector<quint32>	offsets;		// where the positions of each document start
+			QByteArray			positions;		// word positions in each document, delta and varint encoded
+			QByteArray			fields;			// where the term is in each document: FIELD_* flags in the .cpp
+			quint32				lastPosition;	// used when the index is built
 		};
 		
-		struct PosEntry
+		// Documents matching a query node, sorted by document number
+		struct MatchList
 		{
-			PosEntry( int p ) { positions.append( p ); }
-			QList<uint> positions;
+			MatchList() : length( 0 ) {}
+
+			QVector<Document>			documents;
+			QVector< QVector<quint32> >	positions;	// start positions of the matches in each document, if requested
+			int							length;		// how many words each match covers
 		};
+
+		void	clearDict();
+		void	parseTextToStringlist( const QString& text, QStringList& tokenlist, QString * plaintext = 0, QByteArray * tokenfields = 0 );
+		QString	parseTitle( const QString& html );
+		void	insertInDict( const QString& str, int docNum, quint32 position, int field );
+
+		// The names of the table of contents and the keyword index entries pointing to each document
+		void	collectEntryNames( EBook * chmFile, QVector<QString>& contents, QVector<QString>& keywords ) const;
+		void	markField( const QString& names, int docNum, int field );
+		QStringList	nameTerms( const QString& names );
+
+		// Building the index in limited memory
+		void	checkMemoryBudget();
+		bool	spillDict();
+		bool	spillTrigrams();
+		bool	storeText( int docNum, const QByteArray& text );
+		bool	writeTexts( QDataStream& stream );
+		bool	mergeRuns( QDataStream& stream );
+		bool	mergeTrigramRuns( QDataStream& stream );
+		void	clearRuns();
+		static void	writeEntry( QDataStream& stream, const QString& term, const Entry& entry );
+		static bool	readEntry( QDataStream& stream, QString& term, Entry& entry );
+		void	carryOverPostings( const Index * previous, const QVector<int>& newNumbers,
+								   const QVector<QString>& contentNames, const QVector<QString>& keywordNames );
 		
-		bool	parseDocumentToStringlist( EBook * chmFile, const QUrl& filename, QStringList& tokenlist );
-		void	insertInDict( const QString&, int );
-		
-		QStringList				getWildcardTerms( const QString& );
-		QStringList				split( const QString& );
-		QList<Document> 		setupDummyTerm( const QStringList& );
-		bool 					searchForPhrases(const QStringList &phrases, const QStringList &words, const QUrl &filename, EBook * chmFile );
+		// Query evaluation
+		QList<const Entry*>		getTermEntries( const QueryNode * node ) const;
+		int						estimateCost( const QueryNode * node ) const;
+		QVector<Document>		allDocuments( const QVector<Document> * scope ) const;
+		bool					evaluate( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateTerm( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const;
+		bool					evaluatePhrase( const QueryNode * node, const QVector<Document> * scope, bool withPositions, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateNear( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateAnd( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateOr( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateNot( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const;
+		bool					evaluateText( const QueryNode * node, const QVector<Document> * scope, MatchList& result, const QueryControl * control ) const;
+		QVector<Document>		getTextCandidates( const QStringList& literals, const QVector<Document> * scope ) const;
+		void					insertTrigrams( const QString& text, int docNum );
 		
 		QList< QUrl > 			docList;
+		QVector< QByteArray >	docTexts;		// compressed plain text of each document in docList
+		QStringList				docTitles;		// the HTML title of each document in docList
+		QVector< QByteArray >	docHashes;		// the hash of each document content, to find the unchanged ones
+		QHash< QUrl, int >		docNumbers;		// reverse map for docList
 		QHash<QString, Entry*> 	dict;
-		QHash<QString,PosEntry*>miniDict;
+		QStringList				sortedTerms;	// dictionary keys in sorted order, for prefix search
+		QHash< quint64, QVector<qint32> >	trigrams;	// documents containing each three characters of the lower case text
+		bool					trigramsEnabled;
+		qint64					memoryBudget;
+		qint64					dictMemory;		// approximate size of dict while the index is built
+		qint64					trigramMemory;	// approximate size of trigrams while the index is built
+		QList<QTemporaryFile*>	runFiles;		// the parts of dict written by spillDict(), in document order
+		QList<QTemporaryFile*>	trigramRunFiles;	// the parts of trigrams written by spillTrigrams(), in document order
+		QTemporaryFile		*	textFile;		// docTexts written while the index is built with a memory limit
 		bool 					lastWindowClosed;
 		HelperEntityDecoder		entityDecoder;
 	
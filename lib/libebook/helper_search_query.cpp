@@ -0,0 +1,567 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QRegularExpression>
+
+#include "helper_search_query.h"
+
+namespace QtAs {
+
+bool isCjkCharacter( QChar ch )
+{
+	ushort code = ch.unicode();
+
+	return (code >= 0x1100 && code <= 0x11FF)		// Hangul Jamo
+		|| (code >= 0x3040 && code <= 0x30FF)		// Hiragana, Katakana
+		|| (code >= 0x3130 && code <= 0x318F)		// Hangul Compatibility Jamo
+		|| (code >= 0x31F0 && code <= 0x31FF)		// Katakana Phonetic Extensions
+		|| (code >= 0x3400 && code <= 0x4DBF)		// CJK Unified Ideographs Extension A
+		|| (code >= 0x4E00 && code <= 0x9FFF)		// CJK Unified Ideographs
+		|| (code >= 0xAC00 && code <= 0xD7AF)		// Hangul Syllables
+		|| (code >= 0xF900 && code <= 0xFAFF)		// CJK Compatibility Ideographs
+		|| (code >= 0xFF66 && code <= 0xFF9F);		// Halfwidth Katakana
+}
+
+
+void appendBigrams( const QString& text, QStringList& words )
+{
+	if ( text.length() == 1 )
+	{
+		words.push_back( text );
+		return;
+	}
+
+	for ( int i = 0; i + 1 < text.length(); i++ )
+		words.push_back( text.mid( i, 2 ) );
+}
+
+
+// Appends the word, or its character pairs if it is CJK text, the same way as the indexer does
+static void appendWord( const QString& word, QStringList& words )
+{
+	if ( isCjkCharacter( word[0] ) )
+		appendBigrams( word, words );
+	else
+		words.push_back( word );
+}
+
+
+QueryNode * QueryNode::clone() const
+{
+	QueryNode * node = new QueryNode( type );
+	node->words = words;
+	node->distance = distance;
+
+	for ( int i = 0; i < children.size(); i++ )
+		node->children.push_back( children[i]->clone() );
+
+	return node;
+}
+
+
+QString QueryNode::toString() const
+{
+	switch ( type )
+	{
+		case TERM:
+			return words[0];
+
+		case PREFIX:
+			return words[0] + "*";
+
+		case PHRASE:
+			return "\"" + words.join( " " ) + "\"";
+
+		case SUBSTRING:
+			return "*" + words[0] + "*";
+
+		case REGEX:
+			return "/" + words[0] + "/";
+
+		case NOT:
+			return "NOT " + children[0]->toString();
+
+		default:
+			break;
+	}
+
+	// The order of the operands does not matter for AND, OR and NEAR
+	QStringList operands;
+
+	for ( int i = 0; i < children.size(); i++ )
+		operands.push_back( children[i]->toString() );
+
+	operands.sort();
+
+	if ( type == AND )
+		return "(" + operands.join( " AND " ) + ")";
+	else if ( type == OR )
+		return "(" + operands.join( " OR " ) + ")";
+	else
+		return "(" + operands.join( QString( " NEAR/%1 " ).arg( distance ) ) + ")";
+}
+
+
+QList<const QueryNode*> QueryNode::conjuncts() const
+{
+	QList<const QueryNode*> list;
+
+	if ( type == AND )
+	{
+		for ( int i = 0; i < children.size(); i++ )
+			list.push_back( children[i] );
+	}
+	else
+		list.push_back( this );
+
+	return list;
+}
+
+
+void QueryNode::collectTerms( QStringList& terms ) const
+{
+	switch ( type )
+	{
+		case TERM:
+		case PHRASE:
+			terms += words;
+			break;
+
+		case PREFIX:
+			terms.push_back( words[0] + "*" );
+			break;
+
+		case SUBSTRING:
+			terms.push_back( "*" + words[0] + "*" );
+			break;
+
+		case NOT:
+		case REGEX:
+			break;
+
+		default:
+			for ( int i = 0; i < children.size(); i++ )
+				children[i]->collectTerms( terms );
+			break;
+	}
+}
+
+
+QueryParser::QueryParser( const QString& charsSplit, const QString& charsWord )
+	: m_charssplit( charsSplit ), m_charsword( charsWord )
+{
+	m_current = 0;
+}
+
+
+QueryNode * QueryParser::parse( const QString& query, bool lastTermIsPrefix )
+{
+	if ( !tokenize( query, lastTermIsPrefix ) || m_tokens.isEmpty() )
+		return 0;
+
+	m_current = 0;
+	QueryNode * root = parseOr();
+
+	// Something left unparsed, like the unmatched closing bracket
+	if ( root && !atEnd() )
+	{
+		delete root;
+		return 0;
+	}
+
+	return root;
+}
+
+
+void QueryParser::splitWords( const QString& text, QStringList& words ) const
+{
+	QString word;
+
+	// Same rules as the indexer uses
+	for ( int i = 0; i < text.length(); i++ )
+	{
+		QChar ch = text[i].toLower();
+
+		if ( ch.isLetterOrNumber() || m_charsword.indexOf( ch ) != -1 )
+		{
+			if ( !word.isEmpty() && isCjkCharacter( ch ) != isCjkCharacter( word[0] ) )
+			{
+				appendWord( word, words );
+				word = QString::null;
+			}
+
+			word.append( ch );
+			continue;
+		}
+
+		if ( !word.isEmpty() )
+		{
+			appendWord( word, words );
+			word = QString::null;
+		}
+
+		if ( m_charssplit.indexOf( ch ) != -1 )
+			words.push_back( ch );
+	}
+
+	if ( !word.isEmpty() )
+		appendWord( word, words );
+}
+
+
+// Returns the position of the delimiter which ends the token started at start, or -1. The delimiter
+// must be followed by a space, a closing bracket or the end of the query, and must not be escaped.
+// Only the regular expressions may contain spaces.
+int QueryParser::findTokenEnd( const QString& query, int start, QChar delimiter ) const
+{
+	for ( int i = start + 1; i < query.length(); i++ )
+	{
+		if ( query[i] == '\\' )
+		{
+			i++;
+			continue;
+		}
+
+		if ( query[i] == delimiter && (i + 1 == query.length() || query[i + 1].isSpace() || query[i + 1] == ')') )
+			return i;
+
+		if ( query[i].isSpace() && delimiter != '/' )
+			return -1;
+	}
+
+	return -1;
+}
+
+
+bool QueryParser::tokenize( const QString& query, bool lastTermIsPrefix )
+{
+	m_tokens.clear();
+
+	for ( int i = 0; i < query.length(); )
+	{
+		QChar ch = query[i];
+
+		if ( ch.isSpace() )
+		{
+			i++;
+			continue;
+		}
+
+		// Everything in quotes is a phrase
+		if ( ch == '"' )
+		{
+			int end = query.indexOf( '"', i + 1 );
+
+			if ( end == -1 )
+				return false;
+
+			Token token( Token::PHRASE );
+			splitWords( query.mid( i + 1, end - i - 1 ), token.words );
+
+			if ( !token.words.isEmpty() )
+				m_tokens.push_back( token );
+
+			i = end + 1;
+			continue;
+		}
+
+		bool tokenstart = (i == 0 || query[i - 1].isSpace() || query[i - 1] == '('
+						|| (query[i - 1] == '-' && !m_tokens.isEmpty() && m_tokens.last().type == Token::OP_NOT));
+
+		// The regular expression is in slashes, and the substring is in asterisks; otherwise
+		// those are the split characters searched as is
+		if ( tokenstart && (ch == '/' || ch == '*') )
+		{
+			int end = findTokenEnd( query, i, ch );
+
+			if ( end > i + 1 )
+			{
+				QString text = query.mid( i + 1, end - i - 1 );
+
+				if ( ch == '/' && !QRegularExpression( text ).isValid() )
+					return false;
+
+				Token token( ch == '/' ? Token::REGEX : Token::SUBSTRING );
+				token.words.push_back( text );
+				m_tokens.push_back( token );
+
+				i = end + 1;
+				continue;
+			}
+		}
+
+		if ( ch == '(' || ch == ')' )
+		{
+			m_tokens.push_back( Token( ch == '(' ? Token::LEFT_BRACKET : Token::RIGHT_BRACKET ) );
+			i++;
+			continue;
+		}
+
+		// The minus which starts the word negates it; otherwise it is searched as is (like in "window->print")
+		if ( ch == '-'
+		&& (i == 0 || query[i - 1].isSpace() || query[i - 1] == '(')
+		&& i + 1 < query.length() && !query[i + 1].isSpace() && query[i + 1] != '-' )
+		{
+			m_tokens.push_back( Token( Token::OP_NOT ) );
+			i++;
+			continue;
+		}
+
+		if ( ch.isLetterOrNumber() || m_charsword.indexOf( ch ) != -1 )
+		{
+			int start = i;
+			bool cjk = isCjkCharacter( ch );
+
+			// The CJK text is a separate word even without spaces around it, as the indexer splits it
+			while ( i < query.length() && (query[i].isLetterOrNumber() || m_charsword.indexOf( query[i] ) != -1)
+			&& isCjkCharacter( query[i] ) == cjk )
+				i++;
+
+			QString word = query.mid( start, i - start );
+
+			if ( cjk )
+			{
+				// The phrase of the character pairs; a single character is the start of the pairs
+				Token token( Token::PHRASE );
+				appendBigrams( word, token.words );
+				token.prefix = word.length() == 1;
+				m_tokens.push_back( token );
+			}
+			else if ( word == "AND" )
+				m_tokens.push_back( Token( Token::OP_AND ) );
+			else if ( word == "OR" )
+				m_tokens.push_back( Token( Token::OP_OR ) );
+			else if ( word == "NOT" )
+				m_tokens.push_back( Token( Token::OP_NOT ) );
+			else if ( word == "NEAR" && i < query.length() && query[i] == '/' )
+			{
+				int numstart = ++i;
+
+				while ( i < query.length() && query[i].isDigit() )
+					i++;
+
+				if ( i == numstart )
+					return false;
+
+				Token token( Token::OP_NEAR );
+				token.distance = query.mid( numstart, i - numstart ).toInt();
+				m_tokens.push_back( token );
+			}
+			else
+			{
+				Token token( Token::WORD );
+				token.words.push_back( word.toLower() );
+
+				// The last word is still being typed
+				token.prefix = lastTermIsPrefix && i == query.length();
+				m_tokens.push_back( token );
+			}
+
+			continue;
+		}
+
+		// Split characters are words themselves; the rest is ignored like spaces
+		if ( m_charssplit.indexOf( ch ) != -1 )
+		{
+			Token token( Token::WORD );
+			token.words.push_back( ch.toLower() );
+			m_tokens.push_back( token );
+		}
+
+		i++;
+	}
+
+	return true;
+}
+
+
+QueryNode * QueryParser::parseOr()
+{
+	QueryNode * left = parseAnd();
+
+	if ( !left || !peek( Token::OP_OR ) )
+		return left;
+
+	QueryNode * node = new QueryNode( QueryNode::OR );
+	node->children.push_back( left );
+
+	while ( peek( Token::OP_OR ) )
+	{
+		m_current++;
+		QueryNode * right = parseAnd();
+
+		if ( !right )
+		{
+			delete node;
+			return 0;
+		}
+
+		node->children.push_back( right );
+	}
+
+	return node;
+}
+
+
+QueryNode * QueryParser::parseAnd()
+{
+	QueryNode * node = new QueryNode( QueryNode::AND );
+
+	// The operands without operator between them are joined by AND
+	while ( !atEnd() && !peek( Token::RIGHT_BRACKET ) && !peek( Token::OP_OR ) )
+	{
+		if ( peek( Token::OP_AND ) )
+		{
+			m_current++;
+			continue;
+		}
+
+		QueryNode * child = parseUnary();
+
+		if ( !child )
+		{
+			delete node;
+			return 0;
+		}
+
+		node->children.push_back( child );
+	}
+
+	if ( node->children.isEmpty() )
+	{
+		delete node;
+		return 0;
+	}
+
+	if ( node->children.size() == 1 )
+	{
+		QueryNode * child = node->children.takeFirst();
+		delete node;
+		return child;
+	}
+
+	return node;
+}
+
+
+QueryNode * QueryParser::parseUnary()
+{
+	if ( !peek( Token::OP_NOT ) )
+		return parseNear();
+
+	m_current++;
+	QueryNode * child = parseUnary();
+
+	if ( !child )
+		return 0;
+
+	QueryNode * node = new QueryNode( QueryNode::NOT );
+	node->children.push_back( child );
+	return node;
+}
+
+
+QueryNode * QueryParser::parseNear()
+{
+	QueryNode * left = parsePrimary();
+
+	if ( !left || !peek( Token::OP_NEAR ) )
+		return left;
+
+	QueryNode * result = new QueryNode( QueryNode::AND );
+
+	while ( peek( Token::OP_NEAR ) )
+	{
+		int distance = m_tokens[ m_current++ ].distance;
+		QueryNode * right = parsePrimary();
+
+		// Only the words and phrases have positions
+		if ( !right || !left->isPositional() || !right->isPositional() )
+		{
+			delete left;
+			delete right;
+			delete result;
+			return 0;
+		}
+
+		QueryNode * nearnode = new QueryNode( QueryNode::NEAR );
+		nearnode->distance = distance;
+		nearnode->children.push_back( left );
+		nearnode->children.push_back( right );
+		result->children.push_back( nearnode );
+
+		// The chain a NEAR/n b NEAR/n c means both a NEAR/n b and b NEAR/n c
+		left = right->clone();
+	}
+
+	delete left;
+
+	if ( result->children.size() == 1 )
+	{
+		QueryNode * nearnode = result->children.takeFirst();
+		delete result;
+		return nearnode;
+	}
+
+	return result;
+}
+
+
+QueryNode * QueryParser::parsePrimary()
+{
+	if ( atEnd() )
+		return 0;
+
+	const Token& token = m_tokens[ m_current ];
+
+	if ( token.type == Token::LEFT_BRACKET )
+	{
+		m_current++;
+		QueryNode * node = parseOr();
+
+		if ( !node || !peek( Token::RIGHT_BRACKET ) )
+		{
+			delete node;
+			return 0;
+		}
+
+		m_current++;
+		return node;
+	}
+
+	if ( token.type != Token::WORD && token.type != Token::PHRASE && token.type != Token::SUBSTRING && token.type != Token::REGEX )
+		return 0;
+
+	QueryNode * node;
+
+	if ( token.type == Token::SUBSTRING )
+		node = new QueryNode( QueryNode::SUBSTRING );
+	else if ( token.type == Token::REGEX )
+		node = new QueryNode( QueryNode::REGEX );
+	else if ( token.words.size() > 1 )
+		node = new QueryNode( QueryNode::PHRASE );
+	else
+		node = new QueryNode( token.prefix ? QueryNode::PREFIX : QueryNode::TERM );
+
+	node->words = token.words;
+	m_current++;
+
+	return node;
+}
+
+};
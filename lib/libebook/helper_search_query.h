@@ -0,0 +1,141 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_SEARCH_QUERY_H
+#define HELPER_SEARCH_QUERY_H
+
+#include <QList>
+#include <QtAlgorithms>
+#include <QString>
+#include <QStringList>
+
+namespace QtAs
+{
+
+//! A node of the parsed search query
+class QueryNode
+{
+	public:
+		enum Type
+		{
+			TERM,		//!< a single word or split character
+			PREFIX,		//!< all the words starting with the word
+			PHRASE,		//!< the words following each other
+			AND,		//!< all the children must match
+			OR,			//!< any of the children must match
+			NOT,		//!< the only child must not match
+			NEAR,		//!< both children (terms or phrases) are at most distance words apart
+			SUBSTRING,	//!< the text contains the string, even inside a word
+			REGEX		//!< the text matches the regular expression
+		};
+
+		QueryNode( Type type_ ) : type( type_ ), distance( 0 ) {}
+		~QueryNode() { qDeleteAll( children ); }
+
+		//! Returns the deep copy of the node
+		QueryNode * clone() const;
+
+		//! Returns true if the node matches the word positions, and thus could be used in NEAR
+		bool	isPositional() const { return type == TERM || type == PREFIX || type == PHRASE; }
+
+		//! Returns the canonical string for the node, which is the same for the equivalent queries
+		//! (like a b and b a); used as a cache key.
+		QString	toString() const;
+
+		//! Returns the list of the nodes which all must match; for AND these are its children.
+		QList<const QueryNode*>	conjuncts() const;
+
+		//! Appends the words which the matching documents contain (i.e. not under NOT) to \param terms.
+		//! The prefixes are added with '*' at the end, and the substrings with '*' at both ends.
+		void	collectTerms( QStringList& terms ) const;
+
+		Type				type;
+		QStringList			words;		// TERM, PREFIX (without '*'), PHRASE; the string for SUBSTRING and REGEX
+		int					distance;	// NEAR
+		QList<QueryNode*>	children;	// AND, OR, NOT, NEAR
+};
+
+
+//! Returns true for the Chinese, Japanese and Korean characters. Such text has no spaces between the words,
+//! so it is indexed and searched as the overlapping pairs of characters.
+bool isCjkCharacter( QChar ch );
+
+//! Appends the overlapping pairs of characters of the CJK \param text to \param words, or the text itself
+//! if it is a single character.
+void appendBigrams( const QString& text, QStringList& words );
+
+
+//! Parses the search query. The query language is:
+//!   word           the documents containing the word
+//!   "some words"   the documents containing the phrase
+//!   a b, a AND b   the documents containing both
+//!   a OR b         the documents containing any of them
+//!   NOT a, -a      the documents which do not contain a
+//!   a NEAR/n b     a and b are not more than n words apart (a and b are words or phrases)
+//!   *text*         the documents containing the text anywhere, even inside a word
+//!   /regex/        the documents which text matches the regular expression
+//!   ( ... )        grouping
+//! The operators must be in upper case; in lower case they are searched as the words. The substrings
+//! and regular expressions are case insensitive. The CJK text is searched as the phrase of its character
+//! pairs, and a single CJK character matches the pairs starting with it.
+class QueryParser
+{
+	public:
+		//! \param charsSplit and \param charsWord are the same characters as used by the indexer
+		QueryParser( const QString& charsSplit, const QString& charsWord );
+
+		//! Parses the \param query, and returns the root node, or 0 if the query is not valid (like missing
+		//! closing quote or bracket). If \param lastTermIsPrefix is true, and the query ends with a word,
+		//! this word matches all the words starting with it.
+		QueryNode * parse( const QString& query, bool lastTermIsPrefix );
+
+	private:
+		struct Token
+		{
+			enum Type { WORD, PHRASE, SUBSTRING, REGEX, LEFT_BRACKET, RIGHT_BRACKET, OP_AND, OP_OR, OP_NOT, OP_NEAR };
+
+			Token( Type type_ ) : type( type_ ), distance( 0 ), prefix( false ) {}
+
+			Type		type;
+			QStringList	words;		// WORD (one), PHRASE, SUBSTRING and REGEX (one)
+			int			distance;	// OP_NEAR
+			bool		prefix;		// WORD
+		};
+
+		bool		tokenize( const QString& query, bool lastTermIsPrefix );
+		int			findTokenEnd( const QString& query, int start, QChar delimiter ) const;
+		void		splitWords( const QString& text, QStringList& words ) const;
+
+		QueryNode *	parseOr();
+		QueryNode *	parseAnd();
+		QueryNode *	parseUnary();
+		QueryNode *	parseNear();
+		QueryNode *	parsePrimary();
+
+		bool		atEnd() const { return m_current >= m_tokens.size(); }
+		bool		peek( Token::Type type ) const { return !atEnd() && m_tokens[m_current].type == type; }
+
+		QString			m_charssplit;
+		QString			m_charsword;
+		QList<Token>	m_tokens;
+		int				m_current;
+};
+
+};
+
+#endif // HELPER_SEARCH_QUERY_H
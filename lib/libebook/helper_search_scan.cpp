@@ -0,0 +1,200 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SCAN_USE_SSE2
+#endif
+
+#include "helper_search_scan.h"
+
+// How many characters of the document text is shown before the match in the snippet
+static const int SCAN_SNIPPET_LEADING_CONTEXT = 60;
+
+namespace QtAs {
+
+int findText( const QChar * text, int length, const QChar * needle, int needlelength, int from )
+{
+	if ( needlelength <= 0 )
+		return -1;
+
+	const ushort * t = (const ushort *) text;
+	const ushort * n = (const ushort *) needle;
+	const size_t needlesize = needlelength * sizeof(ushort);
+
+	// The last position where the needle may start
+	int last = length - needlelength;
+	int i = qMax( from, 0 );
+
+#if defined (SCAN_USE_SSE2)
+	const __m128i firstchar = _mm_set1_epi16( (short) n[0] );
+	const __m128i lastchar = _mm_set1_epi16( (short) n[needlelength - 1] );
+
+	for ( ; i + 8 <= last + 1; i += 8 )
+	{
+		__m128i blockfirst = _mm_loadu_si128( (const __m128i *) (t + i) );
+		__m128i blocklast = _mm_loadu_si128( (const __m128i *) (t + i + needlelength - 1) );
+		__m128i matches = _mm_and_si128( _mm_cmpeq_epi16( firstchar, blockfirst ), _mm_cmpeq_epi16( lastchar, blocklast ) );
+
+		// Two bits for each of the eight characters
+		int mask = _mm_movemask_epi8( matches );
+
+		for ( int lane = 0; mask != 0 && lane < 8; lane++, mask >>= 2 )
+		{
+			if ( (mask & 1) && memcmp( t + i + lane, n, needlesize ) == 0 )
+				return i + lane;
+		}
+	}
+#endif
+
+	for ( ; i <= last; i++ )
+	{
+		if ( t[i] == n[0] && memcmp( t + i, n, needlesize ) == 0 )
+			return i;
+	}
+
+	return -1;
+}
+
+
+// Appends the character to the plain text, collapsing the whitespaces
+static inline void appendCollapsed( QString& text, QChar ch )
+{
+	if ( ch.isSpace() )
+	{
+		if ( text.isEmpty() || text.endsWith( ' ' ) )
+			return;
+
+		ch = ' ';
+	}
+
+	text.append( ch );
+}
+
+
+QString htmlToPlainText( const QString& html, const HelperEntityDecoder& decoder )
+{
+	QString text;
+	text.reserve( html.length() / 2 );
+
+	for ( int i = 0; i < html.length(); i++ )
+	{
+		QChar ch = html[i];
+
+		if ( ch == '<' )
+		{
+			// Skip the tag, including the quoted attribute values which may contain '>'
+			QChar quote;
+
+			for ( i++; i < html.length(); i++ )
+			{
+				if ( !quote.isNull() )
+				{
+					if ( html[i] == quote )
+						quote = QChar();
+				}
+				else if ( html[i] == '"' || html[i] == '\'' )
+					quote = html[i];
+				else if ( html[i] == '>' )
+					break;
+			}
+
+			appendCollapsed( text, ' ' );
+			continue;
+		}
+
+		if ( ch == '&' )
+		{
+			int end = i + 1;
+
+			while ( end < html.length() && (html[end].isLetterOrNumber() || (end == i + 1 && html[end] == '#')) )
+				end++;
+
+			// Not an entity, just the '&' symbol
+			if ( end == i + 1 )
+			{
+				text.append( ch );
+				continue;
+			}
+
+			QString entity = html.mid( i + 1, end - i - 1 );
+
+			if ( entity.toLower() == "nbsp" )
+				appendCollapsed( text, ' ' );
+			else
+			{
+				QString decoded = decoder.decode( entity );
+
+				for ( int k = 0; k < decoded.length(); k++ )
+					appendCollapsed( text, decoded[k] );
+			}
+
+			// Some HTML does not terminate the entities
+			i = (end < html.length() && html[end] == ';') ? end : end - 1;
+			continue;
+		}
+
+		appendCollapsed( text, ch );
+	}
+
+	return text.trimmed();
+}
+
+
+QString scanSnippet( const QString& text, const QString& haystack, const QString& needle, int first, int maxlength )
+{
+	// Start the snippet at the beginning of a word before the match
+	int start = 0;
+
+	if ( first > SCAN_SNIPPET_LEADING_CONTEXT )
+	{
+		start = text.indexOf( ' ', first - SCAN_SNIPPET_LEADING_CONTEXT ) + 1;
+
+		if ( start <= 0 || start > first )
+			start = first - SCAN_SNIPPET_LEADING_CONTEXT;
+	}
+
+	int end = qMin( text.length(), qMax( start + maxlength, first + needle.length() ) );
+	QString snippet;
+
+	if ( start > 0 )
+		snippet = "...";
+
+	for ( int pos = start; pos < end; )
+	{
+		int match = findText( haystack.constData(), end, needle.constData(), needle.length(), pos );
+
+		if ( match == -1 )
+		{
+			snippet += text.mid( pos, end - pos ).toHtmlEscaped();
+			break;
+		}
+
+		snippet += text.mid( pos, match - pos ).toHtmlEscaped() + "<b>" + text.mid( match, needle.length() ).toHtmlEscaped() + "</b>";
+		pos = match + needle.length();
+	}
+
+	if ( end < text.length() )
+		snippet += "...";
+
+	return snippet;
+}
+
+};
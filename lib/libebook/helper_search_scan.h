@@ -0,0 +1,46 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_SEARCH_SCAN_H
+#define HELPER_SEARCH_SCAN_H
+
+#include <QString>
+
+#include "helper_entitydecoder.h"
+
+// The helpers for searching the document text without the index
+namespace QtAs
+{
+
+//! Returns the position of \param needle in \param text at or after \param from, or -1 if not found.
+//! With SSE2, the first and the last characters of the needle are compared with eight positions
+//! at once, and only the positions where both match are compared completely.
+int		findText( const QChar * text, int length, const QChar * needle, int needlelength, int from );
+
+//! Converts the HTML document into the plain text: removes the tags, decodes the entities using
+//! \param decoder and collapses the whitespace.
+QString	htmlToPlainText( const QString& html, const HelperEntityDecoder& decoder );
+
+//! Returns the HTML snippet of \param text around the position \param first, with all the occurrences of
+//! \param needle in it marked in bold. The occurrences are looked up in \param haystack, which is either
+//! the text itself, or its lower case version of the same length.
+QString	scanSnippet( const QString& text, const QString& haystack, const QString& needle, int first, int maxlength );
+
+};
+
+#endif // HELPER_SEARCH_SCAN_H
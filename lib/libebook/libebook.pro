@@ -1,22 +1,30 @@
 HEADERS += 	bitfiddle.h \
     ebook_chm.h \
     ebook_epub.h \
+    ebook_library_search.h \
     ebook.h \
     ebook_chm_encoding.h \
     ebook_search.h \
     helper_entitydecoder.h \
+    helper_search_docset.h \
     helper_search_index.h \
+    helper_search_query.h \
+    helper_search_scan.h \
     helperxmlhandler_epubcontainer.h \
     helperxmlhandler_epubcontent.h \
     helperxmlhandler_epubtoc.h
 SOURCES +=  \
     ebook_chm.cpp \
     ebook_epub.cpp \
+    ebook_library_search.cpp \
     ebook.cpp \
     ebook_chm_encoding.cpp \
     ebook_search.cpp \
     helper_entitydecoder.cpp \
+    helper_search_docset.cpp \
     helper_search_index.cpp \
+    helper_search_query.cpp \
+    helper_search_scan.cpp \
     helperxmlhandler_epubcontainer.cpp \
     helperxmlhandler_epubcontent.cpp \
     helperxmlhandler_epubtoc.cpp
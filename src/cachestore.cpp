@@ -0,0 +1,166 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QRegExp>
+
+#include "cachestore.h"
+
+// How many bytes are read from the beginning and from the end of the ebook for its fingerprint
+static const int FINGERPRINT_SAMPLE_SIZE = 65536;
+
+
+CacheStore::CacheStore( const QString& directory )
+	: m_directory( directory ),
+	  m_sizeLimit( 0 ),
+	  m_catalog( directory + "/cache.ini", QSettings::IniFormat )
+{
+}
+
+
+QString CacheStore::fingerprint( const QString& ebookfile )
+{
+	QCryptographicHash hash( QCryptographicHash::Md5 );
+	QFile file( ebookfile );
+
+	if ( file.open( QIODevice::ReadOnly ) )
+	{
+		qint64 size = file.size();
+		hash.addData( QByteArray::number( size ) );
+
+		// The header of the CHM and EPUB files differs between the ebooks, and the tail often has the
+		// directory of the archive, so together with the size they identify the content well enough
+		hash.addData( file.read( FINGERPRINT_SAMPLE_SIZE ) );
+
+		if ( size > FINGERPRINT_SAMPLE_SIZE && file.seek( qMax( (qint64) FINGERPRINT_SAMPLE_SIZE, size - FINGERPRINT_SAMPLE_SIZE ) ) )
+			hash.addData( file.read( FINGERPRINT_SAMPLE_SIZE ) );
+	}
+	else
+		hash.addData( QFileInfo( ebookfile ).absoluteFilePath().toUtf8() );
+
+	return hash.result().toHex();
+}
+
+
+QString CacheStore::writablePath( const QString& key, const QString& suffix ) const
+{
+	return m_directory + "/" + key + suffix;
+}
+
+
+QString CacheStore::lookup( const QString& key, const QString& suffix )
+{
+	touch( key );
+	return find( key, suffix );
+}
+
+
+QString CacheStore::find( const QString& key, const QString& suffix ) const
+{
+	QString path = writablePath( key, suffix );
+
+	if ( QFile::exists( path ) || m_systemDirectory.isEmpty() )
+		return path;
+
+	QString systempath = m_systemDirectory + "/" + key + suffix;
+
+	if ( QFile::exists( systempath ) )
+		return systempath;
+
+	return path;
+}
+
+
+void CacheStore::touch( const QString& key )
+{
+	m_catalog.setValue( "used/" + key, QDateTime::currentDateTime().toTime_t() );
+}
+
+
+void CacheStore::touchFile( const QString& path )
+{
+	// The files are named by the key followed by the suffix
+	touch( QFileInfo( path ).fileName().section( '.', 0, 0 ) );
+}
+
+
+QString CacheStore::updateEbookKey( const QString& ebookfile, const QString& key )
+{
+	// The path may contain the characters QSettings does not allow in the keys
+	QString pathkey = "ebooks/" + QCryptographicHash::hash( QFileInfo( ebookfile ).absoluteFilePath().toUtf8(), QCryptographicHash::Md5 ).toHex();
+	QString previous = m_catalog.value( pathkey ).toString();
+
+	if ( previous != key )
+		m_catalog.setValue( pathkey, key );
+
+	return previous;
+}
+
+
+void CacheStore::evict( const QString& keep )
+{
+	if ( m_sizeLimit <= 0 )
+		return;
+
+	// The files of each ebook start with its key
+	QMap< QString, QFileInfoList > files;
+	qint64 total = 0;
+
+	Q_FOREACH( const QFileInfo& fi, QDir( m_directory ).entryInfoList( QDir::Files ) )
+	{
+		QString key = fi.fileName().section( '.', 0, 0 );
+
+		// The files of the old versions, named after the ebook file name, are not managed by the store
+		if ( key.length() != 32 || !QRegExp( "[0-9a-f]+" ).exactMatch( key ) )
+			continue;
+
+		files[ key ].push_back( fi );
+		total += fi.size();
+	}
+
+	if ( total <= m_sizeLimit )
+		return;
+
+	// Order the ebooks by the last use time; the files of the ebooks never looked up use their modification time
+	QMultiMap< uint, QString > byUse;
+
+	for ( QMap< QString, QFileInfoList >::ConstIterator it = files.begin(); it != files.end(); ++it )
+	{
+		uint used = m_catalog.value( "used/" + it.key(), it.value().first().lastModified().toTime_t() ).toUInt();
+		byUse.insert( used, it.key() );
+	}
+
+	for ( QMultiMap< uint, QString >::ConstIterator it = byUse.begin(); it != byUse.end() && total > m_sizeLimit; ++it )
+	{
+		if ( it.value() == keep )
+			continue;
+
+		Q_FOREACH( const QFileInfo& fi, files[ it.value() ] )
+		{
+			if ( QFile::remove( fi.absoluteFilePath() ) )
+				total -= fi.size();
+		}
+
+		m_catalog.remove( "used/" + it.value() );
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHESTORE_H
+#define CACHESTORE_H
+
+#include <QString>
+#include <QSettings>
+
+//! Keeps the files generated for the ebooks, like the search index and the settings. The files are named
+//! by the fingerprint of the ebook content, so the ebooks with the same name do not overwrite each other's
+//! files. When the cache grows over its size limit, the files of the least recently used ebooks are removed.
+//! The files could also be looked up in a read-only system directory, where the prebuilt search indexes
+//! are deployed.
+//!
+//! The store does not write the files itself; they should be written with QSaveFile, so the partially
+//! written files are never seen.
+class CacheStore
+{
+	public:
+		CacheStore( const QString& directory );
+
+		//! The limit of the total size of the files in the cache directory, in bytes; 0 means no limit
+		void	setSizeLimit( qint64 bytes ) { m_sizeLimit = bytes; }
+
+		//! The directory where the files are looked up if they are not in the cache directory; may be empty
+		void	setSystemDirectory( const QString& directory ) { m_systemDirectory = directory; }
+
+		//! Returns the fingerprint of the ebook: its size and the hash of its beginning and end. Only a part
+		//! of the file is read, so it is fast even for huge ebooks. If the file cannot be read, the fingerprint
+		//! is made from its path.
+		static QString	fingerprint( const QString& ebookfile );
+
+		//! Returns the path of the file with the \param suffix (like ".idx") for the ebook \param key,
+		//! in the cache directory. This is where the file should be written.
+		QString	writablePath( const QString& key, const QString& suffix ) const;
+
+		//! Returns the path of the existing file with the \param suffix for the ebook \param key, either in
+		//! the cache directory, or in the system directory. If there is none, returns writablePath().
+		//! The ebook is marked as recently used.
+		QString	lookup( const QString& key, const QString& suffix );
+
+		//! Same as lookup(), but does not mark the ebook as used
+		QString	find( const QString& key, const QString& suffix ) const;
+
+		//! Marks the ebook \param key as recently used, so its files are evicted last
+		void	touch( const QString& key );
+
+		//! Marks the ebook of the file \param path, returned by lookup() or find(), as recently used
+		void	touchFile( const QString& path );
+
+		//! Remembers that the ebook file \param ebookfile has the \param key now, and returns the key it had
+		//! before, or an empty string if it is opened first time. If the keys differ, the ebook has changed.
+		QString	updateEbookKey( const QString& ebookfile, const QString& key );
+
+		//! Removes the files of the least recently used ebooks until the cache is within the size limit.
+		//! The files of the ebook \param keep (the opened one) are not removed.
+		void	evict( const QString& keep = QString() );
+
+	private:
+		QString		m_directory;
+		QString		m_systemDirectory;
+		qint64		m_sizeLimit;
+
+		// The time each ebook was last used, and the key of each ebook file
+		QSettings	m_catalog;
+};
+
+#endif // CACHESTORE_H
@@ -21,6 +21,7 @@
 #include <QDir>
 
 #include "kde-qt.h"
+#include "cachestore.h"
 #include "config.h"
 #include "settings.h"
 #include "mainwindow.h"
@@ -54,6 +55,14 @@ Config::Config()
 	m_advCheckNewVersion = settings.value( "advanced/checknewver", true ).toBool();
 	m_toolbarMode = (Config::ToolbarMode) settings.value( "advanced/toolbarmode", TOOLBAR_LARGEICONSTEXT ).toInt();
 	m_lastOpenedDir = settings.value( "advanced/lastopendir", "." ).toString();
+	m_advLibraryPath = settings.value( "advanced/librarypath", "" ).toString();
+	m_advLibraryMemory = settings.value( "advanced/librarymemory", 256 ).toInt();
+	m_advSubstringIndex = settings.value( "advanced/substringindex", false ).toBool();
+	m_advIndexMemory = settings.value( "advanced/indexmemory", 128 ).toInt();
+	m_advCacheSize = settings.value( "advanced/cachesize", 1024 ).toInt();
+	m_advSystemCacheDir = settings.value( "advanced/systemcachedir", "" ).toString();
+	m_advTabHibernateMinutes = settings.value( "advanced/tabhibernate", 30 ).toInt();
+	m_advTabMaxLiveViews = settings.value( "advanced/tabmaxlive", 10 ).toInt();
 
 	m_browserEnableJS = settings.value( "browser/enablejs", true ).toBool();
 	m_browserEnableJava = settings.value( "browser/enablejava", false ).toBool();
@@ -72,6 +81,22 @@ Config::Config()
 
 	if ( !dir.exists() && !dir.mkdir(m_datapath) )
 		qWarning( "Could not create directory %s", qPrintable( m_datapath ));
+
+	m_cacheStore = new CacheStore( m_datapath );
+	applyCacheSettings();
+}
+
+
+Config::~Config()
+{
+	delete m_cacheStore;
+}
+
+
+void Config::applyCacheSettings()
+{
+	m_cacheStore->setSizeLimit( (qint64) m_advCacheSize * 1024 * 1024 );
+	m_cacheStore->setSystemDirectory( m_advSystemCacheDir );
 }
 
 
@@ -91,6 +116,14 @@ void Config::save( )
 	settings.setValue( "advanced/checknewver", m_advCheckNewVersion );
 	settings.setValue( "advanced/toolbarmode", m_toolbarMode );
 	settings.setValue( "advanced/lastopendir", m_lastOpenedDir );
+	settings.setValue( "advanced/librarypath", m_advLibraryPath );
+	settings.setValue( "advanced/librarymemory", m_advLibraryMemory );
+	settings.setValue( "advanced/substringindex", m_advSubstringIndex );
+	settings.setValue( "advanced/indexmemory", m_advIndexMemory );
+	settings.setValue( "advanced/cachesize", m_advCacheSize );
+	settings.setValue( "advanced/systemcachedir", m_advSystemCacheDir );
+	settings.setValue( "advanced/tabhibernate", m_advTabHibernateMinutes );
+	settings.setValue( "advanced/tabmaxlive", m_advTabMaxLiveViews );
 
 	settings.setValue( "browser/enablejs", m_browserEnableJS );
 	settings.setValue( "browser/enablejava", m_browserEnableJava );
@@ -107,16 +140,16 @@ void Config::save( )
 
 QString Config::getEbookSettingFile(const QString &ebookfile ) const
 {
-	QFileInfo finfo ( ebookfile );
-	QString prefix = pConfig->m_datapath + QDir::separator() + finfo.completeBaseName();
-
-	return prefix + ".kchmviewer";
+	return m_cacheStore->writablePath( CacheStore::fingerprint( ebookfile ), ".kchmviewer" );
 }
 
-QString Config::getEbookIndexFile(const QString &ebookfile) const
+QString Config::getLegacyEbookSettingFile(const QString &ebookfile ) const
 {
 	QFileInfo finfo ( ebookfile );
-	QString prefix = pConfig->m_datapath + "/" + finfo.completeBaseName();
+	return m_datapath + QDir::separator() + finfo.completeBaseName() + ".kchmviewer";
+}
 
-	return prefix + ".idx";
+QString Config::getEbookIndexFile(const QString &ebookfile) const
+{
+	return m_cacheStore->find( CacheStore::fingerprint( ebookfile ), ".idx" );
 }
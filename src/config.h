@@ -25,6 +25,7 @@
 
 #include "recentfiles.h"
 
+class CacheStore;
 
 class Config
 {
@@ -52,14 +53,25 @@ class Config
 		};
 
 		Config();
+		~Config();
 		void	save();
 
 		// Returns the setting filename for this ebook
 		QString	getEbookSettingFile( const QString& ebookfile ) const;
 
-		// Returns the index filename for this ebook
+		// Returns the setting filename the older versions used, named after the ebook file
+		QString	getLegacyEbookSettingFile( const QString& ebookfile ) const;
+
+		// Returns the index filename for this ebook; it may be in the read-only system directory. The ebook
+		// is not marked as used in the cache store, so this is used for the ebooks which are not opened.
 		QString	getEbookIndexFile( const QString& ebookfile )  const;
 
+		// The store of the per-ebook files (settings and indexes)
+		CacheStore *	cacheStore() const { return m_cacheStore; }
+
+		// Applies the cache settings below to the store
+		void	applyCacheSettings();
+
 	public:
 		QString				m_lastOpenedDir;
 		
@@ -86,9 +98,18 @@ class Config
 		bool				m_advLayoutDirectionRL;
 		bool				m_advAutodetectEncoding;
 		bool				m_advCheckNewVersion;
+		QString				m_advLibraryPath;		// the directory with the ebooks for the library search
+		int					m_advLibraryMemory;		// how much memory the library search indexes may take, in MB
+		bool				m_advSubstringIndex;	// build the trigram index for the substring search
+		int					m_advIndexMemory;		// how much memory the search index generation may take, in MB
+		int					m_advCacheSize;			// how much disk space the settings and indexes may take, in MB
+		QString				m_advSystemCacheDir;	// the read-only directory with the prebuilt indexes
+		int					m_advTabHibernateMinutes;	// unload the background tabs unused for this time; 0 never
+		int					m_advTabMaxLiveViews;	// how many tabs may keep their pages loaded; 0 no limit
 
 	private:
 		QString				m_datapath;
+		CacheStore		*	m_cacheStore;
 };
 
 extern Config * pConfig;
@@ -29,6 +29,7 @@ DialogSetup::DialogSetup(QWidget *parent)
 	setupUi( this );
 	
 	connect( btnBrowse, SIGNAL( clicked() ), this, SLOT( browseExternalEditor() ) );
+	connect( btnBrowseLibrary, SIGNAL( clicked() ), this, SLOT( browseLibraryPath() ) );
 	
 	// Set up the parameters
 	switch ( pConfig->m_startupMode )
@@ -64,8 +65,17 @@ DialogSetup::DialogSetup(QWidget *parent)
 	
 	m_numOfRecentFiles = pConfig->m_numOfRecentFiles;
 
+	m_advLibraryPath->setText( pConfig->m_advLibraryPath );
+	m_advLibraryMemory->setValue( pConfig->m_advLibraryMemory );
+	m_advCacheSize->setValue( pConfig->m_advCacheSize );
+	m_advSystemCacheDir->setText( pConfig->m_advSystemCacheDir );
+	m_advTabHibernateMinutes->setValue( pConfig->m_advTabHibernateMinutes );
+	m_advTabMaxLiveViews->setValue( pConfig->m_advTabMaxLiveViews );
+
 	boxAutodetectEncoding->setChecked( pConfig->m_advAutodetectEncoding );
 	boxLayoutDirectionRL->setChecked( pConfig->m_advLayoutDirectionRL );
+	boxSubstringIndex->setChecked( pConfig->m_advSubstringIndex );
+	m_advIndexMemory->setValue( pConfig->m_advIndexMemory );
 
 	// Browser settings
 	m_enableImages->setChecked( pConfig->m_browserEnableImages );
@@ -178,6 +188,13 @@ void DialogSetup::accept()
 	pConfig->m_advExternalEditorPath = m_advExternalProgramName->text();
 	pConfig->m_advUseInternalEditor = m_advViewSourceExternal->isChecked();
 	pConfig->m_advUseInternalEditor = m_advViewSourceInternal->isChecked();
+	pConfig->m_advLibraryPath = m_advLibraryPath->text();
+	pConfig->m_advLibraryMemory = m_advLibraryMemory->value();
+	pConfig->m_advCacheSize = m_advCacheSize->value();
+	pConfig->m_advSystemCacheDir = m_advSystemCacheDir->text();
+	pConfig->m_advTabHibernateMinutes = m_advTabHibernateMinutes->value();
+	pConfig->m_advTabMaxLiveViews = m_advTabMaxLiveViews->value();
+	pConfig->applyCacheSettings();
 		
 	if ( pConfig->m_numOfRecentFiles != m_numOfRecentFiles )
 		need_restart = true;
@@ -185,6 +202,8 @@ void DialogSetup::accept()
 	// Autodetect encoding
 	Check_Need_Restart( boxAutodetectEncoding, &pConfig->m_advAutodetectEncoding, &need_restart );
 	pConfig->m_advCheckNewVersion = cbCheckForUpdates->isChecked();
+	pConfig->m_advSubstringIndex = boxSubstringIndex->isChecked();
+	pConfig->m_advIndexMemory = m_advIndexMemory->value();
 
 	// Layout direction management
 	bool layout_rl = boxLayoutDirectionRL->isChecked();
@@ -220,3 +239,18 @@ void DialogSetup::browseExternalEditor()
 	if ( !exec.isEmpty() )
 		m_advExternalProgramName->setText( exec );
 }
+
+
+void DialogSetup::browseLibraryPath()
+{
+#if defined (USE_KDE)
+	QString dir = KFileDialog::getExistingDirectory( KUrl( m_advLibraryPath->text() ), this, i18n("Choose the directory with the ebooks") );
+#else
+	QString dir = QFileDialog::getExistingDirectory( this,
+								i18n("Choose the directory with the ebooks"),
+								m_advLibraryPath->text() );
+#endif
+
+	if ( !dir.isEmpty() )
+		m_advLibraryPath->setText( dir );
+}
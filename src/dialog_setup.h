@@ -33,6 +33,7 @@ class DialogSetup : public QDialog, public Ui::DialogSetup
 		
 	public slots:
 		void	browseExternalEditor();
+		void	browseLibraryPath();
 		void	accept();
 		
 	private:
@@ -0,0 +1,321 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QFile>
+#include <QSaveFile>
+
+#include "cachestore.h"
+#include "config.h"
+#include "mainwindow.h"
+#include "settings.h"
+#include "flattreemodel.h"
+
+static const qint32 CACHE_MAGIC = 0x4B545245;
+static const qint32 CACHE_VERSION = 1;
+
+
+FlatTreeModel::FlatTreeModel( QObject * parent )
+	: QAbstractItemModel( parent )
+{
+	m_indentWarningShown = false;
+}
+
+
+void FlatTreeModel::setIndents( const QVector<int>& indents )
+{
+	int count = indents.size();
+
+	m_parent.clear();
+	m_parent.reserve( count );
+	m_row.clear();
+	m_row.reserve( count );
+	m_depth.clear();
+	m_depth.reserve( count );
+	m_children.clear();
+	m_children.reserve( count );
+	m_topLevel.clear();
+	m_lastAtIndent.clear();
+	m_indentWarningShown = false;
+
+	QVector<qint32> parents = findParents( indents );
+
+	for ( int i = 0; i < count; i++ )
+		addEntry( parents[i] );
+}
+
+
+void FlatTreeModel::appendIndents( const QVector<int>& indents )
+{
+	int first = entryCount();
+	QVector<qint32> parents = findParents( indents );
+
+	// The entries come in the tree order, so the new children of a present entry come together, each followed
+	// by its subtree; then the new children of a present entry above it, and so on up to the top level ones
+	for ( int i = 0; i < parents.size(); )
+	{
+		int parent = parents[i];
+		int end = i + 1, rows = 1;
+
+		for ( ; end < parents.size() && (parents[end] >= first || parents[end] == parent); end++ )
+		{
+			if ( parents[end] == parent )
+				rows++;
+		}
+
+		int row = children( parent ).size();
+
+		beginInsertRows( indexOf( parent ), row, row + rows - 1 );
+
+		for ( ; i < end; i++ )
+			addEntry( parents[i] );
+
+		endInsertRows();
+	}
+}
+
+
+QVector<qint32> FlatTreeModel::findParents( const QVector<int>& indents )
+{
+	QVector<qint32> parents( indents.size() );
+
+	// The last entry at each indent; we use a pretty complex routine to handle buggy CHMs
+	QVector<int>& rootentry = m_lastAtIndent;
+
+	for ( int k = 0; k < indents.size(); k++ )
+	{
+		int i = entryCount() + k;
+		int indent = indents[k];
+
+		// Do we need to add another indent?
+		if ( indent >= rootentry.size() )
+		{
+			int maxindent = rootentry.size() - 1;
+
+			rootentry.resize( indent + 1 );
+
+			if ( indent > 0 && maxindent < 0 )
+				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
+
+			// And init the rest if needed
+			if ( (indent - maxindent) > 1 )
+			{
+				if ( !m_indentWarningShown )
+				{
+					qWarning("Invalid TOC step, applying workaround. Results may vary.");
+					m_indentWarningShown = true;
+				}
+
+				for ( int j = maxindent; j < indent; j++ )
+					rootentry[j+1] = rootentry[j];
+			}
+
+			rootentry[indent] = -1;
+		}
+
+		int parent = indent > 0 ? rootentry[indent-1] : -1;
+
+		if ( indent > 0 && parent == -1 )
+			qFatal("Child entry indented as %d with no root entry!", indent);
+
+		rootentry[indent] = i;
+		parents[k] = parent;
+	}
+
+	return parents;
+}
+
+
+void FlatTreeModel::addEntry( int parent )
+{
+	int entry = entryCount();
+
+	m_parent.push_back( parent );
+	m_depth.push_back( parent == -1 ? 0 : m_depth[parent] + 1 );
+	m_children.push_back( QVector<qint32>() );
+
+	// The children of each entry are stored in the tree order
+	QVector<qint32>& siblings = parent == -1 ? m_topLevel : m_children[parent];
+
+	m_row.push_back( siblings.size() );
+	siblings.push_back( entry );
+}
+
+
+int FlatTreeModel::subtreeEnd( int entry ) const
+{
+	int end = entry + 1;
+
+	// The subtree entries follow the entry, and are deeper than it
+	while ( end < entryCount() && m_depth[end] > m_depth[entry] )
+		end++;
+
+	return end;
+}
+
+
+int FlatTreeModel::entry( const QModelIndex& index ) const
+{
+	return index.isValid() ? (int) index.internalId() : -1;
+}
+
+
+QModelIndex FlatTreeModel::indexOf( int entry ) const
+{
+	if ( entry < 0 || entry >= entryCount() )
+		return QModelIndex();
+
+	return createIndex( m_row[entry], 0, entry );
+}
+
+
+QModelIndex FlatTreeModel::index( int row, int column, const QModelIndex& parent ) const
+{
+	const QVector<qint32>& siblings = children( entry( parent ) );
+
+	if ( column != 0 || row < 0 || row >= siblings.size() )
+		return QModelIndex();
+
+	return createIndex( row, 0, siblings[row] );
+}
+
+
+QModelIndex FlatTreeModel::parent( const QModelIndex& index ) const
+{
+	int e = entry( index );
+
+	if ( e == -1 )
+		return QModelIndex();
+
+	return indexOf( m_parent[e] );
+}
+
+
+int FlatTreeModel::rowCount( const QModelIndex& parent ) const
+{
+	if ( parent.column() > 0 )
+		return 0;
+
+	return children( entry( parent ) ).size();
+}
+
+
+int FlatTreeModel::columnCount( const QModelIndex& ) const
+{
+	return 1;
+}
+
+
+QString FlatTreeModel::cacheFile( const QString& suffix, QString& key )
+{
+	// Shared with the settings and the search index of the ebook
+	QString cachekey = ::mainWindow->currentSettings()->cacheKey();
+
+	if ( cachekey.isEmpty() )
+		return QString();
+
+	// The entry names are decoded with the ebook encoding, so the cache is valid only for it
+	key = cachekey + "/" + ::mainWindow->chmFile()->currentEncoding();
+
+	return pConfig->cacheStore()->writablePath( cachekey, suffix );
+}
+
+
+bool FlatTreeModel::loadCache( const QString& suffix )
+{
+	QString key;
+	QFile file( cacheFile( suffix, key ) );
+
+	if ( file.fileName().isEmpty() || !file.open( QIODevice::ReadOnly ) )
+		return false; // it's ok, the ebook is opened first time
+
+	QDataStream stream( &file );
+	qint32 magic, version, count;
+	QString filekey;
+
+	stream >> magic >> version;
+
+	if ( magic != CACHE_MAGIC || version != CACHE_VERSION )
+		return false;
+
+	stream >> filekey >> count;
+
+	if ( filekey != key || count < 0 || stream.status() != QDataStream::Ok )
+		return false;
+
+	QVector<int> depths;
+	stream >> depths;
+
+	if ( depths.size() != count || stream.status() != QDataStream::Ok )
+		return false;
+
+	// The depths are fixed already, so the tree is built without the workarounds
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( depths[i] < 0 || depths[i] > (i > 0 ? depths[i - 1] + 1 : 0) )
+			return false;
+	}
+
+	beginResetModel();
+	setIndents( depths );
+	bool valid = readEntries( stream, count ) && stream.status() == QDataStream::Ok;
+
+	// The view should not see the inconsistent entries
+	if ( !valid )
+		setIndents( QVector<int>() );
+
+	endResetModel();
+
+	if ( !valid )
+	{
+		qWarning( "Cache file %s is corrupted, ignoring", qPrintable( file.fileName() ) );
+		clear();
+	}
+
+	return valid;
+}
+
+
+void FlatTreeModel::saveCache( const QString& suffix ) const
+{
+	QString key;
+	QString filename = cacheFile( suffix, key );
+
+	// The ebook could not be read for its key
+	if ( filename.isEmpty() )
+		return;
+
+	// Written to a temporary file first, so the cache is never partially written
+	QSaveFile file( filename );
+
+	if ( !file.open( QIODevice::WriteOnly ) )
+	{
+		qWarning( "Could not write cache file %s: %s", qPrintable( file.fileName() ), qPrintable( file.errorString() ) );
+		return;
+	}
+
+	QDataStream stream( &file );
+
+	stream << CACHE_MAGIC << CACHE_VERSION << key << (qint32) entryCount();
+	stream << m_depth;
+
+	writeEntries( stream );
+
+	if ( stream.status() != QDataStream::Ok || !file.commit() )
+		qWarning( "Could not write cache file %s", qPrintable( file.fileName() ) );
+}
@@ -0,0 +1,107 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FLATTREEMODEL_H
+#define FLATTREEMODEL_H
+
+#include <QAbstractItemModel>
+#include <QDataStream>
+#include <QVector>
+
+//! The tree of the entries kept in flat arrays in the tree pre-order, which is the order the ebook lists the
+//! table of contents and the keyword index in. The view only asks for the visible rows, so the fill time does
+//! not depend on the number of entries. The entries are identified by their number in this order.
+//!
+//! The subclasses keep the entry data, and provide data(). The arrays could be saved into the cache store,
+//! so the entries of the ebook opened again are read from there instead of being parsed.
+class FlatTreeModel : public QAbstractItemModel
+{
+	Q_OBJECT
+
+	public:
+		FlatTreeModel( QObject * parent );
+
+		//! Removes all the entries
+		virtual void	clear() = 0;
+
+		//! Loads the entries of the opened ebook from its cache file with the \param suffix. Returns false
+		//! if there is no such file, or it was made for another ebook content or encoding.
+		bool		loadCache( const QString& suffix );
+
+		//! Saves the entries into the cache file with the \param suffix for the opened ebook
+		void		saveCache( const QString& suffix ) const;
+
+		int			entryCount() const { return m_parent.size(); }
+		int			parentEntry( int entry ) const { return m_parent[entry]; }
+		int			childCount( int entry ) const { return m_children[entry].size(); }
+
+		//! Returns the entry after the last one in the subtree of \param entry
+		int			subtreeEnd( int entry ) const;
+
+		//! Conversion between the entries and the model indexes
+		int			entry( const QModelIndex& index ) const;
+		QModelIndex	indexOf( int entry ) const;
+
+		// Overridden methods
+		QModelIndex	index( int row, int column, const QModelIndex& parent = QModelIndex() ) const;
+		QModelIndex	parent( const QModelIndex& index ) const;
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		int			columnCount( const QModelIndex& parent = QModelIndex() ) const;
+
+	protected:
+		//! Builds the tree from the indents of the entries. The buggy ebooks skip the indent levels; such entries
+		//! are attached to the last entry above them. Should be called between beginResetModel() and endResetModel().
+		void		setIndents( const QVector<int>& indents );
+
+		//! Appends the entries with the \param indents after the present ones, as if setIndents() got them all,
+		//! and tells the views about the new rows. The subclass data of the new entries should be added before.
+		void		appendIndents( const QVector<int>& indents );
+
+		//! Writes and reads the subclass entry data in the cache file; readEntries() should check the data
+		//! is consistent with \param count entries, and return false if it is not.
+		virtual void	writeEntries( QDataStream& stream ) const = 0;
+		virtual bool	readEntries( QDataStream& stream, int count ) = 0;
+
+	private:
+		// Returns the cache file with the suffix for the opened ebook, and the key it must be made for
+		static QString	cacheFile( const QString& suffix, QString& key );
+
+		// Returns the parents of the entries with the indents, which follow the present ones
+		QVector<qint32>	findParents( const QVector<int>& indents );
+
+		// Adds the entry after the present ones
+		void		addEntry( int parent );
+
+		// The children of the entry, or of the root for -1
+		const QVector<qint32>&	children( int parent ) const { return parent == -1 ? m_topLevel : m_children[parent]; }
+
+		// Per entry, in the tree order
+		QVector<qint32>		m_parent;		// -1 for the top level entries
+		QVector<qint32>		m_row;			// among the children of the parent
+		QVector<qint32>		m_depth;		// the fixed indent
+		QVector< QVector<qint32> >	m_children;
+
+		QVector<qint32>		m_topLevel;
+
+		// The last entry at each indent so far, so the entries could be appended
+		QVector<int>		m_lastAtIndent;
+		bool				m_indentWarningShown;
+};
+
+#endif // FLATTREEMODEL_H
@@ -0,0 +1,511 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QBrush>
+#include <QHash>
+#include <QStringList>
+
+#include "indexmodel.h"
+
+
+// Orders the positions of the top level entries by their collation keys
+class SortKeyLessThan
+{
+	public:
+		SortKeyLessThan( const QList<QCollatorSortKey>& keys ) : m_keys( keys ) {}
+
+		bool operator()( int a, int b ) const
+		{
+			return m_keys[a].compare( m_keys[b] ) < 0;
+		}
+
+	private:
+		const QList<QCollatorSortKey>& m_keys;
+};
+
+
+// Orders the positions of the top level entries by their case folded names
+class FoldedLessThan
+{
+	public:
+		FoldedLessThan( const QStringList& names ) : m_names( names ) {}
+
+		bool operator()( int a, int b ) const
+		{
+			return m_names[a] < m_names[b];
+		}
+
+	private:
+		const QStringList& m_names;
+};
+
+
+// Builds the tree to find the smallest of values[low..high) in O(log n): the values are its leaves,
+// and each inner node keeps the smallest of its two children
+static QVector<qint32> buildRangeMinimum( const QVector<qint32>& values )
+{
+	int count = values.size();
+	QVector<qint32> tree( 2 * count );
+
+	for ( int i = 0; i < count; i++ )
+		tree[count + i] = values[i];
+
+	for ( int i = count - 1; i > 0; i-- )
+		tree[i] = qMin( tree[2 * i], tree[2 * i + 1] );
+
+	return tree;
+}
+
+
+// Returns the smallest of the values[low..high) the tree is built from, or -1 if the range is empty
+static qint32 rangeMinimum( const QVector<qint32>& tree, int low, int high )
+{
+	int count = tree.size() / 2;
+	qint32 result = -1;
+
+	for ( low += count, high += count; low < high; low /= 2, high /= 2 )
+	{
+		if ( low & 1 )
+		{
+			if ( result == -1 || tree[low] < result )
+				result = tree[low];
+
+			low++;
+		}
+
+		if ( high & 1 )
+		{
+			high--;
+
+			if ( result == -1 || tree[high] < result )
+				result = tree[high];
+		}
+	}
+
+	return result;
+}
+
+
+void IndexLookup::add( const QVector<qint32>& entries, const QStringList& names, const QCollator& collator )
+{
+	// Compute the collation keys of the new entries once, and sort them. The stable sort keeps the index
+	// order of the entries with the same name.
+	QList<QCollatorSortKey> keys;
+	QStringList foldednames;
+	QVector<int> order( entries.size() ), foldedorder( entries.size() );
+
+	for ( int i = 0; i < entries.size(); i++ )
+	{
+		keys.push_back( collator.sortKey( names[i] ) );
+		foldednames.push_back( names[i].toCaseFolded() );
+		order[i] = i;
+		foldedorder[i] = i;
+	}
+
+	qStableSort( order.begin(), order.end(), SortKeyLessThan( keys ) );
+	qStableSort( foldedorder.begin(), foldedorder.end(), FoldedLessThan( foldednames ) );
+
+	// Merge them with the present ones, which come first for the same name as they are above in the index
+	int count = sorted.size() + entries.size();
+	QVector<qint32> newsorted, newfolded;
+	QList<QCollatorSortKey> newkeys;
+	QStringList newnames;
+
+	newsorted.reserve( count );
+	newkeys.reserve( count );
+	newfolded.reserve( count );
+	newnames.reserve( count );
+
+	for ( int i = 0, j = 0; i < sorted.size() || j < order.size(); )
+	{
+		if ( j == order.size() || (i < sorted.size() && keys[ order[j] ].compare( sortKeys[i] ) >= 0) )
+		{
+			newsorted.push_back( sorted[i] );
+			newkeys.push_back( sortKeys[i] );
+			i++;
+		}
+		else
+		{
+			newsorted.push_back( entries[ order[j] ] );
+			newkeys.push_back( keys[ order[j] ] );
+			j++;
+		}
+	}
+
+	for ( int i = 0, j = 0; i < folded.size() || j < foldedorder.size(); )
+	{
+		if ( j == foldedorder.size() || (i < folded.size() && !(foldednames[ foldedorder[j] ] < foldedNames[i])) )
+		{
+			newfolded.push_back( folded[i] );
+			newnames.push_back( foldedNames[i] );
+			i++;
+		}
+		else
+		{
+			newfolded.push_back( entries[ foldedorder[j] ] );
+			newnames.push_back( foldednames[ foldedorder[j] ] );
+			j++;
+		}
+	}
+
+	sorted = newsorted;
+	sortKeys = newkeys;
+	folded = newfolded;
+	foldedNames = newnames;
+	sortedMinimum = buildRangeMinimum( sorted );
+	foldedMinimum = buildRangeMinimum( folded );
+}
+
+
+void IndexLookup::clear()
+{
+	sorted.clear();
+	sortKeys.clear();
+	folded.clear();
+	foldedNames.clear();
+	sortedMinimum.clear();
+	foldedMinimum.clear();
+}
+
+
+IndexModelBuilder::IndexModelBuilder()
+{
+	m_collator.setCaseSensitivity( Qt::CaseInsensitive );
+	m_count = 0;
+}
+
+
+IndexModelBlock IndexModelBuilder::build( const QList< EBookIndexEntry >& entries )
+{
+	IndexModelBlock block;
+	int count = entries.size();
+	QVector<qint32> toplevel;
+	QStringList names;
+
+	block.indents.reserve( count );
+	block.nameOffset.reserve( count + 1 );
+	block.urlOffset.reserve( count + 1 );
+	block.seeAlsoOffset.reserve( count + 1 );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		const EBookIndexEntry& e = entries[i];
+
+		block.indents.push_back( e.indent );
+
+		block.nameOffset.push_back( block.names.size() );
+		block.names += e.name;
+
+		block.seeAlsoOffset.push_back( block.seeAlso.size() );
+		block.seeAlso += e.seealso;
+
+		block.urlOffset.push_back( block.urlIds.size() );
+
+		// Many entries point to the same page
+		for ( int j = 0; j < e.urls.size(); j++ )
+		{
+			QHash<QUrl, int>::const_iterator it = m_urlIds.constFind( e.urls[j] );
+
+			if ( it == m_urlIds.constEnd() )
+			{
+				it = m_urlIds.insert( e.urls[j], m_urlIds.size() );
+				block.newUrls.push_back( e.urls[j] );
+			}
+
+			block.urlIds.push_back( it.value() );
+		}
+
+		// Only the top level entries are looked up
+		if ( e.indent == 0 )
+		{
+			toplevel.push_back( m_count + i );
+			names.push_back( e.name );
+		}
+	}
+
+	block.nameOffset.push_back( block.names.size() );
+	block.urlOffset.push_back( block.urlIds.size() );
+	block.seeAlsoOffset.push_back( block.seeAlso.size() );
+
+	m_count += count;
+	m_lookup.add( toplevel, names, m_collator );
+	block.lookup = m_lookup;
+
+	return block;
+}
+
+
+IndexModel::IndexModel( QObject * parent )
+	: FlatTreeModel( parent )
+{
+	m_nameOffset.fill( 0, 1 );
+	m_urlOffset.fill( 0, 1 );
+	m_seeAlsoOffset.fill( 0, 1 );
+
+	m_collator.setCaseSensitivity( Qt::CaseInsensitive );
+}
+
+
+void IndexModel::clear()
+{
+	beginResetModel();
+
+	m_nameOffset.fill( 0, 1 );
+	m_urlOffset.fill( 0, 1 );
+	m_seeAlsoOffset.fill( 0, 1 );
+	m_names.clear();
+	m_seeAlso.clear();
+	m_urlIds.clear();
+	m_urls.clear();
+	m_lookup.clear();
+
+	setIndents( QVector<int>() );
+
+	endResetModel();
+}
+
+
+void IndexModel::appendEntries( const IndexModelBlock& block )
+{
+	int count = block.indents.size();
+
+	// The block offsets start from zero, where the present data ends
+	int names = m_names.size(), urlids = m_urlIds.size(), seealso = m_seeAlso.size();
+
+	for ( int i = 1; i <= count; i++ )
+	{
+		m_nameOffset.push_back( names + block.nameOffset[i] );
+		m_urlOffset.push_back( urlids + block.urlOffset[i] );
+		m_seeAlsoOffset.push_back( seealso + block.seeAlsoOffset[i] );
+	}
+
+	m_names += block.names;
+	m_seeAlso += block.seeAlso;
+	m_urlIds += block.urlIds;
+	m_urls += block.newUrls;
+
+	appendIndents( block.indents );
+
+	m_lookup = block.lookup;
+}
+
+
+void IndexModel::writeEntries( QDataStream& stream ) const
+{
+	stream << m_nameOffset << m_urlOffset << m_seeAlsoOffset << m_names << m_seeAlso << m_urlIds << m_urls;
+}
+
+
+bool IndexModel::readEntries( QDataStream& stream, int count )
+{
+	stream >> m_nameOffset >> m_urlOffset >> m_seeAlsoOffset >> m_names >> m_seeAlso >> m_urlIds >> m_urls;
+
+	if ( m_nameOffset.size() != count + 1 || m_urlOffset.size() != count + 1 || m_seeAlsoOffset.size() != count + 1
+	|| m_nameOffset[count] != m_names.size() || m_urlOffset[count] != m_urlIds.size() || m_seeAlsoOffset[count] != m_seeAlso.size() )
+		return false;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( m_nameOffset[i] < 0 || m_nameOffset[i] > m_nameOffset[i + 1]
+		|| m_urlOffset[i] < 0 || m_urlOffset[i] > m_urlOffset[i + 1]
+		|| m_seeAlsoOffset[i] < 0 || m_seeAlsoOffset[i] > m_seeAlsoOffset[i + 1] )
+			return false;
+	}
+
+	for ( int i = 0; i < m_urlIds.size(); i++ )
+	{
+		if ( m_urlIds[i] < 0 || m_urlIds[i] >= m_urls.size() )
+			return false;
+	}
+
+	// The collation keys depend on the locale, so they are not cached
+	QVector<qint32> toplevel;
+	QStringList names;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( parentEntry( i ) == -1 )
+		{
+			toplevel.push_back( i );
+			names.push_back( entryName( i ) );
+		}
+	}
+
+	m_lookup.clear();
+	m_lookup.add( toplevel, names, m_collator );
+	return true;
+}
+
+
+QString IndexModel::entryName( int entry ) const
+{
+	return m_names.mid( m_nameOffset[entry], m_nameOffset[entry + 1] - m_nameOffset[entry] );
+}
+
+
+QList<QUrl> IndexModel::entryUrls( int entry ) const
+{
+	QList<QUrl> urls;
+
+	for ( int i = m_urlOffset[entry]; i < m_urlOffset[entry + 1]; i++ )
+		urls.push_back( m_urls[ m_urlIds[i] ] );
+
+	return urls;
+}
+
+
+QString IndexModel::seeAlso( int entry ) const
+{
+	return m_seeAlso.mid( m_seeAlsoOffset[entry], m_seeAlsoOffset[entry + 1] - m_seeAlsoOffset[entry] );
+}
+
+
+int IndexModel::lowerBound( const QCollatorSortKey& key ) const
+{
+	int low = 0, high = m_lookup.sortKeys.size();
+
+	while ( low < high )
+	{
+		int middle = (low + high) / 2;
+
+		if ( m_lookup.sortKeys[middle].compare( key ) < 0 )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+
+int IndexModel::upperBound( const QCollatorSortKey& key ) const
+{
+	int low = 0, high = m_lookup.sortKeys.size();
+
+	while ( low < high )
+	{
+		int middle = (low + high) / 2;
+
+		if ( m_lookup.sortKeys[middle].compare( key ) <= 0 )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+
+int IndexModel::findPrefix( const QString& text ) const
+{
+	if ( m_lookup.sorted.isEmpty() )
+		return -1;
+
+	// The names starting with the text ignoring the case are next to each other in the folded order:
+	// after the smaller names, and before the larger ones which do not start with it
+	const QStringList& names = m_lookup.foldedNames;
+	QString folded = text.toCaseFolded();
+	int low = 0, high = names.size();
+
+	while ( low < high )
+	{
+		int middle = (low + high) / 2;
+
+		if ( names[middle] < folded )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	int first = low;
+	high = names.size();
+
+	while ( low < high )
+	{
+		int middle = (low + high) / 2;
+
+		if ( names[middle].startsWith( folded ) )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	// The topmost one shown is chosen
+	if ( first < low )
+		return rangeMinimum( m_lookup.foldedMinimum, first, low );
+
+	// None; the collation also ignores the punctuation, so look for the names which start
+	// the same for it
+	low = lowerBound( m_collator.sortKey( text ) );
+	first = low;
+	high = m_lookup.sorted.size();
+
+	while ( low < high )
+	{
+		int middle = (low + high) / 2;
+
+		if ( m_collator.compare( entryName( m_lookup.sorted[middle] ).left( text.length() ), text ) == 0 )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return rangeMinimum( m_lookup.sortedMinimum, first, low );
+}
+
+
+int IndexModel::findExact( const QString& name ) const
+{
+	if ( m_lookup.sorted.isEmpty() )
+		return -1;
+
+	// The same names are shown in the order of the index, so the topmost one is chosen
+	QCollatorSortKey key = m_collator.sortKey( name );
+
+	return rangeMinimum( m_lookup.sortedMinimum, lowerBound( key ), upperBound( key ) );
+}
+
+
+QVariant IndexModel::data( const QModelIndex& index, int role ) const
+{
+	int e = entry( index );
+
+	if ( e == -1 )
+		return QVariant();
+
+	switch( role )
+	{
+		// Item name
+		case Qt::DisplayRole:
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			return entryName( e );
+
+		// Item foreground color
+		case Qt::ForegroundRole:
+			// The entry with several URLs shows the list to choose from
+			if ( m_urlOffset[e + 1] - m_urlOffset[e] > 1 )
+				return QBrush( QColor( Qt::red ) );
+			else if ( isSeeAlso( e ) )
+				return QBrush( QColor( Qt::lightGray ) );
+			break;
+	}
+
+	return QVariant();
+}
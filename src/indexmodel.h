@@ -0,0 +1,149 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INDEXMODEL_H
+#define INDEXMODEL_H
+
+#include <QCollator>
+#include <QHash>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+#include "ebook.h"
+#include "flattreemodel.h"
+
+//! The top level entries of the keyword index sorted for the lookups, which IndexModel does in O(log n).
+//! The entries could be added in blocks, so the index being loaded is looked up; the arrays are implicitly
+//! shared, so the copies passed to the GUI thread are cheap.
+class IndexLookup
+{
+	public:
+		//! Adds the top level \param entries named \param names, which follow the ones added before in the
+		//! index order. The collation keys are computed with \param collator.
+		void	add( const QVector<qint32>& entries, const QStringList& names, const QCollator& collator );
+		void	clear();
+
+		// The entries sorted by name, and their collation keys in the same order. The entries with the
+		// same name are kept in the index order, so the first of them is found.
+		QVector<qint32>			sorted;
+		QList<QCollatorSortKey>	sortKeys;
+
+		// The entries sorted by the case folded name, and these names in the same order
+		QVector<qint32>			folded;
+		QStringList				foldedNames;
+
+		// The trees to find the topmost entry in a range of sorted or folded in O(log n)
+		QVector<qint32>			sortedMinimum;
+		QVector<qint32>			foldedMinimum;
+};
+
+
+//! The keyword index entries prepared by IndexModelBuilder for IndexModel::appendEntries(), in the layout
+//! of the model arrays. The offsets are relative to the block, and have one more element than the entries.
+class IndexModelBlock
+{
+	public:
+		QVector<int>		indents;
+		QVector<qint32>		nameOffset;		// in names
+		QVector<qint32>		urlOffset;		// in urlIds
+		QVector<qint32>		seeAlsoOffset;	// in seeAlso
+
+		QString				names;
+		QString				seeAlso;
+		QVector<qint32>		urlIds;			// in the model URLs, with newUrls appended
+		QVector<QUrl>		newUrls;		// the URLs the previous blocks do not have
+
+		IndexLookup			lookup;			// of all the entries up to this block
+};
+
+
+//! Converts the keyword index entries into the blocks for IndexModel in the index order. It could be used
+//! in another thread than the model, so the collation keys are not computed in the GUI thread.
+class IndexModelBuilder
+{
+	public:
+		IndexModelBuilder();
+
+		//! Returns the block with the \param entries, which follow the ones built before
+		IndexModelBlock	build( const QList< EBookIndexEntry >& entries );
+
+	private:
+		QCollator			m_collator;
+		QHash<QUrl, int>	m_urlIds;
+		IndexLookup			m_lookup;
+		int					m_count;	// the entries built so far
+};
+
+
+//! The keyword index shown in the index tab. The entries are kept in flat arrays in the index order. The top
+//! level entries are also kept sorted by their collation keys, which are computed once when the entries are
+//! added, so looking up the typed text or the 'see also' entry is a binary search.
+class IndexModel : public FlatTreeModel
+{
+	Q_OBJECT
+
+	public:
+		IndexModel( QObject * parent );
+
+		//! Appends the entries of the \param block after the present ones, and tells the views about the new rows
+		void		appendEntries( const IndexModelBlock& block );
+		void		clear();
+
+		QString		entryName( int entry ) const;
+		QList<QUrl>	entryUrls( int entry ) const;
+		QString		seeAlso( int entry ) const;
+		bool		isSeeAlso( int entry ) const { return m_seeAlsoOffset[entry + 1] > m_seeAlsoOffset[entry]; }
+
+		//! Returns the topmost top level entry starting with \param text, ignoring the case. If there is none,
+		//! returns the one which starts with it for the collation (which also ignores the punctuation), or -1.
+		int			findPrefix( const QString& text ) const;
+
+		//! Returns the topmost top level entry named \param name, ignoring the case, or -1
+		int			findExact( const QString& name ) const;
+
+		// Overridden methods
+		QVariant	data( const QModelIndex& index, int role ) const;
+
+	protected:
+		void		writeEntries( QDataStream& stream ) const;
+		bool		readEntries( QDataStream& stream, int count );
+
+	private:
+		// Returns the position of the first entry in the sorted lookup which is not less than the key
+		int			lowerBound( const QCollatorSortKey& key ) const;
+
+		// Returns the position of the first entry in the sorted lookup which is greater than the key
+		int			upperBound( const QCollatorSortKey& key ) const;
+
+		// Per entry, in the index order; the offsets have one more element than the entries
+		QVector<qint32>		m_nameOffset;		// in m_names
+		QVector<qint32>		m_urlOffset;		// in m_urlIds
+		QVector<qint32>		m_seeAlsoOffset;	// in m_seeAlso
+
+		QString				m_names;			// all the names one after another
+		QString				m_seeAlso;			// all the 'see also' values one after another
+		QVector<qint32>		m_urlIds;			// in m_urls
+		QVector<QUrl>		m_urls;				// the different URLs
+
+		QCollator			m_collator;			// case insensitive, as the lookup is
+		IndexLookup			m_lookup;
+};
+
+#endif // INDEXMODEL_H
@@ -277,6 +277,9 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 		pConfig->m_lastOpenedDir = qf.dir().path();
 		m_ebookFileBasename = qf.fileName();
 
+		// The settings are read first, as the navigation tabs cache their data under the settings key
+		bool settingsloaded = m_currentSettings->loadSettings( fileName );
+
 		// Apply settings to the navigation dock
 		m_navPanel->updateTabs( m_ebookFile );
 
@@ -290,7 +293,7 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 		m_viewWindowMgr->invalidate();
 		refreshCurrentBrowser();
 
-		if ( m_currentSettings->loadSettings (fileName) )
+		if ( settingsloaded )
 		{
 			if ( m_ebookFile->hasFeature( EBook::FEATURE_ENCODING ) )
 				setTextEncoding(m_currentSettings->m_activeEncoding );
@@ -551,6 +554,7 @@ void MainWindow::printHelpAndExit()
             "  -token <token>    specifies the application token; see the integration reference\n"
             "  -background       start minimized\n"
             "  -novcheck         disable check for new version even if enabled in configuration\n"
+            "  --benchmarksearch measure the search query and contents filter speed, print it and exit\n"
              , qPrintable( m_arguments[0] ) );
 
     exit (1);
@@ -559,7 +563,7 @@ void MainWindow::printHelpAndExit()
 bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_app )
 {
     QString filename, search_query, search_index, open_url, search_toc;
-    bool do_autotest = false, disable_vcheck = false, force_background = false;
+    bool do_autotest = false, disable_vcheck = false, force_background = false, do_benchmark = false;
 
 	// argv[0] in Qt is still a program name
     for ( int i = 1; i < args.size(); i++  )
@@ -580,6 +584,8 @@ bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_ap
             force_background = true;
         else if ( args[i] == "-novcheck" )
             disable_vcheck = true;
+        else if ( args[i] == "--benchmarksearch" )
+            do_benchmark = true;
         else if ( args[i] == "-v" || args[i] == "--version" )
         {
             printf("kchmviewer version %d.%d built at %s %s\n", APP_VERSION_MAJOR, APP_VERSION_MINOR, __DATE__, __TIME__ );
@@ -651,6 +657,8 @@ bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_ap
 			event_args.push_back( search_toc );
 			qApp->postEvent( this, new UserEvent( "findInToc", event_args ) );
 		}
+		else if ( do_benchmark )
+			qApp->postEvent( this, new UserEvent( "benchmarkSearch" ) );
 		
 		if ( do_autotest )
 		{
@@ -782,6 +790,14 @@ bool MainWindow::handleUserEvent( const UserEvent * event )
 		m_navPanel->executeQueryInSearch( event->m_args[0] );
 		return true;
 	}
+	else if ( event->m_action == "benchmarkSearch" )
+	{
+		if ( !m_navPanel->benchmarkSearch() )
+			fprintf( stderr, "Search benchmark: the search index is not available\n" );
+
+		qApp->quit();
+		return true;
+	}
 	else
 		qWarning( "Unknown user event received: %s", qPrintable( event->m_action ) );
 	
@@ -913,69 +929,77 @@ void MainWindow::actionExtractCHM()
 	                                files.size(), 
 	                                this );
 	
-	for ( int i = 0; i < files.size(); i++ )
+	// The files are retrieved in batches, so the ebook could decompress them concurrently
+	const int batchsize = 32;
+
+	for ( int batchstart = 0; batchstart < files.size(); batchstart += batchsize )
 	{
-		progress.setValue( i );
-		
-		if ( (i % 3) == 0 )
-		{
-			qApp->processEvents();
+		QList< QUrl > batch = files.mid( batchstart, batchsize );
+		QVector< QByteArray > contents;
 
-			if ( progress.wasCancelled() )
-				break;
-		}
+		progress.setValue( batchstart );
+		qApp->processEvents();
 
-		// Extract the file
-		QByteArray buf;
-		
-		if ( m_ebookFile->getFileContentAsBinary( buf, files[i] ) )
+		if ( progress.wasCancelled() )
+			break;
+
+		m_ebookFile->getFileContentAsBinaryBatch( contents, batch );
+
+		for ( int b = 0; b < batch.size(); b++ )
 		{
-			// Split filename to get the list of subdirectories
-			QStringList dirs = files[i].path().split( '/' );
-
-			// Walk through the list of subdirectories, and create them if needed
-			// dirlevel is used to detect extra .. and prevent overwriting files
-			// outside the directory (like creating the file images/../../../../../etc/passwd
-			int i, dirlevel = 0;
-			QStringList dirlist;
-				
-			for ( i = 0; i < dirs.size() - 1; i++ )
+			// Extract the file
+			const QByteArray& buf = contents[b];
+
+			// The null content means it could not be retrieved; the empty files are extracted too
+			if ( !buf.isNull() )
 			{
-				// Skip .. which lead too far above
-				if ( dirs[i] == ".." )
+				// Split filename to get the list of subdirectories
+				QStringList dirs = batch[b].path().split( '/' );
+
+				// Walk through the list of subdirectories, and create them if needed
+				// dirlevel is used to detect extra .. and prevent overwriting files
+				// outside the directory (like creating the file images/../../../../../etc/passwd
+				int i, dirlevel = 0;
+				QStringList dirlist;
+				
+				for ( i = 0; i < dirs.size() - 1; i++ )
 				{
-					if ( dirlevel > 0 )
+					// Skip .. which lead too far above
+					if ( dirs[i] == ".." )
 					{
-						dirlevel--;
-						dirlist.pop_back();
+						if ( dirlevel > 0 )
+						{
+							dirlevel--;
+							dirlist.pop_back();
+						}
 					}
-				}
-				else
-				{
-					dirlist.push_back( dirs[i] );
-					
-					QDir dir ( outdir + dirlist.join( "/" ) );
-					if ( !dir.exists() )
+					else
 					{
-						if ( !dir.mkdir( dir.path() ) )
-							qWarning( "Could not create subdir %s\n", qPrintable( dir.path() ) );
+						dirlist.push_back( dirs[i] );
+					
+						QDir dir ( outdir + dirlist.join( "/" ) );
+						if ( !dir.exists() )
+						{
+							if ( !dir.mkdir( dir.path() ) )
+								qWarning( "Could not create subdir %s\n", qPrintable( dir.path() ) );
+						}
 					}
 				}
-			}
 			
-			QString filename = outdir + dirlist.join( "/" ) + "/" + dirs[i];
-			QFile wf( filename );
-			if ( !wf.open( QIODevice::WriteOnly ) )
-			{
-				qWarning( "Could not write file %s\n", qPrintable( filename ) );
-				continue;
-			}
+				QString filename = outdir + dirlist.join( "/" ) + "/" + dirs[i];
+				QFile wf( filename );
+				if ( !wf.open( QIODevice::WriteOnly ) )
+				{
+					qWarning( "Could not write file %s\n", qPrintable( filename ) );
+					continue;
+				}
 			
-			wf. write( buf );
-			wf.close();
+				wf. write( buf );
+				wf.close();
+			}
+			else
+				qWarning( "Could not get file %s\n", qPrintable( batch[b].toString() ) );
 		}
-		else
-			qWarning( "Could not get file %s\n", qPrintable( files[i].toString() ) );
 	}
 	
 	progress.setValue( files.size() );
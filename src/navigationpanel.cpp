@@ -111,19 +111,13 @@ bool NavigationPanel::findUrlInContents( const QUrl& url )
 	if ( !m_contentsTab )
 		return false;
 
-	TreeItem_TOC * treeitem = m_contentsTab->getTreeItem( url );
+	int entry = m_contentsTab->findEntry( url );
 
-	if ( treeitem )
-	{
-		TreeItem_TOC * itemparent = treeitem;
-		while ( (itemparent = (TreeItem_TOC*) itemparent->parent()) != 0 )
-			itemparent->setExpanded(true);
-
-		m_contentsTab->showItem( treeitem );
-		return true;
-	}
+	if ( entry == -1 )
+		return false;
 
-	return false;
+	m_contentsTab->showEntry( entry );
+	return true;
 }
 
 void NavigationPanel::addBookmark()
@@ -136,17 +130,11 @@ void NavigationPanel::showPrevInToc()
 	if ( !m_contentsTab )
 		return;
 
-	// Try to find current list item
-	TreeItem_TOC * current = m_contentsTab->getTreeItem( ::mainWindow->currentBrowser()->getOpenedPage() );
+	// Try to find current list item; the entries are in the TOC order
+	int current = m_contentsTab->findEntry( ::mainWindow->currentBrowser()->getOpenedPage() );
 
-	if ( !current )
-		return;
-
-	QTreeWidgetItemIterator lit( current );
-	lit--;
-
-	if ( *lit )
-		::mainWindow->openPage( ((TreeItem_TOC *) (*lit) )->getUrl(), MainWindow::OPF_CONTENT_TREE );
+	if ( current > 0 )
+		::mainWindow->openPage( m_contentsTab->entryUrl( current - 1 ), MainWindow::OPF_CONTENT_TREE );
 }
 
 void NavigationPanel::showNextInToc()
@@ -154,17 +142,11 @@ void NavigationPanel::showNextInToc()
 	if ( !m_contentsTab )
 		return;
 
-	// Try to find current list item
-	TreeItem_TOC * current = m_contentsTab->getTreeItem( ::mainWindow->currentBrowser()->getOpenedPage() );
-
-	if ( !current )
-		return;
-
-	QTreeWidgetItemIterator lit( current );
-	lit++;
+	// Try to find current list item; the entries are in the TOC order
+	int current = m_contentsTab->findEntry( ::mainWindow->currentBrowser()->getOpenedPage() );
 
-	if ( *lit )
-		::mainWindow->openPage( ((TreeItem_TOC *) (*lit) )->getUrl(),MainWindow::OPF_CONTENT_TREE );
+	if ( current != -1 && current + 1 < m_contentsTab->entryCount() )
+		::mainWindow->openPage( m_contentsTab->entryUrl( current + 1 ), MainWindow::OPF_CONTENT_TREE );
 }
 
 
@@ -232,6 +214,12 @@ void NavigationPanel::executeQueryInSearch( const QString& text )
 	m_searchTab->execSearchQueryInGui( text );
 }
 
+void NavigationPanel::setSearchScope( const QString& title, const QList<QUrl>& urls )
+{
+	m_searchTab->setSearchScope( title, urls );
+	setActive( TAB_SEARCH );
+}
+
 QStringList NavigationPanel::searchQuery( const QString& text )
 {
 	QList< QUrl > res;
@@ -243,3 +231,12 @@ QStringList NavigationPanel::searchQuery( const QString& text )
 
 	return result;
 }
+
+bool NavigationPanel::benchmarkSearch()
+{
+	// The contents filter is measured too, if the ebook has contents
+	if ( m_contentsTab )
+		m_contentsTab->runBenchmark();
+
+	return m_searchTab->runBenchmark();
+}
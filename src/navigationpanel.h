@@ -71,9 +71,15 @@ class NavigationPanel : public QDockWidget, public Ui::NavigatorPanel
 		// Find text in search tab
 		void	executeQueryInSearch( const QString& text );
 
+		// Limit the search tab queries to the documents with those URLs, like a contents section
+		void	setSearchScope( const QString& title, const QList<QUrl>& urls );
+
 		// Just find text without using search tab
 		QStringList	searchQuery( const QString& text );
 
+		// Measure the search query speed, and print it to stdout
+		bool	benchmarkSearch();
+
 	public slots:
 		// Add a new bookmark
 		void	addBookmark();
@@ -0,0 +1,244 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QFileInfo>
+
+#include "kde-qt.h"
+#include "mainwindow.h"
+#include "ebook_search.h"
+#include "searchresultsmodel.h"
+
+// How many rows the view gets at once
+static const int FETCH_PAGE_SIZE = 100;
+
+
+SearchResultsModel::SearchResultsModel( QObject * parent )
+	: QAbstractTableModel( parent )
+{
+	m_shown = 0;
+	m_engine = 0;
+	m_library = 0;
+	m_lastTermIsPrefix = false;
+}
+
+
+void SearchResultsModel::clear()
+{
+	beginResetModel();
+
+	m_rows.clear();
+	m_shown = 0;
+	m_engine = 0;
+	m_library = 0;
+	m_query.clear();
+
+	endResetModel();
+}
+
+
+void SearchResultsModel::setResults( const QList<QUrl>& urls, EBookSearch * engine, const QString& query, bool lastTermIsPrefix )
+{
+	beginResetModel();
+
+	m_rows.clear();
+	m_engine = engine;
+	m_library = 0;
+	m_query = query;
+	m_lastTermIsPrefix = lastTermIsPrefix;
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		Row row;
+		row.url = urls[i];
+		m_rows.push_back( row );
+	}
+
+	m_shown = qMin( m_rows.size(), FETCH_PAGE_SIZE );
+	endResetModel();
+}
+
+
+void SearchResultsModel::setLibraryResults( const QList<EBookLibrarySearch::Result>& results, EBookLibrarySearch * library, const QString& query )
+{
+	beginResetModel();
+
+	m_rows.clear();
+	m_engine = 0;
+	m_library = library;
+	m_query = query;
+	m_lastTermIsPrefix = false;
+
+	for ( int i = 0; i < results.size(); i++ )
+	{
+		Row row;
+		row.url = results[i].url;
+		row.ebook = results[i].ebook;
+		row.title = results[i].title.isEmpty() ? results[i].url.path() : results[i].title;
+		m_rows.push_back( row );
+	}
+
+	m_shown = qMin( m_rows.size(), FETCH_PAGE_SIZE );
+	endResetModel();
+}
+
+
+void SearchResultsModel::addResult( const QString& title, const QUrl& url, const QString& snippet )
+{
+	Row row;
+	row.url = url;
+	row.title = title;
+	row.snippet = snippet;
+	row.resolved = true;
+
+	// Shown right away, unless there are the rows the view did not fetch yet
+	if ( m_shown == m_rows.size() )
+	{
+		beginInsertRows( QModelIndex(), m_shown, m_shown );
+		m_rows.push_back( row );
+		m_shown++;
+		endInsertRows();
+	}
+	else
+		m_rows.push_back( row );
+}
+
+
+QUrl SearchResultsModel::url( const QModelIndex& index ) const
+{
+	if ( !index.isValid() || index.row() >= m_shown )
+		return QUrl();
+
+	return m_rows[ index.row() ].url;
+}
+
+
+QString SearchResultsModel::ebook( const QModelIndex& index ) const
+{
+	if ( !index.isValid() || index.row() >= m_shown )
+		return QString();
+
+	return m_rows[ index.row() ].ebook;
+}
+
+
+void SearchResultsModel::resolve( Row& row ) const
+{
+	row.resolved = true;
+
+	if ( m_library )
+	{
+		row.snippet = m_library->getSnippet( row.ebook, row.url, m_query );
+		return;
+	}
+
+	row.title = ::mainWindow->chmFile()->getTopicByUrl( row.url );
+
+	if ( m_engine )
+		row.snippet = m_engine->getSnippet( row.url, m_query, 200, m_lastTermIsPrefix );
+}
+
+
+int SearchResultsModel::rowCount( const QModelIndex& parent ) const
+{
+	return parent.isValid() ? 0 : m_shown;
+}
+
+
+int SearchResultsModel::columnCount( const QModelIndex& parent ) const
+{
+	return parent.isValid() ? 0 : COLUMN_COUNT;
+}
+
+
+QVariant SearchResultsModel::data( const QModelIndex& index, int role ) const
+{
+	if ( !index.isValid() || index.row() >= m_shown )
+		return QVariant();
+
+	switch( role )
+	{
+		case Qt::DisplayRole:
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			{
+				Row& row = m_rows[ index.row() ];
+
+				if ( index.column() == COLUMN_LOCATION )
+				{
+					if ( !row.ebook.isEmpty() )
+						return QFileInfo( row.ebook ).fileName() + ": " + row.url.path();
+
+					return row.url.path();
+				}
+
+				if ( !row.resolved )
+					resolve( row );
+
+				if ( index.column() == COLUMN_TITLE )
+					return row.title;
+
+				return row.snippet;
+			}
+	}
+
+	return QVariant();
+}
+
+
+QVariant SearchResultsModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+
+	switch( section )
+	{
+		case COLUMN_TITLE:
+			return i18n( "Title" );
+
+		case COLUMN_LOCATION:
+			return i18n( "Location" );
+
+		case COLUMN_SNIPPET:
+			return i18n( "Context" );
+	}
+
+	return QVariant();
+}
+
+
+bool SearchResultsModel::canFetchMore( const QModelIndex& parent ) const
+{
+	return !parent.isValid() && m_shown < m_rows.size();
+}
+
+
+void SearchResultsModel::fetchMore( const QModelIndex& parent )
+{
+	if ( parent.isValid() )
+		return;
+
+	int count = qMin( m_rows.size() - m_shown, FETCH_PAGE_SIZE );
+
+	if ( count <= 0 )
+		return;
+
+	beginInsertRows( QModelIndex(), m_shown, m_shown + count - 1 );
+	m_shown += count;
+	endInsertRows();
+}
@@ -0,0 +1,101 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SEARCHRESULTSMODEL_H
+#define SEARCHRESULTSMODEL_H
+
+#include <QAbstractTableModel>
+#include <QList>
+#include <QUrl>
+
+#include "ebook_library_search.h"
+
+class EBookSearch;
+
+//! The search results shown in the search tab. Only the URLs are kept for the found documents; their titles
+//! and snippets are made when the view shows them. The view gets the results in pages as it is scrolled, so
+//! the number of the results does not matter.
+class SearchResultsModel : public QAbstractTableModel
+{
+	Q_OBJECT
+
+	public:
+		enum Column
+		{
+			COLUMN_TITLE,
+			COLUMN_LOCATION,
+			COLUMN_SNIPPET,
+			COLUMN_COUNT
+		};
+
+		SearchResultsModel( QObject * parent );
+
+		void		clear();
+
+		//! Shows the documents of the opened ebook found by \param engine for the \param query
+		void		setResults( const QList<QUrl>& urls, EBookSearch * engine, const QString& query, bool lastTermIsPrefix );
+
+		//! Shows the documents found in the library
+		void		setLibraryResults( const QList<EBookLibrarySearch::Result>& results, EBookLibrarySearch * library, const QString& query );
+
+		//! Adds the document with the known title and snippet, like the one found by the scan
+		void		addResult( const QString& title, const QUrl& url, const QString& snippet );
+
+		//! The number of the results, including those the view did not fetch yet
+		int			resultCount() const { return m_rows.size(); }
+
+		QUrl		url( const QModelIndex& index ) const;
+
+		//! The ebook file for the library search results; empty for the current ebook
+		QString		ebook( const QModelIndex& index ) const;
+
+		// Overridden methods
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		int			columnCount( const QModelIndex& parent = QModelIndex() ) const;
+		QVariant	data( const QModelIndex& index, int role ) const;
+		QVariant	headerData( int section, Qt::Orientation orientation, int role ) const;
+		bool		canFetchMore( const QModelIndex& parent ) const;
+		void		fetchMore( const QModelIndex& parent );
+
+	private:
+		struct Row
+		{
+			Row() : resolved( false ) {}
+
+			QUrl		url;
+			QString		ebook;
+			QString		title;
+			QString		snippet;
+			bool		resolved;	// the title and snippet are made
+		};
+
+		void		resolve( Row& row ) const;
+
+		// The rows are resolved when shown, so they change in the const data()
+		mutable QList<Row>		m_rows;
+		int						m_shown;	// the rows the view fetched
+
+		// Where the titles and snippets come from
+		EBookSearch			*	m_engine;
+		EBookLibrarySearch	*	m_library;
+		QString					m_query;
+		bool					m_lastTermIsPrefix;
+};
+
+#endif // SEARCHRESULTSMODEL_H
@@ -18,15 +18,24 @@
 
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QDataStream>
 #include <QDateTime>
  
 #include "settings.h"
 #include "config.h"
+#include "cachestore.h"
 
 static qint32 SETTINGS_MAGIC = 0xD8AB4E76;
 static qint32 SETTINGS_VERSION = 4;
 
+// The suffixes of the ebook files in the cache store
+static const char SETTINGS_SUFFIX[] = ".kchmviewer";
+static const char INDEX_SUFFIX[] = ".idx";
+
+// Added to the search index file name to keep the index of the previous revision of the ebook
+static const char PREVIOUS_INDEX_SUFFIX[] = ".previous";
+
 /*
  * The order is important!
  * To be compatible with next versions, you may add items ONLY before the MARKER_END!
@@ -131,6 +140,9 @@ bool Settings::loadSettings( const QString & filename )
 
 	m_settingsFile = QString::null;
 	m_searchIndex = QString::null;
+	m_searchIndexSave = QString::null;
+	m_previousSearchIndex = QString::null;
+	m_cacheKey = QString::null;
 	
 	if ( !finfo.size() )
 		return false;
@@ -138,11 +150,43 @@ bool Settings::loadSettings( const QString & filename )
 	// Init those params, as they'll be used during save the first time even if the file is not here
 	m_currentfilesize = finfo.size();
 	m_currentfiledate = finfo.lastModified().toTime_t();
-	m_settingsFile = pConfig->getEbookSettingFile( filename );
-	m_searchIndex = pConfig->getEbookIndexFile( filename );
+
+	// The files are named by the ebook content, so the ebooks with the same file name do not share them
+	CacheStore * cache = pConfig->cacheStore();
+
+	m_cacheKey = CacheStore::fingerprint( filename );
+	m_settingsFile = cache->writablePath( m_cacheKey, SETTINGS_SUFFIX );
+	m_searchIndex = cache->lookup( m_cacheKey, INDEX_SUFFIX );
+	m_searchIndexSave = cache->writablePath( m_cacheKey, INDEX_SUFFIX );
+
+	// If the ebook has changed since it was opened last time, its previous index is used to generate the new one
+	QString previouskey = cache->updateEbookKey( filename, m_cacheKey );
+
+	if ( !previouskey.isEmpty() && previouskey != m_cacheKey && !QFile::exists( m_searchIndex ) )
+	{
+		QString previousindex = cache->lookup( previouskey, INDEX_SUFFIX );
+
+		if ( QFile::exists( previousindex ) )
+			m_previousSearchIndex = previousindex;
+	}
+
+	cache->evict( m_cacheKey );
 	
 	QFile file( m_settingsFile );
 
+	// The older versions named the settings file after the ebook file; it is read and saved under the new name
+	QString legacyfile;
+
+	if ( !file.exists() )
+	{
+		legacyfile = pConfig->getLegacyEbookSettingFile( filename );
+
+		if ( QFile::exists( legacyfile ) )
+			file.setFileName( legacyfile );
+		else
+			legacyfile.clear();
+	}
+
     if ( !file.open (QIODevice::ReadOnly) )
 		return false; // it's ok, file may not exist
 	
@@ -183,6 +227,7 @@ bool Settings::loadSettings( const QString & filename )
 			if ( m_currentfilesize != finfo.size() )
 			{
 				m_currentfilesize = finfo.size();
+				keepPreviousSearchIndex();
 				return false;
 			}
 			break;
@@ -192,6 +237,7 @@ bool Settings::loadSettings( const QString & filename )
 			if ( m_currentfiledate != finfo.lastModified().toTime_t() )
 			{
 				m_currentfiledate = finfo.lastModified().toTime_t();
+				keepPreviousSearchIndex();
 				return false;
 			}
 			break;
@@ -233,13 +279,23 @@ bool Settings::loadSettings( const QString & filename )
 		}
 	}
 	
+	// The legacy file is of this ebook (its size and time matched), so it is moved into the cache store
+	if ( complete_read && !legacyfile.isEmpty() )
+	{
+		file.close();
+
+		if ( saveSettings() )
+			QFile::remove( legacyfile );
+	}
+
 	return complete_read;
 }
 
 
 bool Settings::saveSettings( )
 {
-	QFile file( m_settingsFile );
+	// Written to a temporary file first, so the settings are never partially written
+	QSaveFile file( m_settingsFile );
     if ( !file.open (QIODevice::WriteOnly) )
 	{
 		qWarning ("Could not write settings into file %s: %s", 
@@ -288,6 +344,16 @@ bool Settings::saveSettings( )
 	stream << m_viewwindows;
 	
 	stream << MARKER_END;
+
+	if ( !file.commit() )
+	{
+		qWarning ("Could not write settings into file %s: %s",
+		          qPrintable( m_settingsFile ),
+		          qPrintable( file.errorString() ));
+		return false;
+	}
+
+	pConfig->cacheStore()->evict( m_cacheKey );
 	return true;
 }
 
@@ -299,4 +365,34 @@ void Settings::removeSettings( const QString & filename )
 
 	QFile::remove( settingsfile );
 	QFile::remove( idxfile );
+	QFile::remove( idxfile + PREVIOUS_INDEX_SUFFIX );
+}
+
+
+void Settings::keepPreviousSearchIndex()
+{
+	// The ebook has changed, but the sampled fingerprint did not notice it, so the index is outdated.
+	// It is kept aside, so the postings of the unchanged documents are reused when the index is generated again.
+	if ( !QFile::exists( m_searchIndex ) )
+		return;
+
+	if ( m_searchIndex == m_searchIndexSave )
+	{
+		QString previous = m_searchIndexSave + PREVIOUS_INDEX_SUFFIX;
+		QFile::remove( previous );
+
+		if ( !QFile::rename( m_searchIndex, previous ) )
+		{
+			QFile::remove( m_searchIndex );
+			return;
+		}
+
+		m_previousSearchIndex = previous;
+	}
+	else
+	{
+		// The index from the read-only system directory
+		m_previousSearchIndex = m_searchIndex;
+		m_searchIndex = m_searchIndexSave;
+	}
 }
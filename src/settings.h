@@ -32,7 +32,18 @@ class Settings
 		bool	saveSettings ( );
 		void 	removeSettings ( const QString& filename );
 		
+		// The search index to load; it may be in the read-only system directory
 		QString	searchIndexFile() const	{ return m_searchIndex; }
+
+		// Where the generated search index is saved
+		QString	searchIndexSaveFile() const	{ return m_searchIndexSave; }
+
+		// The index of the previous revision of the ebook, if it has changed since the index was generated;
+		// empty otherwise
+		QString	previousSearchIndexFile() const { return m_previousSearchIndex; }
+
+		// The key of the ebook files in the cache store
+		QString	cacheKey() const { return m_cacheKey; }
 		
 		class SavedBookmark
 		{
@@ -71,10 +82,15 @@ class Settings
 		viewindow_saved_settings_t	m_viewwindows;
 	
 	private:
+		void	keepPreviousSearchIndex();
+
 		unsigned int				m_currentfilesize;
 		unsigned int				m_currentfiledate;
 		QString						m_settingsFile;
 		QString						m_searchIndex;
+		QString						m_searchIndexSave;
+		QString						m_previousSearchIndex;
+		QString						m_cacheKey;
 };
 
 #endif
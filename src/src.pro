@@ -1,5 +1,6 @@
 INCLUDEPATH += ../lib/libebook
-HEADERS += config.h \
+HEADERS += cachestore.h \
+    config.h \
     dialog_chooseurlfromlist.h \
     dialog_setup.h \
     kde-qt.h \
@@ -18,9 +19,13 @@ HEADERS += config.h \
     toolbarmanager.h \
     toolbareditor.h \
     textencodings.h \
-    treeitem_toc.h \
-    treeitem_index.h
-SOURCES += config.cpp \
+    flattreemodel.h \
+    indexmodel.h \
+    searchresultsmodel.h \
+    tocfiltermodel.h \
+    tocmodel.h
+SOURCES += cachestore.cpp \
+    config.cpp \
     dialog_chooseurlfromlist.cpp \
     dialog_setup.cpp \
     kde-qt.cpp \
@@ -38,8 +43,11 @@ SOURCES += config.cpp \
     toolbarmanager.cpp \
     toolbareditor.cpp \
     textencodings.cpp \
-    treeitem_toc.cpp \
-    treeitem_index.cpp
+    flattreemodel.cpp \
+    indexmodel.cpp \
+    searchresultsmodel.cpp \
+    tocfiltermodel.cpp \
+    tocmodel.cpp
 TARGET = ../bin/kchmviewer
 CONFIG += threads \
     warn_on \
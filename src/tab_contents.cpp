@@ -16,13 +16,20 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QElapsedTimer>
+#include <QRegExp>
+
+#include <stdio.h>
+
 #include "kde-qt.h"
 
 #include "mainwindow.h"
-#include "treeitem_toc.h"
+#include "navigationpanel.h"
 #include "tab_contents.h"
 #include "config.h"
 
+// The suffix of the contents file in the cache store
+static const char CACHE_SUFFIX[] = ".toc";
 
 TabContents::TabContents( QWidget *parent )
 	: QWidget( parent ), Ui::TabContents()
@@ -30,25 +37,53 @@ TabContents::TabContents( QWidget *parent )
 	setupUi( this );
 	
 	m_contextMenu = 0;
+	m_contextEntry = -1;
+
+	m_model = new TocModel( this );
+	tree->setModel( m_model );
+
+	m_filterModel = new TocFilterModel( m_model, this );
+	results->setModel( m_filterModel );
+	results->setUniformItemSizes( true );
 	
 	tree->header()->hide();
+
+	// All the rows have the same height, so the view does not need to lay out the rows it does not show
+	tree->setUniformRowHeights( true );
 	
 	// Handle clicking on m_contentsWindow element
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked( const QModelIndex & ) ),
+                 this,
+                 SLOT( onClicked( const QModelIndex & ) ) );
+
+        connect( results,
+                 SIGNAL( clicked( const QModelIndex & ) ),
                  this,
-                 SLOT( onClicked ( QTreeWidgetItem *, int ) ) );
+                 SLOT( onResultClicked( const QModelIndex & ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated( const QModelIndex & ) ),
                  this,
-                 SLOT( onClicked ( QTreeWidgetItem *, int ) ) );
+                 SLOT( onClicked( const QModelIndex & ) ) );
+
+        connect( results,
+                 SIGNAL( activated( const QModelIndex & ) ),
+                 this,
+                 SLOT( onResultClicked( const QModelIndex & ) ) );
     }
 
+	// Typing in the filter shows the matching entries instead of the tree
+	connect( filter, SIGNAL( textChanged( const QString & ) ), this, SLOT( onFilterChanged( const QString & ) ) );
+
+	// The expanded entries show the open book icon
+	connect( tree, SIGNAL( expanded( const QModelIndex & ) ), this, SLOT( onExpanded( const QModelIndex & ) ) );
+	connect( tree, SIGNAL( collapsed( const QModelIndex & ) ), this, SLOT( onCollapsed( const QModelIndex & ) ) );
+
 	// Activate custom context menu, and connect it
 	tree->setContextMenuPolicy( Qt::CustomContextMenu );
 	connect( tree, 
@@ -71,160 +106,242 @@ void TabContents::refillTableOfContents( )
 	ShowWaitCursor wc;
 	QList< EBookTocEntry > data;
 	
-	if ( !::mainWindow->chmFile()->getTableOfContents( data )
-	|| data.size() == 0 )
-	{
-		qWarning ("Table of contents is present but is empty; wrong parsing?");
-		return;
-	}
-
-	// Fill up the tree; we use a pretty complex routine to handle buggy CHMs
-	QVector< TreeItem_TOC *> lastchild;
-	QVector< TreeItem_TOC *> rootentry;
-	bool warning_shown = false;
+	m_contextEntry = -1;
+	m_filterText.clear();
+	m_filterModel->setEntries( QVector<int>() );
 
-	tree->clear();
-
-	for ( int i = 0; i < data.size(); i++ )
+	// The contents parsed when the ebook was opened before are kept in the cache
+	if ( !m_model->loadCache( CACHE_SUFFIX ) )
 	{
-		int indent = data[i].indent;
-
-		// Do we need to add another indent?
-		if ( indent >= rootentry.size() )
+		if ( !::mainWindow->chmFile()->getTableOfContents( data )
+		|| data.size() == 0 )
 		{
-			int maxindent = rootentry.size() - 1;
+			qWarning ("Table of contents is present but is empty; wrong parsing?");
+			m_model->clear();
+			return;
+		}
 
-			// Resize the arrays
-			lastchild.resize( indent + 1 );
-			rootentry.resize( indent + 1 );
+		m_model->setEntries( data );
+		m_model->saveCache( CACHE_SUFFIX );
+	}
 
-			if ( indent > 0 && maxindent < 0 )
-				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
+	if ( pConfig->m_tocOpenAllEntries )
+	{
+		m_model->setAllExpanded();
+		tree->expandAll();
+	}
 
-			// And init the rest if needed
-			if ( (indent - maxindent) > 1 )
-			{
-				if ( !warning_shown )
-				{
-					qWarning("Invalid TOC step, applying workaround. Results may vary.");
-					warning_shown = true;
-				}
-
-				for ( int j = maxindent; j < indent; j++ )
-				{
-					lastchild[j+1] = lastchild[j];
-					rootentry[j+1] = rootentry[j];
-				}
-			}
+	// The names may have changed with the encoding
+	if ( !filter->text().isEmpty() )
+		onFilterChanged( filter->text() );
+}
 
-			lastchild[indent] = 0;
-			rootentry[indent] = 0;
-		}
 
-		// Create the node
-		TreeItem_TOC * item;
+int TabContents::findEntry( const QUrl& url ) const
+{
+	// During the first iteraction we check for the fragment as well, so the URLs
+	// like ch05.htm#app1 and ch05.htm#app2 could be handled as different TOC entries
+	int entry = m_model->findEntry( url, false );
 
-		if ( indent == 0 )
-			item = new TreeItem_TOC( tree, lastchild[indent], data[i].name, data[i].url, data[i].iconid );
-		else
-		{
-			// New non-root entry. It is possible (for some buggy CHMs) that there is no previous entry: previoous entry had indent 1,
-			// and next entry has indent 3. Backtracking it up, creating missing entries.
-			if ( rootentry[indent-1] == 0 )
-				qFatal("Child entry indented as %d with no root entry!", indent);
+	// During the second iteraction we ignore the fragment, so if there is no ch05.htm#app1
+	// but there is ch05.htm, we just use it
+	if ( entry == -1 )
+		entry = m_model->findEntry( url, true );
 
-			item = new TreeItem_TOC( rootentry[indent-1], lastchild[indent], data[i].name, data[i].url, data[i].iconid );
-		}
+	return entry;
+}
 
-        if ( pConfig->m_tocOpenAllEntries )
-            item->setExpanded( true );
+void TabContents::showEntry( int entry )
+{
+	QModelIndex index = m_model->indexOf( entry );
 
-		lastchild[indent] = item;
-		rootentry[indent] = item;
-	}
+	// Expand the parents, so the entry is visible
+	for ( QModelIndex parent = index.parent(); parent.isValid(); parent = parent.parent() )
+		tree->expand( parent );
 
-	tree->update();
+	tree->setCurrentIndex( index );
+	tree->scrollTo( index );
 }
 
 
-static TreeItem_TOC * findTreeItem( TreeItem_TOC *item, const QUrl& url, bool ignorefragment )
+void TabContents::onClicked( const QModelIndex& index )
 {
-	if ( item->containstUrl( url, ignorefragment ) )
-		return item;
-
-	for ( int i = 0; i < item->childCount(); ++i )
-	{
-		TreeItem_TOC * bitem = findTreeItem( (TreeItem_TOC *) item->child( i ), url, ignorefragment );
-
-		if ( bitem )
-			return bitem;
-	}
-
-	return 0;
+	if ( !index.isValid() )
+		return;
+	
+	::mainWindow->activateUrl( m_model->entryUrl( m_model->entry( index ) ) );
 }
 
-TreeItem_TOC * TabContents::getTreeItem( const QUrl& url )
+void TabContents::onFilterChanged( const QString& text )
 {
-	// During the first iteraction we check for the fragment as well, so the URLs
-	// like ch05.htm#app1 and ch05.htm#app2 could be handled as different TOC entries
-	for ( int i = 0; i < tree->topLevelItemCount(); i++ )
+	if ( text.trimmed().isEmpty() )
 	{
-		TreeItem_TOC * item = findTreeItem( (TreeItem_TOC*) tree->topLevelItem(i), url, false );
-
-		if ( item )
-			return item;
+		m_filterText.clear();
+		m_filterModel->setEntries( QVector<int>() );
+		results->hide();
+		tree->show();
+		return;
 	}
 
-	// During the second iteraction we ignore the fragment, so if there is no ch05.htm#app1
-	// but there is ch05.htm, we just use it
-	for ( int i = 0; i < tree->topLevelItemCount(); i++ )
-	{
-		TreeItem_TOC * item = findTreeItem( (TreeItem_TOC*) tree->topLevelItem(i), url, true );
-
-		if ( item )
-			return item;
-	}
+	// When the text is typed further, its matches are among the previous ones
+	if ( !m_filterText.isEmpty() && text.startsWith( m_filterText ) )
+		m_filterModel->setEntries( m_model->filterEntries( text, &m_filterModel->entries() ) );
+	else
+		m_filterModel->setEntries( m_model->filterEntries( text ) );
 
-	return 0;
+	m_filterText = text;
+	tree->hide();
+	results->show();
 }
 
-void TabContents::showItem( TreeItem_TOC * item )
+void TabContents::onResultClicked( const QModelIndex& index )
 {
-	tree->setCurrentItem( item );
-	tree->scrollToItem( item );
+	int entry = m_filterModel->entry( index );
+
+	if ( entry != -1 )
+		::mainWindow->activateUrl( m_model->entryUrl( entry ) );
 }
 
+void TabContents::onExpanded( const QModelIndex& index )
+{
+	m_model->setExpanded( index, true );
+}
 
-void TabContents::onClicked(QTreeWidgetItem * item, int)
+void TabContents::onCollapsed( const QModelIndex& index )
 {
-	if ( !item )
-		return;
-	
-	TreeItem_TOC * treeitem = (TreeItem_TOC*) item;
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	m_model->setExpanded( index, false );
 }
 
 void TabContents::onContextMenuRequested(const QPoint & point)
 {
-	TreeItem_TOC * treeitem = (TreeItem_TOC *) tree->itemAt( point );
+	int entry = m_model->entry( tree->indexAt( point ) );
 	
-	if( treeitem )
+	if( entry != -1 )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
-		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
+		// The same menu as for the other tabs, and the search in the section
+		if ( !m_contextMenu )
+		{
+			m_contextMenu = new QMenu( this );
+			m_contextMenu->addActions( ::mainWindow->tabItemsContextMenu()->actions() );
+			m_contextMenu->addSeparator();
+			m_contextMenu->addAction( i18n( "&Search in this section" ), this, SLOT( onSearchInSection() ) );
+		}
+
+		m_contextEntry = entry;
+		::mainWindow->currentBrowser()->setTabKeeper( m_model->entryUrl( entry ) );
+		m_contextMenu->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
 
 
+void TabContents::onSearchInSection()
+{
+	if ( m_contextEntry == -1 )
+		return;
+
+	// The section entries follow it in the TOC order
+	QList<QUrl> urls;
+	int end = m_model->subtreeEnd( m_contextEntry );
+
+	for ( int i = m_contextEntry; i < end; i++ )
+	{
+		if ( !m_model->entryUrl( i ).isEmpty() )
+			urls.push_back( m_model->entryUrl( i ) );
+	}
+
+	::mainWindow->navigator()->setSearchScope( m_model->entryName( m_contextEntry ), urls );
+}
+
+
 void TabContents::search( const QString & text )
 {
-	QList<QTreeWidgetItem*> items = tree->findItems( text, Qt::MatchWildcard | Qt::MatchRecursive );
+	// The wildcards are still accepted, as before the filter box; then the first matching entry is opened
+	if ( text.contains( '*' ) || text.contains( '?' ) )
+	{
+		QRegExp pattern( text, Qt::CaseInsensitive, QRegExp::Wildcard );
+
+		for ( int i = 0; i < m_model->entryCount(); i++ )
+		{
+			if ( !m_model->entryUrl( i ).isEmpty() && pattern.exactMatch( m_model->entryName( i ) ) )
+			{
+				::mainWindow->activateUrl( m_model->entryUrl( i ) );
+				return;
+			}
+		}
 
-	if ( items.isEmpty() )
 		return;
-			
-	TreeItem_TOC * treeitem = (TreeItem_TOC *) items.first();
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	}
+
+	// Otherwise the same matching as the filter box; the best match which has a page is opened
+	QVector<int> matches = m_model->filterEntries( text );
+
+	for ( int i = 0; i < matches.size(); i++ )
+	{
+		if ( !m_model->entryUrl( matches[i] ).isEmpty() )
+		{
+			::mainWindow->activateUrl( m_model->entryUrl( matches[i] ) );
+			return;
+		}
+	}
+}
+
+bool TabContents::runBenchmark( int iterations )
+{
+	if ( m_model->entryCount() == 0 )
+		return false;
+
+	// The texts are made of a title in the middle of the contents: its first letter, which matches the most
+	// titles, its first word, the same word with every other letter, and the word typed letter by letter
+	// with the previous matches narrowed as the filter box does
+	QString word = m_model->entryName( m_model->entryCount() / 2 ).section( ' ', 0, 0, QString::SectionSkipEmpty ).left( 8 );
+	QString sparse;
+
+	for ( int i = 0; i < word.length(); i += 2 )
+		sparse += word[i];
+
+	QList< QPair<QString, QString> > filters;
+	filters.push_back( qMakePair( QString("tocchar"), word.left( 1 ) ) );
+	filters.push_back( qMakePair( QString("tocword"), word ) );
+	filters.push_back( qMakePair( QString("tocfuzzy"), sparse ) );
+	filters.push_back( qMakePair( QString("toctyped"), word ) );
+
+	printf( "Contents filter benchmark, %d titles, %d iterations per text\n", m_model->entryCount(), iterations );
+
+	for ( int f = 0; f < filters.size(); f++ )
+	{
+		const QString& text = filters[f].second;
+		bool typed = filters[f].first == "toctyped";
+		qint64 total = 0, best = -1;
+		int found = 0;
+
+		for ( int i = 0; i < iterations; i++ )
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			QVector<int> matches = m_model->filterEntries( typed ? text.left( 1 ) : text );
+
+			// Every keystroke is timed; the time is per keystroke
+			for ( int len = 2; typed && len <= text.length(); len++ )
+				matches = m_model->filterEntries( text.left( len ), &matches );
+
+			qint64 elapsed = timer.nsecsElapsed() / (typed ? qMax( text.length(), 1 ) : 1);
+			total += elapsed;
+			found = matches.size();
+
+			if ( best < 0 || elapsed < best )
+				best = elapsed;
+		}
+
+		printf( "  %-8s %-40s min %8.3f ms, avg %8.3f ms, %d titles\n",
+				qPrintable( filters[f].first ),
+				qPrintable( text ),
+				best / 1000000.0,
+				total / 1000000.0 / qMax( iterations, 1 ),
+				found );
+	}
+
+	return true;
 }
 
 void TabContents::focus()
@@ -20,7 +20,8 @@
 #define TAB_CONTENTS_H
 
 #include "kde-qt.h"
-#include "treeitem_toc.h"
+#include "tocmodel.h"
+#include "tocfiltermodel.h"
 #include "ui_tab_contents.h"
 
 
@@ -32,18 +33,38 @@ class TabContents : public QWidget, public Ui::TabContents
 		~TabContents();
 		
 		void	refillTableOfContents();
-		void	showItem( TreeItem_TOC * item );
+		void	showEntry( int entry );
 		void	search( const QString& text );
+
+		//! Measures the filter box speed on the texts made of the current contents, and prints it to stdout.
+		//! Returns false if there are no contents.
+		bool	runBenchmark( int iterations = 20 );
 		void	focus();
 		
-		TreeItem_TOC *	getTreeItem(const QUrl &url );
+		//! Returns the TOC entry pointing to the url, or -1
+		int		findEntry( const QUrl &url ) const;
+
+		//! The entries are numbered in the TOC order
+		int		entryCount() const { return m_model->entryCount(); }
+		QUrl	entryUrl( int entry ) const { return m_model->entryUrl( entry ); }
 		
 	public slots:
 		void	onContextMenuRequested ( const QPoint &point );
-		void	onClicked ( QTreeWidgetItem * item, int column );
+		void	onClicked ( const QModelIndex& index );
+		void	onSearchInSection();
+		void	onExpanded( const QModelIndex& index );
+		void	onCollapsed( const QModelIndex& index );
+		void	onFilterChanged( const QString& text );
+		void	onResultClicked( const QModelIndex& index );
 	
 	private:
 		QMenu 	*	m_contextMenu;
+		TocModel *	m_model;
+		int			m_contextEntry;
+
+		// The entries matching the filter, and the filter text they were found for
+		TocFilterModel *	m_filterModel;
+		QString				m_filterText;
 };
 
 
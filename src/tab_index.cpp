@@ -16,18 +16,128 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
 #include "mainwindow.h"
-#include "treeitem_index.h"
+#include "dialog_chooseurlfromlist.h"
 #include "tab_index.h"
 #include "config.h"
 
+// The suffix of the keyword index file in the cache store
+static const char CACHE_SUFFIX[] = ".kwd";
+
+
+// The index being loaded in the thread pool
+class IndexLoad
+{
+	public:
+		IndexLoad( int serial_, const QString& file_, const QString& encoding_ )
+			: serial( serial_ ), file( file_ ), encoding( encoding_ ), success( false ) {}
+
+		int						serial;
+		QString					file;
+		QString					encoding;
+
+		// The blocks built but not yet taken by the tab; guarded by the mutex
+		QMutex					mutex;
+		QList<IndexModelBlock>	pending;
+		bool					success;
+};
+
+
+// The tab the loads report to; it is reset by the tab destructor, so the loads never touch a deleted tab
+class IndexLoadTarget
+{
+	public:
+		IndexLoadTarget( TabIndex * tab_ ) : tab( tab_ ) {}
+
+		QMutex					mutex;
+		TabIndex			*	tab;
+};
+
+
+// Parses the index in the thread pool, and passes the entries to the tab in blocks while parsing. The blocks
+// are built for the model here, so the GUI thread only appends them. The ebook is opened again, so its handle
+// is not shared with the GUI thread, which keeps reading the pages from it.
+class IndexLoadRunner : public QRunnable, public EBookIndexSink
+{
+	public:
+		IndexLoadRunner( QSharedPointer<IndexLoadTarget> target, QSharedPointer<IndexLoad> load )
+			: m_target( target ), m_load( load ) {}
+
+		void run()
+		{
+			// Showing the pages is more important. The pool thread is shared, so its priority is restored.
+			QThread::Priority priority = QThread::currentThread()->priority();
+			QThread::currentThread()->setPriority( QThread::LowPriority );
+
+			EBook * ebook = EBook::loadFile( m_load->file );
+			bool success = false;
+
+			if ( ebook )
+			{
+				if ( ebook->hasFeature( EBook::FEATURE_ENCODING ) )
+					ebook->setCurrentEncoding( qPrintable( m_load->encoding ) );
+
+				success = ebook->getIndexProgressively( this );
+				delete ebook;
+			}
+
+			{
+				QMutexLocker locker( &m_load->mutex );
+				m_load->success = success;
+			}
+
+			QThread::currentThread()->setPriority( priority );
+			notify( "onIndexLoaded" );
+		}
+
+		void indexEntries( const QList<EBookIndexEntry>& entries )
+		{
+			IndexModelBlock block = m_builder.build( entries );
+
+			{
+				QMutexLocker locker( &m_load->mutex );
+				m_load->pending.push_back( block );
+			}
+
+			notify( "onIndexBatch" );
+		}
+
+	private:
+		void notify( const char * method )
+		{
+			QMutexLocker locker( &m_target->mutex );
+
+			if ( m_target->tab )
+				QMetaObject::invokeMethod( m_target->tab, method, Qt::QueuedConnection, Q_ARG( int, m_load->serial ) );
+		}
+
+		QSharedPointer<IndexLoadTarget>	m_target;
+		QSharedPointer<IndexLoad>	m_load;
+		IndexModelBuilder			m_builder;
+};
+
 TabIndex::TabIndex ( QWidget * parent )
 	: QWidget( parent ), Ui::TabIndex()
 {
 	// UIC stuff
 	setupUi( this );
 	
-	tree->headerItem()->setHidden( true );
+	m_model = new IndexModel( this );
+	tree->setModel( m_model );
+
+	tree->header()->hide();
+
+	// All the rows have the same height, so the view does not need to lay out the rows it does not show
+	tree->setUniformRowHeights( true );
+
+	// The index is always expanded
+	tree->setExpandsOnDoubleClick( false );
 	
 	connect( text,
 			 SIGNAL( textChanged (const QString &) ), 
@@ -42,16 +152,16 @@ TabIndex::TabIndex ( QWidget * parent )
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked( const QModelIndex & ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( const QModelIndex & ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated( const QModelIndex & ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( const QModelIndex & ) ) );
     }
 
 	// Activate custom context menu, and connect it
@@ -62,165 +172,240 @@ TabIndex::TabIndex ( QWidget * parent )
 	         SLOT( onContextMenuRequested( const QPoint & ) ) );
 	
 	m_indexListFilled = false;
-	m_lastSelectedItem = 0;
+	m_lastSelectedEntry = -1;
 	m_contextMenu = 0;
+	m_loadSerial = 0;
+	m_loadTarget = QSharedPointer<IndexLoadTarget>( new IndexLoadTarget( this ) );
 
 	focus();
+
+	// The index is loaded in the background once the ebook is opened, and its encoding is set
+	if ( ::mainWindow->chmFile() )
+		QTimer::singleShot( 0, this, SLOT( refillIndex() ) );
+}
+
+TabIndex::~TabIndex()
+{
+	// The parsing cannot be interrupted, but it uses its own ebook handle, so it is left to finish alone
+	QMutexLocker locker( &m_loadTarget->mutex );
+	m_loadTarget->tab = 0;
 }
 
 void TabIndex::onTextChanged ( const QString & newvalue)
 {
-	QList<QTreeWidgetItem *> items = tree->findItems( newvalue, Qt::MatchStartsWith );
-	
-	if ( !items.isEmpty() )
-	{
-		m_lastSelectedItem = items[0];
-		tree->setCurrentItem( m_lastSelectedItem );
-		tree->scrollToItem( m_lastSelectedItem );
-	}
-	else
-		m_lastSelectedItem = 0;
+	m_lastSelectedEntry = m_model->findPrefix( newvalue );
+
+	if ( m_lastSelectedEntry != -1 )
+		showEntry( m_lastSelectedEntry );
 }
 
 
 void TabIndex::showEvent( QShowEvent * )
 {
-	if ( !::mainWindow->chmFile() || m_indexListFilled )
-		return;
-
-	m_indexListFilled = true;
-	refillIndex();
+	if ( ::mainWindow->chmFile() )
+		refillIndex();
 }
 
 void TabIndex::onReturnPressed( )
 {
-	if ( !m_lastSelectedItem )
+	if ( m_lastSelectedEntry == -1 )
 		return;
 	
-	TreeItem_Index * treeitem = (TreeItem_Index*) m_lastSelectedItem;
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	::mainWindow->activateUrl( getUrl( m_lastSelectedEntry ) );
 }
 
 
 void TabIndex::invalidate( )
 {
-	tree->clear();
+	m_model->clear();
+	m_load.clear();
 	m_indexListFilled = false;
-	m_lastSelectedItem = 0;
+	m_lastSelectedEntry = -1;
 }
 
-void TabIndex::onItemActivated ( QTreeWidgetItem * item, int )
+void TabIndex::onItemActivated ( const QModelIndex& index )
 {
-	if ( !item )
+	int entry = m_model->entry( index );
+
+	if ( entry == -1 )
 		return;
 	
-	TreeItem_Index * treeitem = (TreeItem_Index*) item;
-	
-	// Prevent opened index tree item from closing; because the tree open/close 
-	// procedure will be triggered after the slots are called, we change the tree
-	// state to "collapsed", so the slot handler expands it again.
-	if ( item->isExpanded() )
-		item->setExpanded( false );
-	
-	QUrl url = treeitem->getUrl();
-	
-	if ( !url.isValid() )
+	if ( m_model->isSeeAlso( entry ) ) // 'see also' link
+	{
+		m_lastSelectedEntry = m_model->findExact( m_model->seeAlso( entry ) );
+
+		if ( m_lastSelectedEntry != -1 )
+			showEntry( m_lastSelectedEntry );
+
 		return;
+	}
 
-	if ( treeitem->isSeeAlso() ) // 'see also' link
-	{
-		QList<QTreeWidgetItem *> items = tree->findItems( treeitem->seeAlso(), Qt::MatchFixedString );
+	QUrl url = getUrl( entry );
 	
-		if ( !items.isEmpty() )
-		{
-			m_lastSelectedItem = items[0];
-			tree->setCurrentItem( m_lastSelectedItem );
-			tree->scrollToItem( m_lastSelectedItem );
-		}
-		else
-			m_lastSelectedItem = 0;
-	}
-	else
+	if ( url.isValid() )
 		::mainWindow->openPage( url, MainWindow::OPF_CONTENT_TREE );
 }
 
 
 void TabIndex::refillIndex( )
 {
-	ShowWaitCursor wc;
-	QList< EBookIndexEntry > data;
-	
-	if ( !::mainWindow->chmFile()->getIndex( data ) || data.size() == 0 )
+	if ( m_indexListFilled )
+		return;
+
+	m_indexListFilled = true;
+
+	// The index parsed when the ebook was opened before is kept in the cache
+	if ( m_model->loadCache( CACHE_SUFFIX ) )
 	{
-		qWarning ("CHM index present but is empty; wrong parsing?");
+		tree->expandAll();
+
+		if ( !text->text().isEmpty() )
+			onTextChanged( text->text() );
+
 		return;
 	}
-	
-	QVector< TreeItem_Index *> lastchild;
-	QVector< TreeItem_Index *> rootentry;
-	bool warning_shown = false;
 
-	tree->clear();
+	// Parsing takes a while for the large indexes, so it is done in the background. The entries are appended
+	// to the model as they are parsed, and the text typed meanwhile is looked up in them.
+	m_load = QSharedPointer<IndexLoad>( new IndexLoad( ++m_loadSerial,
+													   ::mainWindow->getOpenedFileName(),
+													   ::mainWindow->chmFile()->currentEncoding() ) );
+
+	QThreadPool::globalInstance()->start( new IndexLoadRunner( m_loadTarget, m_load ) );
+}
+
+void TabIndex::onIndexBatch( int serial )
+{
+	// Was it superseded by a newer load, or the index invalidated?
+	if ( !m_load || m_load->serial != serial )
+		return;
+
+	// The index is parsed again when loaded if the encoding was changed meanwhile
+	if ( m_load->encoding != ::mainWindow->chmFile()->currentEncoding() )
+		return;
+
+	appendLoadedBlocks();
+}
+
+void TabIndex::onIndexLoaded( int serial )
+{
+	// Was it superseded by a newer load, or the index invalidated?
+	if ( !m_load || m_load->serial != serial )
+		return;
 
-	for ( int i = 0; i < data.size(); i++ )
+	// The encoding was changed while the index was parsed
+	if ( m_load->encoding != ::mainWindow->chmFile()->currentEncoding() )
 	{
-		int indent = data[i].indent;
+		m_load.clear();
+		m_model->clear();
+		m_lastSelectedEntry = -1;
+		m_indexListFilled = false;
+		refillIndex();
+		return;
+	}
 
-		// Do we need to add another indent?
-		if ( indent >= rootentry.size() )
-		{
-			int maxindent = rootentry.size() - 1;
+	bool success = appendLoadedBlocks();
 
-			// Resize the arrays
-			lastchild.resize( indent + 1 );
-			rootentry.resize( indent + 1 );
+	if ( !success || m_model->entryCount() == 0 )
+	{
+		qWarning ("CHM index present but is empty; wrong parsing?");
 
-			if ( indent > 0 && maxindent < 0 )
-				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
+		// The entries shown so far are not trusted either
+		m_load.clear();
+		m_model->clear();
+		m_lastSelectedEntry = -1;
+		return;
+	}
 
-			// And init the rest if needed
-			if ( (indent - maxindent) > 1 )
-			{
-				if ( !warning_shown )
-				{
-					qWarning("Invalid TOC step, applying workaround. Results may vary.");
-					warning_shown = true;
-				}
-
-				for ( int j = maxindent; j < indent; j++ )
-				{
-					lastchild[j+1] = lastchild[j];
-					rootentry[j+1] = rootentry[j];
-				}
-			}
+	m_model->saveCache( CACHE_SUFFIX );
+	m_load.clear();
+}
 
-			lastchild[indent] = 0;
-			rootentry[indent] = 0;
-		}
+bool TabIndex::appendLoadedBlocks()
+{
+	QList<IndexModelBlock> blocks;
+	bool success;
 
-		// Create the node
-		TreeItem_Index * item;
+	{
+		QMutexLocker locker( &m_load->mutex );
+		blocks.swap( m_load->pending );
+		success = m_load->success;
+	}
 
-		if ( indent == 0 )
-			item = new TreeItem_Index( tree, lastchild[indent], data[i].name, data[i].urls, data[i].seealso );
-		else
+	for ( int i = 0; i < blocks.size(); i++ )
+	{
+		int first = m_model->entryCount();
+
+		// The last entry could get its first children; it is expanded before, so the view lays out
+		// the new rows once instead of on each expand() below
+		if ( first > 0 )
+			tree->expand( m_model->indexOf( first - 1 ) );
+
+		// The rows are inserted, so the view keeps its scroll position and selection
+		m_model->appendEntries( blocks[i] );
+		expandEntries( first );
+	}
+
+	// The entries found so far stay the same, unless a better match came; the view is not moved otherwise
+	if ( !blocks.isEmpty() && !text->text().isEmpty() )
+	{
+		int entry = m_model->findPrefix( text->text() );
+
+		if ( entry != m_lastSelectedEntry )
 		{
-			// New non-root entry. It is possible (for some buggy CHMs) that there is no previous entry: previoous entry had indent 1,
-			// and next entry has indent 3. Backtracking it up, creating missing entries.
-			if ( rootentry[indent-1] == 0 )
-				qFatal("Child entry indented as %d with no root entry!", indent);
+			m_lastSelectedEntry = entry;
 
-			item = new TreeItem_Index( rootentry[indent-1], lastchild[indent], data[i].name, data[i].urls, data[i].seealso );
+			if ( entry != -1 )
+				showEntry( entry );
 		}
+	}
 
-		// Make it open
-		item->setExpanded( true );
+	return success;
+}
 
-		lastchild[indent] = item;
-		rootentry[indent] = item;
+void TabIndex::expandEntries( int first )
+{
+	for ( int e = first; e < m_model->entryCount(); e++ )
+	{
+		if ( m_model->childCount( e ) > 0 )
+			tree->expand( m_model->indexOf( e ) );
 	}
+}
+
+void TabIndex::showEntry( int entry )
+{
+	QModelIndex index = m_model->indexOf( entry );
 
-	tree->update();
+	tree->setCurrentIndex( index );
+	tree->scrollTo( index );
+}
+
+QUrl TabIndex::getUrl( int entry ) const
+{
+	QList<QUrl> urls = m_model->entryUrls( entry );
+
+	if ( urls.size() == 1 )
+		return urls.front();
+
+	// Create a dialog with URLs, and show it, so user can select an URL he/she wants.
+	QStringList titles;
+	EBook * xchm = ::mainWindow->chmFile();
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		QString title = xchm->getTopicByUrl( urls[i] );
+
+		if ( title.isEmpty() )
+		{
+			qWarning( "Could not get item name for url '%s'", qPrintable( urls[i].toString() ) );
+			titles.push_back(QString::null);
+		}
+		else
+			titles.push_back(title);
+	}
+
+	DialogChooseUrlFromList dlg( ::mainWindow );
+	return dlg.getSelectedItemUrl( urls, titles );
 }
 
 void TabIndex::search( const QString & index )
@@ -228,11 +413,8 @@ void TabIndex::search( const QString & index )
 	if ( !::mainWindow->chmFile() )
 		return;
 
-	if ( !m_indexListFilled )
-	{
-		m_indexListFilled = true;
-		refillIndex();
-	}
+	// If the index is still loading, the text is looked up when it is loaded
+	refillIndex();
 
 	text->setText( index );
 	onTextChanged( index );
@@ -246,11 +428,11 @@ void TabIndex::focus()
 
 void TabIndex::onContextMenuRequested(const QPoint & point)
 {
-	TreeItem_Index * treeitem = (TreeItem_Index *) tree->itemAt( point );
+	int entry = m_model->entry( tree->indexAt( point ) );
 	
-	if( treeitem )
+	if( entry != -1 )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
+		::mainWindow->currentBrowser()->setTabKeeper( getUrl( entry ) );
 		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
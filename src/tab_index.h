@@ -20,15 +20,21 @@
 #define TAB_INDEX_H
 
 
+#include <QSharedPointer>
+
 #include "kde-qt.h"
+#include "indexmodel.h"
 #include "ui_tab_index.h"
 
+class IndexLoad;
+class IndexLoadTarget;
 
 class TabIndex : public QWidget, public Ui::TabIndex
 {
 	Q_OBJECT
 	public:
 		TabIndex( QWidget * parent = 0 );
+		~TabIndex();
 	
 		void	invalidate();
 		void	search( const QString& index );
@@ -37,17 +43,39 @@ class TabIndex : public QWidget, public Ui::TabIndex
 	private slots:
 		void 	onTextChanged ( const QString & newvalue);
 		void 	onReturnPressed ();
-		void	onItemActivated ( QTreeWidgetItem * item, int column );
+		void	onItemActivated ( const QModelIndex& index );
 		void	onContextMenuRequested ( const QPoint &point );
+		void	onIndexBatch( int serial );
+		void	onIndexLoaded( int serial );
+
+		// Starts loading the index, unless it is loaded or being loaded already
+		void	refillIndex();
 		
 	private:
 		void	showEvent ( QShowEvent * );
 		
-		void	refillIndex();
+		void	showEntry( int entry );
+
+		// Appends the blocks of the index being loaded which are received so far, and looks up the typed
+		// text in them. Returns false if the loading failed.
+		bool	appendLoadedBlocks();
+
+		// Expands the entries from \param first on which have children
+		void	expandEntries( int first );
+
+		// Returns the entry URL; if there are several, asks the user to choose one
+		QUrl	getUrl( int entry ) const;
 		
 		QMenu 			* 	m_contextMenu;	
-		QTreeWidgetItem	*	m_lastSelectedItem;
+		IndexModel		*	m_model;
+		int					m_lastSelectedEntry;
 		bool				m_indexListFilled;
+
+		// The ebook index is parsed in the global thread pool; only the result of the last load is used.
+		// The loads are not waited for, they notify the tab through the target, which is reset when it is destroyed.
+		QSharedPointer<IndexLoad>	m_load;
+		QSharedPointer<IndexLoadTarget>	m_loadTarget;
+		int					m_loadSerial;
 };
 
 #endif
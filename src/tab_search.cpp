@@ -17,49 +17,117 @@
  */
 
 #include <QHeaderView>
+#include <QStyledItemDelegate>
+#include <QTextDocument>
+#include <QAbstractTextDocumentLayout>
+#include <QPainter>
+#include <QRunnable>
+#include <QDirIterator>
+#include <QSaveFile>
 
 #include "mainwindow.h"
 #include "config.h"
+#include "cachestore.h"
 #include "tab_search.h"
 #include "ebook_search.h"
+#include "ebook_library_search.h"
+#include "searchresultsmodel.h"
 
 
-class SearchTreeViewItem : public QTreeWidgetItem
+// The results are shown in pages as the view is scrolled, so all of them are returned
+static const unsigned int RESULTS_LIMIT = 0xFFFFFFFF;
+
+// How long the search as you type query may run, in milliseconds
+static const int LIVE_QUERY_TIME_BUDGET = 300;
+
+
+// Draws the snippet HTML, so the matched terms are marked
+class SearchSnippetDelegate : public QStyledItemDelegate
 {
 	public:
-		SearchTreeViewItem( QTreeWidget * tree, const QString& name, const QUrl& url )
-			:	QTreeWidgetItem( tree ), m_name( name ), m_url( url ) {}
-	
-		QUrl	getUrl() const { return m_url; }
-	
-	protected:
-		// Overriden members
-		int columnCount () const	{ return 2; }
-	
-		// Overriden member
-		QVariant data ( int column, int role ) const
+		SearchSnippetDelegate( QObject * parent ) : QStyledItemDelegate( parent ) {}
+
+		void paint( QPainter * painter, const QStyleOptionViewItem& option, const QModelIndex& index ) const
 		{
-			switch( role )
-			{
-				// Item name
-				case Qt::DisplayRole:
-				case Qt::ToolTipRole:
-				case Qt::WhatsThisRole:
-				if ( column == 0 )
-					return m_name;
-				else
-					return m_url.path();
-			}
-			
-			return QVariant();
+			QStyleOptionViewItem opt = option;
+			initStyleOption( &opt, index );
+
+			QString html = opt.text;
+			opt.text = QString();
+
+			// Draw the background and selection
+			QStyle * style = opt.widget ? opt.widget->style() : QApplication::style();
+			style->drawControl( QStyle::CE_ItemViewItem, &opt, painter, opt.widget );
+
+			QTextDocument doc;
+			doc.setDefaultFont( opt.font );
+			doc.setDocumentMargin( 0 );
+			doc.setHtml( html );
+
+			QAbstractTextDocumentLayout::PaintContext ctx;
+
+			if ( opt.state & QStyle::State_Selected )
+				ctx.palette.setColor( QPalette::Text, opt.palette.color( QPalette::Active, QPalette::HighlightedText ) );
+			else
+				ctx.palette.setColor( QPalette::Text, opt.palette.color( QPalette::Active, QPalette::Text ) );
+
+			QRect textrect = style->subElementRect( QStyle::SE_ItemViewItemText, &opt, opt.widget );
+
+			painter->save();
+			painter->translate( textrect.topLeft() );
+			painter->setClipRect( textrect.translated( -textrect.topLeft() ) );
+			doc.documentLayout()->draw( painter, ctx );
+			painter->restore();
 		}
-	
-	private:
-		QString		m_name;		
-		QUrl		m_url;
 };
 
 
+// The state of the search as you type query, shared between the worker and the tab
+class SearchLiveQuery
+{
+	public:
+		SearchLiveQuery( int serial_, const QString& query_, const QtAs::DocIdSet * scope_ )
+			: serial( serial_ ), query( query_ ), scoped( scope_ != 0 ), control( LIVE_QUERY_TIME_BUDGET ), success( false )
+		{
+			if ( scope_ )
+				scope = *scope_;
+		}
+
+		int						serial;
+		QString					query;
+		QtAs::DocIdSet			scope;
+		bool					scoped;
+		QtAs::QueryControl		control;
+		QList<QUrl>				results;
+		bool					success;
+};
+
+
+// Runs the query in the thread pool, and notifies the tab when done
+class SearchLiveQueryRunner : public QRunnable
+{
+	public:
+		SearchLiveQueryRunner( TabSearch * tab, EBookSearch * engine, QSharedPointer<SearchLiveQuery> query )
+			: m_tab( tab ), m_engine( engine ), m_query( query ) {}
+
+		void run()
+		{
+			if ( m_query->control.isCancelled() )
+				return;
+
+			m_query->success = m_engine->searchQuery( m_query->query, &m_query->results, 0, RESULTS_LIMIT, &m_query->control, true,
+													  m_query->scoped ? &m_query->scope : 0 );
+
+			if ( !m_query->control.isCancelled() )
+				QMetaObject::invokeMethod( m_tab, "onLiveQueryFinished", Qt::QueuedConnection, Q_ARG( int, m_query->serial ) );
+		}
+
+	private:
+		TabSearch					*	m_tab;
+		EBookSearch					*	m_engine;
+		QSharedPointer<SearchLiveQuery>	m_query;
+};
+
 
 TabSearch::TabSearch( QWidget * parent )
 	: QWidget( parent ), Ui::TabSearch()
@@ -79,26 +147,38 @@ TabSearch::TabSearch( QWidget * parent )
 			 this, 
 			 SLOT( onReturnPressed() ) );
 
+	// Typing in the combo box line edit
+	connect( searchBox->lineEdit(),
+			 SIGNAL( textEdited( const QString & ) ),
+			 this,
+			 SLOT( onTextEdited( const QString & ) ) );
+
 	// Pressing 'Return' in the combo box line edit
 	connect( searchBox->lineEdit(), 
 			 SIGNAL( returnPressed() ), 
 			 this, 
 			 SLOT( onReturnPressed() ) );
 	
+	m_results = new SearchResultsModel( this );
+	tree->setModel( m_results );
+
+	// All the rows have the same height, so the view does not need to lay out the rows it does not show
+	tree->setUniformRowHeights( true );
+
 	// Clicking on tree element
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked( const QModelIndex & ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( const QModelIndex & ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated( const QModelIndex & ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( const QModelIndex & ) ) );
     }
 
 	// Activate custom context menu, and connect it
@@ -108,20 +188,59 @@ TabSearch::TabSearch( QWidget * parent )
 			 this, 
 			 SLOT( onContextMenuRequested( const QPoint & ) ) );
 
+	// The library search and the document scan cannot be used together
+	connect( cbSearchLibrary,
+			 SIGNAL( toggled( bool ) ),
+			 this,
+			 SLOT( onSearchModeToggled( bool ) ) );
+
+	connect( cbScanDocuments,
+			 SIGNAL( toggled( bool ) ),
+			 this,
+			 SLOT( onSearchModeToggled( bool ) ) );
+
+	tree->setItemDelegateForColumn( SearchResultsModel::COLUMN_SNIPPET, new SearchSnippetDelegate( tree ) );
+
 	focus();
 	
 	m_contextMenu = 0;
 	m_genIndexProgress = 0;
 	m_searchEngineInitDone = false;
 	
+	m_liveQuerySerial = 0;
+	m_liveQueryPool.setMaxThreadCount( 1 );
+
+	m_librarySearch = 0;
+	m_libraryProgress = 0;
+
+	m_scanProgress = 0;
+	m_scanControl = 0;
+	m_scanResults = 0;
+
+	m_searchScope = 0;
+	cbSearchScope->hide();
+
 	m_searchEngine = new EBookSearch();
 	connect( m_searchEngine, SIGNAL( progressStep( int, const QString& ) ), this, SLOT( onProgressStep( int, const QString& ) ) );
+	connect( m_searchEngine, SIGNAL( scanMatch( const QUrl&, int, const QString& ) ), this, SLOT( onScanMatch( const QUrl&, int, const QString& ) ) );
+}
+
+
+TabSearch::~TabSearch()
+{
+	cancelLiveQuery();
+	m_liveQueryPool.waitForDone();
+
+	delete m_searchEngine;
+	delete m_librarySearch;
+	delete m_searchScope;
 }
 
 
 void TabSearch::invalidate( )
 {
-	tree->clear();
+	cancelLiveQuery();
+	m_results->clear();
 	searchBox->clear();
 	searchBox->lineEdit()->clear();
 	
@@ -129,6 +248,39 @@ void TabSearch::invalidate( )
 	m_genIndexProgress = 0;
 	
 	m_searchEngineInitDone = false;
+
+	// The sections of the previous ebook
+	m_scopeUrls.clear();
+	delete m_searchScope;
+	m_searchScope = 0;
+	cbSearchScope->hide();
+}
+
+
+void TabSearch::setSearchScope( const QString& title, const QList<QUrl>& urls )
+{
+	m_scopeUrls = urls;
+	delete m_searchScope;
+	m_searchScope = 0;
+
+	cbSearchScope->setText( i18n( "Search only in \"%1\"" ) .arg( title ) );
+	cbSearchScope->setChecked( true );
+	cbSearchScope->show();
+
+	m_results->clear();
+	searchBox->lineEdit()->selectAll();
+}
+
+
+const QtAs::DocIdSet * TabSearch::searchScope()
+{
+	if ( m_scopeUrls.isEmpty() || !cbSearchScope->isChecked() )
+		return 0;
+
+	if ( !m_searchScope )
+		m_searchScope = new QtAs::DocIdSet( m_searchEngine->documentSet( m_scopeUrls ) );
+
+	return m_searchScope;
 }
 
 
@@ -140,40 +292,309 @@ void TabSearch::onReturnPressed( )
 	if ( text.isEmpty() )
 		return;
 	
-	tree->clear();
+	cancelLiveQuery();
+	m_results->clear();
 	
-	if ( searchQuery( text, &results ) )
+	if ( cbSearchLibrary->isChecked() )
 	{
-		if ( !results.empty() )
-		{
-			for ( int i = 0; i < results.size(); i++ )
-			{
-				SearchTreeViewItem * item = new SearchTreeViewItem ( tree,
-																	 ::mainWindow->chmFile()->getTopicByUrl( results[i] ),
-																	 results[i] );
+		searchLibrary( text );
+		return;
+	}
 
-				if ( i == 0 )
-					tree->setCurrentItem( item );
-			}
+	if ( cbScanDocuments->isChecked() )
+	{
+		scanDocuments( text );
+		return;
+	}
 
-			::mainWindow->showInStatusBar( i18n( "Search returned %1 result(s)" ) . arg(results.size()) );
+	if ( searchQuery( text, &results, true, RESULTS_LIMIT ) )
+	{
+		showResults( results, text, false );
+
+		if ( !results.empty() )
 			tree->setFocus();
-		}
-		else
-			::mainWindow->showInStatusBar( i18n( "Search returned no results") );
 	}
 	else
 		::mainWindow->showInStatusBar( i18n( "Search failed") );
 }
 
 
-void TabSearch::onItemActivated( QTreeWidgetItem * item, int )
+void TabSearch::onTextEdited( const QString & text )
+{
+	cancelLiveQuery();
+
+	// The library search may need to read many indexes, and the scan reads all the documents,
+	// so they are only started explicitly
+	if ( text.trimmed().isEmpty() || cbSearchLibrary->isChecked() || cbScanDocuments->isChecked() )
+		return;
+
+	// Do not generate the index while typing; it is done when the search is started explicitly
+	if ( !m_searchEngineInitDone && !loadSearchIndex() )
+		return;
+
+	if ( !m_searchEngine->hasIndex() )
+		return;
+
+	m_liveQuery = QSharedPointer<SearchLiveQuery>( new SearchLiveQuery( ++m_liveQuerySerial, text, searchScope() ) );
+	m_liveQueryPool.start( new SearchLiveQueryRunner( this, m_searchEngine, m_liveQuery ) );
+}
+
+
+void TabSearch::onLiveQueryFinished( int serial )
+{
+	// Was it superseded by a newer query?
+	if ( !m_liveQuery || m_liveQuery->serial != serial )
+		return;
+
+	QSharedPointer<SearchLiveQuery> query = m_liveQuery;
+	m_liveQuery.clear();
+
+	// The query is not complete yet (like an unterminated phrase); keep the previous results
+	if ( !query->success )
+		return;
+
+	m_results->clear();
+	showResults( query->results, query->query, true );
+
+	if ( query->control.isTimedOut() )
+		::mainWindow->showInStatusBar( i18n( "Search returned %1 result(s); the search took too long and was stopped" ) . arg(query->results.size()) );
+}
+
+
+void TabSearch::cancelLiveQuery()
+{
+	if ( m_liveQuery )
+	{
+		m_liveQuery->control.cancel();
+		m_liveQuery.clear();
+	}
+}
+
+
+void TabSearch::showResults( const QList<QUrl>& results, const QString& query, bool lastTermIsPrefix )
+{
+	// The titles and snippets are made when the rows are shown
+	m_results->setResults( results, m_searchEngine, query, lastTermIsPrefix );
+
+	if ( !results.empty() )
+	{
+		tree->setCurrentIndex( m_results->index( 0, 0 ) );
+		::mainWindow->showInStatusBar( i18n( "Search returned %1 result(s)" ) . arg(results.size()) );
+	}
+	else
+		::mainWindow->showInStatusBar( i18n( "Search returned no results") );
+}
+
+
+bool TabSearch::initLibrarySearch()
+{
+	if ( pConfig->m_advLibraryPath.isEmpty() )
+	{
+		QMessageBox::information( this,
+								  i18n( "Library search" ),
+								  i18n( "The directory with the ebooks is not set. Please set it in the Advanced settings." ) );
+		return false;
+	}
+
+	if ( !m_librarySearch )
+	{
+		m_librarySearch = new EBookLibrarySearch();
+		connect( m_librarySearch, SIGNAL( queryProgress( int, int ) ), this, SLOT( onLibraryQueryProgress( int, int ) ) );
+		connect( m_librarySearch, SIGNAL( queryFinished( bool ) ), this, SLOT( onLibraryQueryFinished( bool ) ) );
+		connect( m_librarySearch, SIGNAL( indexLoaded( const QString& ) ), this, SLOT( onLibraryIndexLoaded( const QString& ) ) );
+	}
+
+	m_librarySearch->setMemoryBudget( (qint64) pConfig->m_advLibraryMemory * 1024 * 1024 );
+
+	if ( m_libraryPath == pConfig->m_advLibraryPath )
+		return true;
+
+	// The library directory has changed; find the ebooks in it
+	ShowWaitCursor waitcursor;
+
+	m_librarySearch->clear();
+	m_libraryPath = pConfig->m_advLibraryPath;
+
+	QDirIterator it( m_libraryPath, QStringList() << "*.chm" << "*.epub", QDir::Files, QDirIterator::Subdirectories );
+
+	while ( it.hasNext() )
+	{
+		QString ebookfile = it.next();
+		m_librarySearch->addBook( ebookfile, pConfig->getEbookIndexFile( ebookfile ) );
+	}
+
+	return true;
+}
+
+
+void TabSearch::searchLibrary( const QString& query )
+{
+	if ( !initLibrarySearch() )
+		return;
+
+	// The query runs in the background; it could be cancelled from the progress dialog
+	if ( !m_libraryProgress )
+	{
+		m_libraryProgress = new QProgressDialog( this );
+		m_libraryProgress->setWindowTitle( i18n( "Library search" ) );
+		m_libraryProgress->setLabelText( i18n( "Searching in the library..." ) );
+		m_libraryProgress->setMinimumDuration( 500 );
+		connect( m_libraryProgress, SIGNAL( canceled() ), this, SLOT( onLibraryQueryCanceled() ) );
+	}
+
+	m_libraryQuery = query;
+	m_libraryProgress->setMaximum( m_librarySearch->bookCount() );
+	m_libraryProgress->setValue( 0 );
+
+	m_librarySearch->startQuery( query );
+}
+
+
+void TabSearch::onLibraryQueryProgress( int searched, int total )
+{
+	m_libraryProgress->setMaximum( total );
+	m_libraryProgress->setValue( searched );
+}
+
+
+void TabSearch::onLibraryIndexLoaded( const QString& indexfile )
+{
+	// Only the books actually searched are marked as used, so the cache store evicts the others first
+	pConfig->cacheStore()->touchFile( indexfile );
+}
+
+
+void TabSearch::onLibraryQueryCanceled()
+{
+	m_librarySearch->cancelQuery();
+	m_libraryProgress->reset();
+	::mainWindow->showInStatusBar( i18n( "Search cancelled") );
+}
+
+
+void TabSearch::onLibraryQueryFinished( bool success )
+{
+	m_libraryProgress->reset();
+
+	if ( !success )
+	{
+		::mainWindow->showInStatusBar( i18n( "Search failed") );
+		return;
+	}
+
+	QList< EBookLibrarySearch::Result > results = m_librarySearch->queryResults();
+	m_results->setLibraryResults( results, m_librarySearch, m_libraryQuery );
+
+	if ( !results.isEmpty() )
+		tree->setCurrentIndex( m_results->index( 0, 0 ) );
+
+	if ( results.isEmpty() )
+		::mainWindow->showInStatusBar( i18n( "Search returned no results") );
+	else
+	{
+		::mainWindow->showInStatusBar( i18n( "Search in %1 book(s) returned %2 result(s)" ) . arg( m_librarySearch->bookCount() ) . arg( results.size() ) );
+		tree->setFocus();
+	}
+}
+
+
+void TabSearch::scanDocuments( const QString& text )
+{
+	// The scan is already running; the progress dialog blocks the input, but not the queued searches
+	if ( m_scanControl )
+		return;
+
+	QtAs::QueryControl control;
+	QProgressDialog progress( this );
+
+	// Modal, so the ebook could not be closed while the scan is running, but it could be cancelled.
+	// It is shown right away, as the window is not blocked until then.
+	progress.setWindowModality( Qt::WindowModal );
+	progress.setWindowTitle( i18n( "Scanning the documents..." ) );
+	progress.setLabelText( i18n( "Scanning the documents..." ) );
+	progress.setMaximum( 100 );
+	progress.setMinimumDuration( 0 );
+	progress.show();
+	progress.setValue( 0 );
+
+	m_scanProgress = &progress;
+	m_scanControl = &control;
+	m_scanResults = 0;
+
+	bool completed = m_searchEngine->scanQuery( ::mainWindow->chmFile(), text, false, &control );
+
+	// Deliver the matches found by the last tasks
+	qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
+
+	m_scanProgress = 0;
+	m_scanControl = 0;
+
+	if ( !completed && !control.isCancelled() )
+		::mainWindow->showInStatusBar( i18n( "Search failed") );
+	else if ( !completed )
+		::mainWindow->showInStatusBar( i18n( "The scan was cancelled; %1 result(s) found" ) . arg( m_scanResults ) );
+	else if ( m_scanResults == 0 )
+		::mainWindow->showInStatusBar( i18n( "Search returned no results") );
+	else
+		::mainWindow->showInStatusBar( i18n( "Search returned %1 result(s)" ) . arg( m_scanResults ) );
+
+	if ( m_scanResults > 0 )
+		tree->setFocus();
+}
+
+
+void TabSearch::onScanMatch( const QUrl& url, int count, const QString& snippet )
+{
+	// The match of the scan which is already finished
+	if ( !m_scanControl )
+		return;
+
+	QString title = ::mainWindow->chmFile()->getTopicByUrl( url );
+
+	if ( title.isEmpty() )
+		title = url.path();
+
+	if ( count > 1 )
+		title = i18n( "%1 (%2 matches)" ) . arg( title ) . arg( count );
+
+	m_results->addResult( title, url, snippet );
+
+	if ( m_scanResults++ == 0 )
+		tree->setCurrentIndex( m_results->index( 0, 0 ) );
+}
+
+
+void TabSearch::onSearchModeToggled( bool checked )
+{
+	if ( !checked )
+		return;
+
+	if ( sender() == cbSearchLibrary )
+		cbScanDocuments->setChecked( false );
+	else
+		cbSearchLibrary->setChecked( false );
+}
+
+
+void TabSearch::onItemActivated( const QModelIndex& index )
 {
-	if ( !item )
+	if ( !index.isValid() )
 		return;
 	
-	SearchTreeViewItem * treeitem = (SearchTreeViewItem *) item;
-	::mainWindow->currentBrowser()->openUrl( treeitem->getUrl() );
+	QString ebook = m_results->ebook( index );
+
+	// The library search result from another ebook
+	if ( !ebook.isEmpty() && QFileInfo( ebook ) != QFileInfo( ::mainWindow->getOpenedFileName() ) )
+	{
+		QStringList args;
+		args.push_back( ebook );
+		args.push_back( m_results->url( index ).toString() );
+
+		qApp->postEvent( ::mainWindow, new UserEvent( "loadAndOpen", args ) );
+		return;
+	}
+
+	::mainWindow->currentBrowser()->openUrl( m_results->url( index ) );
 }
 
 
@@ -196,32 +617,47 @@ void TabSearch::saveSettings( Settings::search_saved_settings_t & settings )
 void TabSearch::onHelpClicked( const QString & )
 {
 	QWhatsThis::showText ( mapToGlobal( lblHelp->pos() ),
-		i18n( "<html><p>The improved search engine allows you to search for a word, symbol or phrase, which is set of words and symbols included in quotes. Only the documents which include all the terms specified in th search query are shown; no prefixes needed.<p>Unlike MS CHM internal search index, my improved search engine indexes everything, including special symbols. Therefore it is possible to search (and find!) for something like <i>$q = new ChmFile();</i>. This search also fully supports Unicode, which means that you can search in non-English documents.<p>If you want to search for a quote symbol, use quotation mark instead. The engine treats a quote and a quotation mark as the same symbol, which allows to use them in phrases.</html>") );
+		i18n( "<html><p>The improved search engine allows you to search for a word, symbol or phrase, which is set of words and symbols included in quotes. Only the documents which include all the terms specified in th search query are shown; no prefixes needed.<p>The terms could be combined with <i>OR</i> to find the documents containing any of them, and excluded with <i>NOT</i> or a minus sign, like <i>-word</i>. The parentheses group the terms, like <i>(dialog OR window) -modal</i>. The <i>NEAR/n</i> operator finds the words or phrases which are not more than <i>n</i> words apart, like <i>file NEAR/3 open</i>. The operators must be in upper case.<p>To find the text inside the words, put it in asterisks, like <i>*Buffer*</i>; the regular expressions are put in slashes, like <i>/get\\w+Size/</i>. Both are case insensitive.<p>To search only in a part of the ebook, choose <i>Search in this section</i> in the context menu of the contents tab.<p>To find the text exactly as typed without the search index, check <i>Scan the documents for the exact text</i>; this reads every document of the ebook, so it is slower.<p>Unlike MS CHM internal search index, my improved search engine indexes everything, including special symbols. Therefore it is possible to search (and find!) for something like <i>$q = new ChmFile();</i>. This search also fully supports Unicode, which means that you can search in non-English documents.<p>If you want to search for a quote symbol, use quotation mark instead. The engine treats a quote and a quotation mark as the same symbol, which allows to use them in phrases.</html>") );
 }
 
 
-bool TabSearch::initSearchEngine( )
+bool TabSearch::loadSearchIndex()
 {
+	QFile file( ::mainWindow->currentSettings()->searchIndexFile() );
+	
+	if ( !file.open( QIODevice::ReadOnly ) )
+		return false;
+
 	ShowWaitCursor waitcursor;
+
+	// The document numbers of the scope are different in the new index
+	delete m_searchScope;
+	m_searchScope = 0;
 	
-	QString indexfile = ::mainWindow->currentSettings()->searchIndexFile();
+	QDataStream stream( &file );
 	
-	// First try to read the index if exists
-	QFile file( indexfile );
+	::mainWindow->statusBar()->showMessage( i18n( "Reading dictionary..." ) );
+	qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
 	
-	if ( file.open( QIODevice::ReadOnly ) )
-	{
-		QDataStream stream( &file );
-		
-		::mainWindow->statusBar()->showMessage( i18n( "Reading dictionary..." ) );
-		qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
-		
-		if ( m_searchEngine->loadIndex( stream ) )
-		{
-			m_searchEngineInitDone = true;
-			return true;
-		}
-	}
+	if ( !m_searchEngine->loadIndex( stream ) )
+		return false;
+
+	m_searchEngineInitDone = true;
+	return true;
+}
+
+
+bool TabSearch::initSearchEngine( )
+{
+	// First try to read the index if exists
+	if ( loadSearchIndex() )
+		return true;
+
+	ShowWaitCursor waitcursor;
+
+	// The document numbers of the scope are different in the new index
+	delete m_searchScope;
+	m_searchScope = 0;
 	
 	// So the index cannot be read or does not exist. Create a new one.
 	
@@ -237,26 +673,57 @@ bool TabSearch::initSearchEngine( )
 	
 	// Show 'em
 	qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
-		
-	// Since we gonna save it, reopen the file
-	file.close();
+
+	m_searchEngine->setSubstringIndexEnabled( pConfig->m_advSubstringIndex );
+	m_searchEngine->setIndexMemoryBudget( (qint64) pConfig->m_advIndexMemory * 1024 * 1024 );
+
+	// The index read above may be in the read-only system directory, so it is saved into the cache.
+	// It is written to a temporary file first, so an interrupted generation does not leave a broken index.
+	QSaveFile savefile( ::mainWindow->currentSettings()->searchIndexSaveFile() );
 	
-	if ( !file.open( QIODevice::WriteOnly ) )
+	if ( !savefile.open( QIODevice::WriteOnly ) )
 	{
-		QMessageBox::critical( 0, "Cannot save index", tr("The index cannot be saved into file %1") .arg( file.fileName() ) );
+		QMessageBox::critical( 0, "Cannot save index", tr("The index cannot be saved into file %1") .arg( savefile.fileName() ) );
 		return false;
 	}
 	
 	// Run the generation
-	QDataStream stream( &file );
+	QDataStream stream( &savefile );
+
+	// If the ebook has changed, the index of its previous revision is kept; the unchanged documents are copied from it
+	QFile previousfile( ::mainWindow->currentSettings()->previousSearchIndexFile() );
+	QDataStream previousstream( &previousfile );
+	bool hasprevious = previousfile.open( QIODevice::ReadOnly );
 	
-	m_searchEngine->generateIndex( ::mainWindow->chmFile(), stream );
+	bool generated = m_searchEngine->generateIndex( ::mainWindow->chmFile(), stream, hasprevious ? &previousstream : 0 );
 	
 	delete m_genIndexProgress;
 	m_genIndexProgress = 0;
+
+	if ( generated && !savefile.commit() )
+		QMessageBox::critical( 0, "Cannot save index", tr("The index cannot be saved into file %1") .arg( savefile.fileName() ) );
+	else if ( !generated )
+		savefile.cancelWriting();
+	else if ( !m_searchEngine->hasIndex() )
+	{
+		// The index generated with the memory limit is not kept in memory, so it is read back
+		QFile savedfile( savefile.fileName() );
+		QDataStream savedstream( &savedfile );
+
+		if ( savedfile.open( QIODevice::ReadOnly ) )
+			m_searchEngine->loadIndex( savedstream );
+	}
 	
 	if ( m_searchEngine->hasIndex() )
 	{
+		if ( hasprevious )
+		{
+			previousfile.close();
+			previousfile.remove();
+		}
+
+		pConfig->cacheStore()->evict( ::mainWindow->currentSettings()->cacheKey() );
+
 		m_searchEngineInitDone = true;
 		return true;
 	}
@@ -273,7 +740,7 @@ void TabSearch::execSearchQueryInGui( const QString & query )
 }
 
 
-bool TabSearch::searchQuery( const QString & query, QList< QUrl > * results )
+bool TabSearch::searchQuery( const QString & query, QList< QUrl > * results, bool inScope, unsigned int limit )
 {
 	if ( !m_searchEngineInitDone )
 	{
@@ -293,10 +760,21 @@ bool TabSearch::searchQuery( const QString & query, QList< QUrl > * results )
 	ShowWaitCursor waitcursor;
 	bool result;
 	
-	result = m_searchEngine->searchQuery( query, results, ::mainWindow->chmFile() );
+	result = m_searchEngine->searchQuery( query, results, ::mainWindow->chmFile(), limit, 0, false, inScope ? searchScope() : 0 );
 	return result;
 }
 
+bool TabSearch::runBenchmark()
+{
+	if ( !m_searchEngineInitDone )
+	{
+		if ( !initSearchEngine() )
+			return false;
+	}
+
+	return m_searchEngine->runBenchmark();
+}
+
 void TabSearch::focus()
 {
 	if ( !searchBox->hasFocus() && !tree->hasFocus() )
@@ -305,11 +783,12 @@ void TabSearch::focus()
 
 void TabSearch::onContextMenuRequested( const QPoint & point )
 {
-	SearchTreeViewItem * treeitem = (SearchTreeViewItem *) tree->itemAt( point );
+	QModelIndex index = tree->indexAt( point );
 	
-	if( treeitem )
+	// The pages of other ebooks cannot be opened in the tabs
+	if( index.isValid() && m_results->ebook( index ).isEmpty() )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
+		::mainWindow->currentBrowser()->setTabKeeper( m_results->url( index ) );
 		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
@@ -322,4 +801,15 @@ void TabSearch::onProgressStep(int value, const QString & stepName)
 		m_genIndexProgress->setLabelText( stepName );
 		m_genIndexProgress->setValue( value );
 	}
+
+	if ( m_scanProgress )
+	{
+		m_scanProgress->setValue( value );
+
+		// The scan does not process the user input; the dialog is modal, so only its Cancel button gets here
+		qApp->processEvents();
+
+		if ( m_scanProgress->wasCanceled() )
+			m_scanControl->cancel();
+	}
 }
@@ -19,44 +19,91 @@
 #ifndef TAB_SEARCH_H
 #define TAB_SEARCH_H
 
+#include <QThreadPool>
+#include <QSharedPointer>
+
 #include "kde-qt.h"
 #include "settings.h"
 #include "ui_tab_search.h"
 
 class EBookSearch;
+namespace QtAs { class QueryControl; class DocIdSet; }
+class EBookLibrarySearch;
+class SearchLiveQuery;
+class SearchResultsModel;
 
 class TabSearch : public QWidget, public Ui::TabSearch
 {
 	Q_OBJECT
 	public:
 		TabSearch( QWidget * parent = 0 );
+		~TabSearch();
 	
 		void	invalidate();
 		void	restoreSettings (const Settings::search_saved_settings_t& settings);
 		void	saveSettings( Settings::search_saved_settings_t& settings );
 		void	execSearchQueryInGui( const QString& query );
-		bool	searchQuery(const QString& query, QList<QUrl> *results );
+		bool	searchQuery(const QString& query, QList<QUrl> *results, bool inScope = false, unsigned int limit = 100 );
+		void	setSearchScope( const QString& title, const QList<QUrl>& urls );
+		bool	runBenchmark();
 		void	focus();
 		
 	private slots:
 		void	onContextMenuRequested ( const QPoint &point );
 		void	onHelpClicked( const QString & );
 		void 	onReturnPressed ();
-		void	onItemActivated( QTreeWidgetItem * item, int );
+		void	onItemActivated( const QModelIndex& index );
+		void	onTextEdited( const QString& text );
+		void	onLiveQueryFinished( int serial );
+		void	onSearchModeToggled( bool checked );
+		void	onScanMatch( const QUrl& url, int count, const QString& snippet );
+		void	onLibraryQueryProgress( int searched, int total );
+		void	onLibraryQueryFinished( bool success );
+		void	onLibraryQueryCanceled();
+		void	onLibraryIndexLoaded( const QString& indexfile );
 		
 		// For index generation
 		void	onProgressStep( int value, const QString& stepName );
 	
 	private:
 		bool	initSearchEngine();
+		bool	loadSearchIndex();	// only reads the existing index, never generates it
+		bool	initLibrarySearch();
+		void	searchLibrary( const QString& query );
+		void	scanDocuments( const QString& text );
+		void	cancelLiveQuery();
+		void	showResults( const QList<QUrl>& results, const QString& query, bool lastTermIsPrefix );
+		const QtAs::DocIdSet *	searchScope();
 		
 	private:
 		QMenu			* 	m_contextMenu;
 		EBookSearch		*	m_searchEngine;
+		SearchResultsModel *	m_results;
 		bool				m_searchEngineInitDone;
 		
 		// For index generation
 		QProgressDialog *	m_genIndexProgress;
+
+		// Search as you type; the query runs in the thread pool, and only the last one is shown
+		QThreadPool			m_liveQueryPool;
+		QSharedPointer<SearchLiveQuery>	m_liveQuery;
+		int					m_liveQuerySerial;
+
+		// Search in all the ebooks in the library directory; created when first used
+		EBookLibrarySearch *	m_librarySearch;
+		QString				m_libraryPath;
+		QString				m_libraryQuery;		// the running query
+		QProgressDialog *	m_libraryProgress;
+
+		// Scanning the documents without the index; set while the scan is running
+		QProgressDialog *	m_scanProgress;
+		QtAs::QueryControl *	m_scanControl;
+		int					m_scanResults;
+
+		// The search could be limited to a contents section; the document set is made from the URLs
+		// when first used with the current index
+		QList<QUrl>			m_scopeUrls;
+		QtAs::DocIdSet	*	m_searchScope;
 };
 
 #endif
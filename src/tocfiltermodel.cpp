@@ -0,0 +1,62 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "tocmodel.h"
+#include "tocfiltermodel.h"
+
+
+TocFilterModel::TocFilterModel( TocModel * toc, QObject * parent )
+	: QAbstractListModel( parent ), m_toc( toc )
+{
+}
+
+
+void TocFilterModel::setEntries( const QVector<int>& entries )
+{
+	beginResetModel();
+	m_entries = entries;
+	endResetModel();
+}
+
+
+int TocFilterModel::entry( const QModelIndex& index ) const
+{
+	if ( !index.isValid() || index.row() >= m_entries.size() )
+		return -1;
+
+	return m_entries[ index.row() ];
+}
+
+
+int TocFilterModel::rowCount( const QModelIndex& parent ) const
+{
+	return parent.isValid() ? 0 : m_entries.size();
+}
+
+
+QVariant TocFilterModel::data( const QModelIndex& index, int role ) const
+{
+	int e = entry( index );
+
+	if ( e == -1 )
+		return QVariant();
+
+	// The same name and icon as in the tree
+	return m_toc->data( m_toc->indexOf( e ), role );
+}
@@ -0,0 +1,53 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TOCFILTERMODEL_H
+#define TOCFILTERMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+class TocModel;
+
+//! The table of contents entries matching the filter typed in the contents tab, as a flat list.
+//! The names and icons are taken from the contents model.
+class TocFilterModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+	public:
+		TocFilterModel( TocModel * toc, QObject * parent );
+
+		//! Replaces the shown entries; these are the TOC entry numbers
+		void		setEntries( const QVector<int>& entries );
+		const QVector<int>&	entries() const { return m_entries; }
+
+		//! Returns the TOC entry shown at the \param index, or -1
+		int			entry( const QModelIndex& index ) const;
+
+		// Overridden methods
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		QVariant	data( const QModelIndex& index, int role ) const;
+
+	private:
+		TocModel	*	m_toc;
+		QVector<int>	m_entries;
+};
+
+#endif // TOCFILTERMODEL_H
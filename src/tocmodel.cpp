@@ -0,0 +1,398 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QHash>
+
+#include "mainwindow.h"
+#include "tocmodel.h"
+
+
+// Returns the bit of the character class in the name masks: a letter, a digit, or a group of other characters
+static inline quint64 charMask( QChar ch )
+{
+	ushort code = ch.unicode();
+
+	if ( code >= 'a' && code <= 'z' )
+		return Q_UINT64_C(1) << (code - 'a');
+
+	if ( code >= '0' && code <= '9' )
+		return Q_UINT64_C(1) << (26 + code - '0');
+
+	return Q_UINT64_C(1) << (36 + code % 28);
+}
+
+
+// A filtered entry; the better matches go first, and the same ones in the TOC order
+struct FilterMatch
+{
+	FilterMatch( int e, int s ) : entry( e ), score( s ) {}
+	FilterMatch() : entry( -1 ), score( 0 ) {}
+
+	bool operator<( const FilterMatch& m ) const
+	{
+		return score > m.score || (score == m.score && entry < m.entry);
+	}
+
+	int		entry;
+	int		score;
+};
+
+
+// Makes sure the path starts with /; the URLs in some TOCs are relative, and in others absolute
+static QString absolutePath( const QUrl& url )
+{
+	QString path = url.path();
+
+	if ( !path.startsWith( '/' ) )
+		path.prepend( '/' );
+
+	return path;
+}
+
+
+TocModel::TocModel( QObject * parent )
+	: FlatTreeModel( parent )
+{
+}
+
+
+void TocModel::clear()
+{
+	beginResetModel();
+
+	m_nameOffset.clear();
+	m_urlId.clear();
+	m_image.clear();
+	m_expanded.clear();
+	m_names.clear();
+	m_lowerNames.clear();
+	m_charMasks.clear();
+	m_urls.clear();
+	m_urlEntries.clear();
+	m_pathEntries.clear();
+
+	setIndents( QVector<int>() );
+
+	endResetModel();
+}
+
+
+void TocModel::setEntries( const QList< EBookTocEntry >& data )
+{
+	beginResetModel();
+
+	int count = data.size();
+	QVector<int> indents( count );
+
+	m_urlId.resize( count );
+	m_image.resize( count );
+	m_expanded.fill( false, count );
+	m_nameOffset.clear();
+	m_nameOffset.reserve( count + 1 );
+	m_names.clear();
+	m_urls.clear();
+
+	m_urlEntries.clear();
+	m_pathEntries.clear();
+
+	for ( int i = 0; i < count; i++ )
+	{
+		indents[i] = data[i].indent;
+		m_image[i] = data[i].iconid;
+
+		m_nameOffset.push_back( m_names.size() );
+		m_names += data[i].name;
+
+		// Many entries point to the same page; the URL is stored once
+		QHash<QUrl, qint32>::const_iterator it = m_urlEntries.constFind( data[i].url );
+
+		if ( it == m_urlEntries.constEnd() )
+		{
+			m_urlId[i] = m_urls.size();
+			m_urls.push_back( data[i].url );
+			addUrlEntry( i );
+		}
+		else
+			m_urlId[i] = m_urlId[ it.value() ];
+	}
+
+	m_nameOffset.push_back( m_names.size() );
+	m_names.squeeze();
+
+	buildFilterData();
+	setIndents( indents );
+
+	endResetModel();
+}
+
+
+// Maps the URL of the entry, and its path without the fragment, to the entry, unless there is an earlier one
+void TocModel::addUrlEntry( int entry )
+{
+	QUrl url = entryUrl( entry );
+
+	if ( m_urlEntries.contains( url ) )
+		return;
+
+	m_urlEntries.insert( url, entry );
+
+	QString path = absolutePath( url );
+
+	if ( !m_pathEntries.contains( path ) )
+		m_pathEntries.insert( path, entry );
+}
+
+
+void TocModel::writeEntries( QDataStream& stream ) const
+{
+	stream << m_nameOffset << m_urlId << m_image << m_names << m_urls;
+}
+
+
+bool TocModel::readEntries( QDataStream& stream, int count )
+{
+	stream >> m_nameOffset >> m_urlId >> m_image >> m_names >> m_urls;
+
+	if ( m_nameOffset.size() != count + 1 || m_urlId.size() != count || m_image.size() != count
+	|| m_nameOffset[count] != m_names.size() )
+		return false;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( m_nameOffset[i] < 0 || m_nameOffset[i] > m_nameOffset[i + 1] || m_urlId[i] < 0 || m_urlId[i] >= m_urls.size() )
+			return false;
+	}
+
+	m_expanded.fill( false, count );
+	m_urlEntries.clear();
+	m_pathEntries.clear();
+
+	for ( int i = 0; i < count; i++ )
+		addUrlEntry( i );
+
+	buildFilterData();
+	return true;
+}
+
+
+void TocModel::buildFilterData()
+{
+	// Lowered character by character, so the names keep their offsets
+	m_lowerNames.resize( m_names.size() );
+	m_charMasks.fill( 0, m_nameOffset.size() - 1 );
+
+	const QChar * src = m_names.constData();
+	QChar * dst = m_lowerNames.data();
+
+	for ( int i = 0; i < m_charMasks.size(); i++ )
+	{
+		quint64 mask = 0;
+
+		for ( int pos = m_nameOffset[i]; pos < m_nameOffset[i + 1]; pos++ )
+		{
+			dst[pos] = src[pos].toLower();
+			mask |= charMask( dst[pos] );
+		}
+
+		m_charMasks[i] = mask;
+	}
+}
+
+
+bool TocModel::filterMatch( int entry, const QString& text, const QString& letters, quint64 mask, int& score ) const
+{
+	// All the characters of the text must be in the name; this check rejects most names
+	if ( (m_charMasks[entry] & mask) != mask )
+		return false;
+
+	const QChar * name = m_lowerNames.constData() + m_nameOffset[entry];
+	int length = m_nameOffset[entry + 1] - m_nameOffset[entry];
+	int pos = 0, last = -1;
+
+	score = 0;
+
+	// Matching the letters in order, as early as possible
+	for ( int i = 0; i < letters.size(); i++ )
+	{
+		while ( pos < length && name[pos] != letters[i] )
+			pos++;
+
+		if ( pos == length )
+			return false;
+
+		if ( pos == 0 || !name[pos - 1].isLetterOrNumber() )
+			score += 10;
+
+		if ( last != -1 )
+		{
+			if ( pos == last + 1 )
+				score += 5;
+			else
+				score -= qMin( pos - last - 1, 5 );
+		}
+
+		last = pos++;
+	}
+
+	// The exact substring is the best, especially at the start
+	int found = QString::fromRawData( name, length ).indexOf( text );
+
+	if ( found == 0 )
+		score += 40;
+	else if ( found > 0 )
+		score += 20;
+
+	// Among the same matches the shorter names are closer
+	score -= length / 16;
+	return true;
+}
+
+
+QVector<int> TocModel::filterEntries( const QString& text, const QVector<int> * candidates ) const
+{
+	QVector<int> result;
+	QString lowered, letters;
+	quint64 mask = 0;
+
+	for ( int i = 0; i < text.size(); i++ )
+	{
+		QChar ch = text[i].toLower();
+		lowered.append( ch );
+
+		if ( !ch.isSpace() )
+		{
+			letters.append( ch );
+			mask |= charMask( ch );
+		}
+	}
+
+	if ( letters.isEmpty() )
+		return result;
+
+	lowered = lowered.trimmed();
+
+	QVector<FilterMatch> matches;
+	int count = candidates ? candidates->size() : entryCount();
+
+	for ( int i = 0; i < count; i++ )
+	{
+		int entry = candidates ? (*candidates)[i] : i;
+		int score;
+
+		if ( filterMatch( entry, lowered, letters, mask, score ) )
+			matches.push_back( FilterMatch( entry, score ) );
+	}
+
+	qSort( matches );
+	result.resize( matches.size() );
+
+	for ( int i = 0; i < matches.size(); i++ )
+		result[i] = matches[i].entry;
+
+	return result;
+}
+
+
+QString TocModel::entryName( int entry ) const
+{
+	return m_names.mid( m_nameOffset[entry], m_nameOffset[entry + 1] - m_nameOffset[entry] );
+}
+
+
+int TocModel::findEntry( const QUrl& url, bool ignorefragment ) const
+{
+	// This is called on every page change, so both lookups are hashed
+	if ( ignorefragment )
+		return m_pathEntries.value( absolutePath( url ), -1 );
+
+	return m_urlEntries.value( url, -1 );
+}
+
+
+void TocModel::setExpanded( const QModelIndex& index, bool expanded )
+{
+	int e = entry( index );
+
+	if ( e == -1 )
+		return;
+
+	m_expanded.setBit( e, expanded );
+	emit dataChanged( index, index );
+}
+
+
+void TocModel::setAllExpanded()
+{
+	int rows = rowCount( QModelIndex() );
+
+	if ( rows == 0 )
+		return;
+
+	m_expanded.fill( true );
+
+	// The view repaints everything for a range, so the nested entries need no signals of their own
+	emit dataChanged( index( 0, 0 ), index( rows - 1, 0 ) );
+}
+
+
+QVariant TocModel::data( const QModelIndex& index, int role ) const
+{
+	int e = entry( index );
+	int imagenum;
+
+	if ( e == -1 )
+		return QVariant();
+
+	switch( role )
+	{
+		// Item name
+		case Qt::DisplayRole:
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			return entryName( e );
+
+		// Item image
+		case Qt::DecorationRole:
+			if ( m_image[e] != EBookTocEntry::IMAGE_NONE )
+			{
+				int image = m_image[e];
+
+				// If the item has children, we change the book image to "open book", or next image automatically
+				if ( childCount( e ) )
+				{
+					if ( m_expanded.testBit( e ) )
+						imagenum = (image == EBookTocEntry::IMAGE_AUTO) ? 1 : image;
+					else
+						imagenum = (image == EBookTocEntry::IMAGE_AUTO) ? 0 : image + 1;
+				}
+				else
+					imagenum = (image == EBookTocEntry::IMAGE_AUTO) ? 10 : image;
+
+				const QPixmap *pix = ::mainWindow->getEBookIconPixmap( (EBookTocEntry::Icon) imagenum );
+
+				if ( !pix || pix->isNull() )
+					abort();
+
+				return *pix;
+			}
+			break;
+	}
+
+	return QVariant();
+}
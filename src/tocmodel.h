@@ -0,0 +1,91 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TOCMODEL_H
+#define TOCMODEL_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QUrl>
+#include <QVector>
+
+#include "ebook.h"
+#include "flattreemodel.h"
+
+//! The table of contents shown in the contents tab. The entries are kept in flat arrays in the TOC order,
+//! so even the contents with a hundred thousand entries take a few megabytes.
+class TocModel : public FlatTreeModel
+{
+	Q_OBJECT
+
+	public:
+		TocModel( QObject * parent );
+
+		//! Replaces the contents; the entries with wrong indents are fixed the same way as before
+		void		setEntries( const QList< EBookTocEntry >& data );
+		void		clear();
+
+		QString		entryName( int entry ) const;
+		QUrl		entryUrl( int entry ) const { return m_urls[ m_urlId[entry] ]; }
+
+		//! Returns the first entry pointing to \param url, or -1. The URL fragment must match too, unless
+		//! \param ignorefragment is set. Both lookups use the hashes built in setEntries().
+		int			findEntry( const QUrl& url, bool ignorefragment ) const;
+
+		//! Returns the entries which names contain the characters of \param text in the same order, ignoring the case
+		//! and the spaces; the best matches first. The consecutive characters, the word starts and the exact substrings
+		//! rank higher. If \param candidates is not null, only those entries are checked; when the text is typed further,
+		//! the previous result could be narrowed this way.
+		QVector<int>	filterEntries( const QString& text, const QVector<int> * candidates = 0 ) const;
+
+		//! The open book icon is shown for the expanded entries; the view should report them
+		void		setExpanded( const QModelIndex& index, bool expanded );
+
+		//! Marks all the entries expanded; QTreeView::expandAll() does not report them one by one
+		void		setAllExpanded();
+
+		// Overridden methods
+		QVariant	data( const QModelIndex& index, int role ) const;
+
+	protected:
+		void		writeEntries( QDataStream& stream ) const;
+		bool		readEntries( QDataStream& stream, int count );
+
+	private:
+		void		addUrlEntry( int entry );
+		void		buildFilterData();
+		bool		filterMatch( int entry, const QString& text, const QString& letters, quint64 mask, int& score ) const;
+
+		// Per entry, in the TOC order
+		QVector<qint32>		m_nameOffset;	// in m_names; one more than the entries
+		QVector<qint32>		m_urlId;		// in m_urls
+		QVector<qint16>		m_image;
+		QBitArray			m_expanded;
+
+		QString				m_names;		// all the names one after another
+		QString				m_lowerNames;	// the same in lower case, for the filter; the offsets are the same
+		QVector<quint64>	m_charMasks;	// the characters each name contains, one bit per character class
+		QVector<QUrl>		m_urls;			// the different URLs
+
+		// The first entry pointing to each URL, and to each path ignoring the fragment
+		QHash<QUrl, qint32>		m_urlEntries;
+		QHash<QString, qint32>	m_pathEntries;
+};
+
+#endif // TOCMODEL_H
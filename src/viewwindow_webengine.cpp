@@ -63,6 +63,7 @@ ViewWindow::ViewWindow( QWidget * parent )
     m_contextMenu = 0;
     m_contextMenuLink = 0;
     m_storedScrollbarPosition = -1; // see header
+    m_scrollPosition = 0;
 
     // All links are going through us
     //page()->setLinkDelegationPolicy( QWebPage::DelegateAllLinks );
@@ -82,6 +83,10 @@ ViewWindow::ViewWindow( QWidget * parent )
 
     connect( this, SIGNAL( loadFinished(bool)), this, SLOT( onLoadFinished(bool)) );
 
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
+    connect( page(), SIGNAL( scrollPositionChanged(QPointF)), this, SLOT( onScrollPositionChanged(QPointF)) );
+#endif
+
     // Search results highlighter
     QPalette pal = palette();
     pal.setColor( QPalette::Inactive, QPalette::Highlight, pal.color(QPalette::Active, QPalette::Highlight) );
@@ -111,6 +116,7 @@ bool ViewWindow::openUrl ( const QUrl& url )
 
     // Do not use setContent() here, it resets QWebHistory
     load( url );
+    m_scrollPosition = 0;
 
     m_newTabLinkKeeper.clear();
     mainWindow->viewWindowMgr()->setTabName( this );
@@ -232,9 +238,13 @@ void ViewWindow::zoomDecrease()
 
 int ViewWindow::getScrollbarPosition()
 {
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
+    // Tracked in onScrollPositionChanged(), so the session is saved without waiting for the pages
+    return m_scrollPosition;
+#else
     QAtomicInt value = -1;
 
-    page()->runJavaScript("document.body.scrollTop", [&value](const QVariant &v) { qDebug( "value retrieved: %d\n", v.toInt()); value = v.toInt(); });
+    page()->runJavaScript("document.body.scrollTop", [&value](const QVariant &v) { value = v.toInt(); });
 
     while ( value == -1 )
     {
@@ -242,6 +252,14 @@ int ViewWindow::getScrollbarPosition()
     }
 
     return value;
+#endif
+}
+
+void ViewWindow::onScrollPositionChanged( const QPointF& position )
+{
+    // The position is in the view pixels, while setScrollbarPosition() takes the page ones, as
+    // document.body.scrollTop gives them
+    m_scrollPosition = qRound( position.y() / qMax( zoomFactor(), 0.01 ) );
 }
 
 void ViewWindow::setScrollbarPosition(int pos, bool )
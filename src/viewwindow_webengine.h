@@ -67,6 +67,7 @@ class ViewWindow : public QWebEngineView
         * Return current scrollbar position in view window. Saved on program exit.
         * There is no restriction on returned value, except that giving this value to
         * setScrollbarPosition() should move the scrollbar in the same position.
+        * The position is tracked as the page scrolls, so this returns immediately.
         */
         int		getScrollbarPosition();
 
@@ -118,6 +119,9 @@ class ViewWindow : public QWebEngineView
         // Used to restore the scrollbar position and the navigation button status
         void			onLoadFinished ( bool ok );
 
+        // Used to track the scrollbar position
+        void			onScrollPositionChanged( const QPointF& position );
+
     private:
         QMenu 				*	m_contextMenu;
         QMenu 				*	m_contextMenuLink;
@@ -130,6 +134,9 @@ class ViewWindow : public QWebEngineView
         // It is set to -1 if no scrollbar position has been set and the page is not loaded yet
         // It is set to 0 if no scrollbar position has been set and the page is loaded already
         int						m_storedScrollbarPosition;
+
+        // The last known scrollbar position, as the page reports it when scrolled
+        int						m_scrollPosition;
 };
 
 #endif // VIEWWINDOW_WEBENGINE_H
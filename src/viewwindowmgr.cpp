@@ -16,6 +16,11 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QDateTime>
+#include <QFile>
+#include <QTimer>
+#include <QVBoxLayout>
+
 #include "config.h"
 #include "mainwindow.h"
 #include "viewwindow.h"
@@ -42,6 +47,45 @@ class ViewWindowTabWidget : public QTabWidget
 };
 
 
+// Orders the tabs from the least recently used
+class TabLastUsedLessThan
+{
+	public:
+		template< class T > bool operator()( const T * a, const T * b ) const
+		{
+			return a->lastUsed < b->lastUsed;
+		}
+};
+
+
+// Returns true if less than a tenth of the system memory is available. Only known on Linux.
+static bool isLowOnMemory()
+{
+#if defined (Q_OS_LINUX)
+	QFile file( "/proc/meminfo" );
+
+	if ( !file.open( QIODevice::ReadOnly ) )
+		return false;
+
+	qint64 total = 0, available = -1;
+
+	// The file is not seekable, so it is read line by line
+	while ( !file.atEnd() )
+	{
+		QByteArray line = file.readLine().simplified();
+
+		if ( line.startsWith( "MemTotal:" ) )
+			total = line.split( ' ' ).value( 1 ).toLongLong();
+		else if ( line.startsWith( "MemAvailable:" ) )
+			available = line.split( ' ' ).value( 1 ).toLongLong();
+	}
+
+	return total > 0 && available >= 0 && available < total / 10;
+#else
+	return false;
+#endif
+}
+
 
 ViewWindowMgr::ViewWindowMgr( QWidget *parent )
 	: QWidget( parent ), Ui::TabbedBrowser()
@@ -88,6 +132,12 @@ ViewWindowMgr::ViewWindowMgr( QWidget *parent )
 
 	connect( toolPrevious, SIGNAL(clicked()), this, SLOT( onFindPrevious()) );
 	connect( toolNext, SIGNAL(clicked()), this, SLOT( onFindNext()) );
+
+	// The idle tabs are checked every minute
+	m_currentWidget = 0;
+	m_hibernateTimer = new QTimer( this );
+	connect( m_hibernateTimer, SIGNAL( timeout() ), this, SLOT( onHibernateTimer() ) );
+	m_hibernateTimer->start( 60 * 1000 );
 }
 
 ViewWindowMgr::~ViewWindowMgr( )
@@ -114,12 +164,25 @@ ViewWindow * ViewWindowMgr::current()
 	if ( !tab )
 		abort();
 	
+	if ( !tab->window )
+		wakeTab( tab );
+
 	return tab->window;
 }
 
 ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 {
-	ViewWindow * viewvnd = new ViewWindow( m_tabWidget );
+	return createTab( set_active, true )->window;
+}
+
+ViewWindowMgr::TabData * ViewWindowMgr::createTab( bool set_active, bool live )
+{
+	// The page keeps the tab when the window is destroyed by hibernation
+	QWidget * page = new QWidget( m_tabWidget );
+	QVBoxLayout * layout = new QVBoxLayout( page );
+	layout->setContentsMargins( 0, 0, 0, 0 );
+
+	ViewWindow * viewvnd = live ? createViewWindow( page ) : 0;
 	
 	editFind->installEventFilter( this );
 	
@@ -127,7 +190,10 @@ ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 	TabData tabdata;
 	tabdata.window = viewvnd;
 	tabdata.action = new QAction( "window", this ); // temporary name; real name is set in setTabName
-	tabdata.widget = viewvnd;
+	tabdata.widget = page;
+	tabdata.lastUsed = QDateTime::currentMSecsSinceEpoch();
+	tabdata.scroll_y = 0;
+	tabdata.zoom = 1.0;
 	
 	connect( tabdata.action,
 			 SIGNAL( triggered() ),
@@ -142,6 +208,21 @@ ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 	if ( set_active || m_Windows.size() == 1 )
 		m_tabWidget->setCurrentWidget( tabdata.widget );
 	
+	// Set up the accelerator if we have room
+	if ( m_Windows.size() < 10 )
+		tabdata.action->setShortcut( QKeySequence( i18n("Alt+%1").arg( m_Windows.size() ) ) );
+	
+	// Add it to the "Windows" menu
+	m_menuWindow->addAction( tabdata.action );
+	
+	return &m_Windows.last();
+}
+
+ViewWindow * ViewWindowMgr::createViewWindow( QWidget * page )
+{
+	ViewWindow * viewvnd = new ViewWindow( page );
+	page->layout()->addWidget( viewvnd );
+
 #if defined (USE_WEBKIT)
 	// Handle clicking on link in browser window
 	connect( viewvnd,
@@ -152,16 +233,83 @@ ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 
     connect( viewvnd, SIGNAL(dataLoaded(ViewWindow*)), this, SLOT(onWindowContentChanged(ViewWindow*)));
 
-	// Set up the accelerator if we have room
-	if ( m_Windows.size() < 10 )
-		tabdata.action->setShortcut( QKeySequence( i18n("Alt+%1").arg( m_Windows.size() ) ) );
-	
-	// Add it to the "Windows" menu
-	m_menuWindow->addAction( tabdata.action );
-	
 	return viewvnd;
 }
 
+void ViewWindowMgr::hibernateTab( TabData * tab )
+{
+	if ( !tab->window )
+		return;
+
+	tab->url = tab->window->getOpenedPage();
+	tab->scroll_y = tab->window->getScrollbarPosition();
+	tab->zoom = tab->window->getZoomFactor();
+
+	tab->history.clear();
+	QDataStream stream( &tab->history, QIODevice::WriteOnly );
+	stream << *tab->window->history();
+
+	// The tab keeps its title and menu action. The window may be hibernated from its own call, like
+	// opening a new tab, so it is deleted later.
+	tab->window->hide();
+	tab->widget->layout()->removeWidget( tab->window );
+	tab->window->disconnect( this );
+	tab->window->deleteLater();
+	tab->window = 0;
+}
+
+void ViewWindowMgr::wakeTab( TabData * tab )
+{
+	tab->window = createViewWindow( tab->widget );
+
+	// Restoring the history opens its current page
+	QDataStream stream( tab->history );
+	stream >> *tab->window->history();
+
+	if ( tab->window->history()->count() == 0 )
+		tab->window->openUrl( tab->url );
+
+	tab->window->setScrollbarPosition( tab->scroll_y );
+	tab->window->setZoomFactor( tab->zoom );
+	tab->history.clear();
+}
+
+void ViewWindowMgr::hibernateIdleTabs()
+{
+	qint64 now = QDateTime::currentMSecsSinceEpoch();
+	qint64 idle = (qint64) pConfig->m_advTabHibernateMinutes * 60 * 1000;
+	bool lowmemory = isLowOnMemory();
+	QList< TabData * > live;
+
+	for ( WindowsIterator it = m_Windows.begin(); it != m_Windows.end(); ++it )
+	{
+		// The current tab is always live
+		if ( !it->window || it->widget == m_tabWidget->currentWidget() )
+			continue;
+
+		if ( lowmemory || (idle > 0 && now - it->lastUsed > idle) )
+			hibernateTab( &*it );
+		else
+			live.push_back( &*it );
+	}
+
+	// Then the least recently used ones over the limit; the current tab counts too
+	int limit = pConfig->m_advTabMaxLiveViews;
+
+	if ( limit > 0 && live.size() + 1 > limit )
+	{
+		qSort( live.begin(), live.end(), TabLastUsedLessThan() );
+
+		for ( int i = 0; i < live.size() + 1 - limit; i++ )
+			hibernateTab( live[i] );
+	}
+}
+
+void ViewWindowMgr::onHibernateTimer()
+{
+	hibernateIdleTabs();
+}
+
 void ViewWindowMgr::closeAllWindows( )
 {
 	while ( m_Windows.begin() != m_Windows.end() )
@@ -173,18 +321,21 @@ void ViewWindowMgr::setTabName( ViewWindow * window )
 	TabData * tab = findTab( window );
 	
 	if ( tab )
-	{
-        QString title = window->title().trimmed();
+		setTabTitle( tab, window->title() );
+}
+
+void ViewWindowMgr::setTabTitle( TabData * tab, const QString& text )
+{
+	QString title = text.trimmed();
 		
-		// Trim too long string
-		if ( title.length() > 25 )
-			title = title.left( 22 ) + "...";
+	// Trim too long string
+	if ( title.length() > 25 )
+		title = title.left( 22 ) + "...";
 	
-		m_tabWidget->setTabText( m_tabWidget->indexOf( window ), title );
-		tab->action->setText( title );
-		
-		updateCloseButtons();
-	}
+	m_tabWidget->setTabText( m_tabWidget->indexOf( tab->widget ), title );
+	tab->action->setText( title );
+	
+	updateCloseButtons();
 }
 
 void ViewWindowMgr::onCloseCurrentWindow( )
@@ -223,8 +374,12 @@ void ViewWindowMgr::closeWindow( QWidget * widget )
 
 	m_menuWindow->removeAction( it->action );
 	
+	if ( m_currentWidget == it->widget )
+		m_currentWidget = 0;
+
+	// The window is deleted with its page
 	m_tabWidget->removeTab( m_tabWidget->indexOf( it->widget ) );
-	delete it->window;
+	delete it->widget;
 	delete it->action;
 	
 	m_Windows.erase( it );
@@ -242,13 +397,28 @@ void ViewWindowMgr::restoreSettings( const Settings::viewindow_saved_settings_t
 	// Destroy automatically created tab
 	closeWindow( m_Windows.first().widget );
 	
+	// The tabs are restored hibernated, and are loaded when activated. The signals are blocked, so the first
+	// tab is not loaded when it becomes current; the active one is loaded by setCurrentPage().
+	m_tabWidget->blockSignals( true );
+
 	for ( int i = 0; i < settings.size(); i++ )
 	{
-		ViewWindow * window = addNewTab( false );
-		window->openUrl( settings[i].url ); // will call setTabName()
-		window->setScrollbarPosition( settings[i].scroll_y );
-		window->setZoomFactor( settings[i].zoom );
+		TabData * tab = createTab( false, false );
+		tab->url = QUrl( settings[i].url );
+		tab->scroll_y = settings[i].scroll_y;
+		tab->zoom = settings[i].zoom;
+		tab->lastUsed = 0;
+
+		QString title = ::mainWindow->chmFile()->getTopicByUrl( tab->url );
+
+		// If no title is found, use the path (without the first /)
+		if ( title.isEmpty() )
+			title = tab->url.path().mid( 1 );
+
+		setTabTitle( tab, title );
 	}
+
+	m_tabWidget->blockSignals( false );
 }
 
 
@@ -264,9 +434,12 @@ void ViewWindowMgr::saveSettings( Settings::viewindow_saved_settings_t & setting
 		if ( !tab )
 			abort();
 		
-		settings.push_back( Settings::SavedViewWindow( tab->window->getOpenedPage().toString(),
-													   tab->window->getScrollbarPosition(),
-													   tab->window->getZoomFactor()) );
+		if ( tab->window )
+			settings.push_back( Settings::SavedViewWindow( tab->window->getOpenedPage().toString(),
+														   tab->window->getScrollbarPosition(),
+														   tab->window->getZoomFactor()) );
+		else
+			settings.push_back( Settings::SavedViewWindow( tab->url.toString(), tab->scroll_y, tab->zoom ) );
 	}
 }
 
@@ -283,13 +456,26 @@ void ViewWindowMgr::onTabChanged( int newtabIndex )
 	if ( newtabIndex == -1 )
 		return;
 
+	qint64 now = QDateTime::currentMSecsSinceEpoch();
+	TabData * previous = findTab( m_currentWidget );
+
+	// The tab is idle since it is not current
+	if ( previous )
+		previous->lastUsed = now;
+
 	TabData * tab = findTab( m_tabWidget->widget( newtabIndex ) );
 	
 	if ( tab )
 	{
+		if ( !tab->window )
+			wakeTab( tab );
+
+		tab->lastUsed = now;
+		m_currentWidget = tab->widget;
+
 		tab->window->updateHistoryIcons();
 		mainWindow->browserChanged( tab->window );
-		tab->widget->setFocus();
+		tab->window->setFocus();
 	}
 }
 
@@ -317,13 +503,13 @@ void ViewWindowMgr::activateWindow()
 void ViewWindowMgr::closeSearch()
 {
 	frameFind->hide();
-	m_tabWidget->currentWidget()->setFocus();
+	current()->setFocus();
 }
 
 ViewWindowMgr::TabData * ViewWindowMgr::findTab(QWidget * widget)
 {
 	for ( WindowsIterator it = m_Windows.begin(); it != m_Windows.end(); ++it )
-		if ( it->widget == widget )
+		if ( it->widget == widget || (it->window && it->window == widget) )
 			return (it.operator->());
 		
 	return 0;
@@ -331,7 +517,14 @@ ViewWindowMgr::TabData * ViewWindowMgr::findTab(QWidget * widget)
 
 void ViewWindowMgr::setCurrentPage(int index)
 {
-	m_tabWidget->setCurrentIndex( index );
+	if ( index < 0 || index >= m_tabWidget->count() )
+		index = m_tabWidget->currentIndex();
+
+	// The restored tab which is already current is not changed, but still must be loaded
+	if ( index == m_tabWidget->currentIndex() )
+		onTabChanged( index );
+	else
+		m_tabWidget->setCurrentIndex( index );
 }
 
 int ViewWindowMgr::currentPageIndex() const
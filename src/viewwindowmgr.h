@@ -61,6 +61,11 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
 		// Set up the configuration settings
 		void	applyBrowserSettings();
 
+		// Hibernates the background tabs not used for the configured time, or all of them when the system
+		// is low on memory; also keeps the number of the live views within the configured limit. It is only
+		// called from the timer, never while a window is handling its own call.
+		void	hibernateIdleTabs();
+
 	public slots:
 		void	onCloseCurrentWindow();
 		void	onCloseWindow( int num );
@@ -78,20 +83,43 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
 		void	closeSearch();
 		
 		void	editTextEdited( const QString & text );
+		void	onHibernateTimer();
 	
 	private:
 		void	find( bool backward = false );
 		
+		// The tab page keeps the browser window. The window of the hibernated tab is destroyed, and its state is
+		// kept here until the tab is activated again.
 		typedef struct
 		{
 			QWidget			*	widget;
-            ViewWindow		*	window;
+            ViewWindow		*	window;		// 0 if the tab is hibernated
 			QAction			*	action;
+			qint64				lastUsed;	// when the tab was last current, in ms since epoch
+
+			// The state of the hibernated tab
+			QUrl				url;
+			int					scroll_y;
+			qreal				zoom;
+			QByteArray			history;
 		} TabData;
 		
 		void	closeAllWindows();
 		void	closeWindow( QWidget * widget );		
 		TabData * findTab( QWidget * widget );
+
+		// Adds the tab with its page and menu action; the browser window is created only for the live tab
+		TabData *		createTab( bool set_active, bool live );
+
+		// Creates the browser window in the tab page
+		ViewWindow *	createViewWindow( QWidget * page );
+
+		// Sets the tab and menu text, trimming it if too long
+		void	setTabTitle( TabData * tab, const QString& text );
+
+		// Destroys the window of the tab keeping its state, and creates it back
+		void	hibernateTab( TabData * tab );
+		void	wakeTab( TabData * tab );
 				
 		// Storage of all available windows
 		QList< TabData >	m_Windows;
@@ -109,6 +137,10 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
         QString                 m_lastSearchedWord;
 
 		ViewWindowTabWidget	*	m_tabWidget;
+
+		// The tab which was current before, and the timer checking for the idle tabs
+		QWidget				*	m_currentWidget;
+		QTimer				*	m_hibernateTimer;
 };
 
 #endif /* INCLUDE_KCHMVIEWWINDOWMGR_H */
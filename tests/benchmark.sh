@@ -0,0 +1,52 @@
+#!/bin/sh
+
+CHMDIR="/mnt/ebooks /mnt/disk_d/Docs"
+#KCHMVIEWER="../src/kchmviewer"
+KCHMVIEWER="../bin/kchmviewer"
+BENCHLOG="benchmark.log"
+CMDOPTIONS="--nocrashhandler"
+
+# The time budgets in milliseconds: the average time of a query of each type, the worst
+# time to make the snippets for 100 results, and the average time to filter the contents.
+QUERYBUDGET=100
+SNIPPETBUDGET=50
+TOCBUDGET=10
+
+FAILED=0
+
+find $CHMDIR -iname "*.chm" -print > benchmark.list
+
+while read file; do
+
+echo "Benchmarking file $file"
+echo "File $file" >> $BENCHLOG
+
+# The index is built on the first run if it is not cached yet, so the second run is measured
+$KCHMVIEWER $CMDOPTIONS --benchmarksearch "$file" </dev/null >/dev/null 2>&1
+OUTPUT=`$KCHMVIEWER $CMDOPTIONS --benchmarksearch "$file" </dev/null 2>&1`
+echo "$OUTPUT" >> $BENCHLOG
+
+# The lines are: type, query, "min"/"max" time "ms,", "avg" time "ms,", documents
+echo "$OUTPUT" | awk -v querybudget=$QUERYBUDGET -v snippetbudget=$SNIPPETBUDGET -v tocbudget=$TOCBUDGET '
+	/ ms, / {
+		for ( i = 2; i < NF; i++ )
+		{
+			if ( $1 == "snippets" && $i == "max" && $(i+1) > snippetbudget )
+				{ print "  snippets took " $(i+1) " ms, the budget is " snippetbudget " ms"; failed = 1 }
+			else if ( $1 ~ /^toc/ && $i == "avg" && $(i+1) > tocbudget )
+				{ print "  " $1 " filter took " $(i+1) " ms, the budget is " tocbudget " ms"; failed = 1 }
+			else if ( $1 != "snippets" && $1 !~ /^toc/ && $i == "avg" && $(i+1) > querybudget )
+				{ print "  " $1 " query took " $(i+1) " ms, the budget is " querybudget " ms"; failed = 1 }
+		}
+	}
+	END { exit failed }'
+
+if test $? != 0; then
+	echo "$file is over the budget"
+	FAILED=1
+fi
+
+done < benchmark.list
+
+rm -f benchmark.list
+exit $FAILED